@@ -2,7 +2,9 @@
 #define __RN487X
 
 #include "eonOS.h"
+#include "rn487x_const.h"
 #include "rn487x_defines.h"
+#include "rn487x_trace.h"
 #include <stdbool.h>
 #include <string.h>
 
@@ -13,12 +15,581 @@
  */
 #define RN487X_DEFAULT_BAUDRATE 115200
 
+// Longest command text (without the trailing CR) an rn487x_cmd_t can hold
+#ifndef RN487X_CMD_LEN
+#define RN487X_CMD_LEN 80
+#endif
+
+// Commands of a pipeline allowed in flight at the same time. Pipelining
+// hides the reply round trips, not the transmit time: on a saturated
+// UART it gains little whatever the depth (see rn487x_pipeline).
+#ifndef RN487X_PIPELINE_DEPTH
+#define RN487X_PIPELINE_DEPTH 4
+#endif
+
+// Longest reply line kept by the command engine
+#ifndef RN487X_LINE_LEN
+#define RN487X_LINE_LEN 128
+#endif
+
+// RX ring size, a power of two larger than RN487X_LINE_LEN
+#ifndef RN487X_RX_RING_LEN
+#define RN487X_RX_RING_LEN 256
+#endif
+
+// TX ring of the DMA backend (RN487X_TX_DMA), a power of two larger than
+// RN487X_CMD_LEN. The platform provides BLE_SERIAL_DMA_START(buf, len) and
+// calls rn487x_txDmaDone() from its transfer-complete interrupt; when that
+// interrupt can preempt the driver, RN487X_TX_LOCK/RN487X_TX_UNLOCK must
+// mask it.
+#ifndef RN487X_TX_RING_LEN
+#define RN487X_TX_RING_LEN 256
+#endif
+#ifndef RN487X_TX_LOCK
+#define RN487X_TX_LOCK()
+#define RN487X_TX_UNLOCK()
+#endif
+
+// Entries of the event handler table
+#ifndef RN487X_MAX_EVENT_HANDLERS
+#define RN487X_MAX_EVENT_HANDLERS 8
+#endif
+
+// Optional features, each with its state in rn487x_t and its functions
+// compiled only when the macro is defined (like RN487X_METRICS):
+//   RN487X_STREAM  paced transparent UART stream (rn487x_streamWrite)
+//   RN487X_SHADOW  write-combining shadow of the local characteristic
+//                  values (rn487x_shadowConfig)
+//   RN487X_BATCH   batched characteristic reads and writes
+//                  (rn487x_writeLocalCharacts, rn487x_readRemoteCharacts)
+//   RN487X_SCAN    scan report parser, duplicate filter and result ring
+//                  (rn487x_startScan)
+//   RN487X_BEACON  beacon rotation (rn487x_beaconSlot)
+
+// Transparent UART stream buffer, a power of two
+#ifndef RN487X_STREAM_BUF_LEN
+#define RN487X_STREAM_BUF_LEN 512
+#endif
+
+// Default stream chunk: ATT payload of the default 23-byte MTU
+#ifndef RN487X_STREAM_CHUNK
+#define RN487X_STREAM_CHUNK 20
+#endif
+
+// Default stream pacing [B/s] and the bytes the module may buffer ahead
+#ifndef RN487X_STREAM_RATE
+#define RN487X_STREAM_RATE 8000
+#endif
+#ifndef RN487X_STREAM_BURST
+#define RN487X_STREAM_BURST 128
+#endif
+
+// Write-combining window of the local characteristic values [ms]. With 0,
+// rn487x_writeLocalCharact sends the SHW right away unless the value is
+// unchanged; otherwise the writes of a window collapse into one SHW of
+// the last value, sent from rn487x_process() in command mode.
+#ifndef RN487X_SHADOW_WINDOW
+#define RN487X_SHADOW_WINDOW 0
+#endif
+
+// Scan: ring of the latest reports and duplicate filter, powers of two
+#ifndef RN487X_SCAN_RING_LEN
+#define RN487X_SCAN_RING_LEN 8
+#endif
+#ifndef RN487X_SCAN_FILTER_LEN
+#define RN487X_SCAN_FILTER_LEN 64
+#endif
+
+// Beacon rotation: frames of the schedule and AD structures per frame,
+// one IB command each
+#ifndef RN487X_BEACON_SLOTS
+#define RN487X_BEACON_SLOTS 4
+#endif
+#ifndef RN487X_BEACON_ADS
+#define RN487X_BEACON_ADS 3
+#endif
+
+// Time from the wake line going low to a usable UART (RN4871 low power)
+#ifndef RN487X_WAKE_TIME_MS
+#define RN487X_WAKE_TIME_MS 5
+#endif
+
+// Command metrics (RN487X_METRICS): latency histogram buckets per command
+// class, bucket b counting the replies within [2^b, 2^(b+1)) ms, the first
+// one from 0 ms and the last one without upper bound
+#ifndef RN487X_METRIC_BUCKETS
+#define RN487X_METRIC_BUCKETS 8
+#endif
+
+// Adaptive timeouts of the idempotent commands (RN487X_CMD_FLAG_RETRY):
+// per command class, the reply timeout follows the smoothed reply time
+// plus four deviations, as TCP does, never below RN487X_TIMEOUT_MIN_MS
+// nor above the timeout of the command. A command timing out is resent
+// up to RN487X_RETRIES times, the n-th time after RN487X_RETRY_BACKOFF_MS
+// << (n - 1) and with a doubled timeout. Only the commands expecting a
+// bare AOK are resent: any reply of any attempt completes them alike. The
+// replies owed by the earlier attempts are then drained, the next command
+// held back until they came or one more reply timeout elapsed, so none of
+// them lands on a later command.
+#ifndef RN487X_TIMEOUT_MIN_MS
+#define RN487X_TIMEOUT_MIN_MS 50
+#endif
+#ifndef RN487X_RETRIES
+#define RN487X_RETRIES 2
+#endif
+#ifndef RN487X_RETRY_BACKOFF_MS
+#define RN487X_RETRY_BACKOFF_MS 5
+#endif
+
+// Trace ring (RN487X_TRACE), records of 12 bytes, a power of two
+#ifndef RN487X_TRACE_LEN
+#define RN487X_TRACE_LEN 32
+#endif
+
+// Remote characteristics kept by the client role (rn487x_discoverRemote)
+#ifndef RN487X_REMOTE_MAX_CHARACTS
+#define RN487X_REMOTE_MAX_CHARACTS 16
+#endif
+
 typedef struct
 {
   uint16_t index;
   uint16_t length;
 } ble_charact_t;
 
+// Declarative GATT schema, meant for static const tables. UUIDs are upper
+// case hex (4 or 32 digits), as listed by LS.
+typedef struct
+{
+  const char *uuid;
+  uint8_t property;        // BLE_PROPERTY_*
+  uint8_t length;          // octets, 0x01-0x14
+  ble_charact_t *charact;  // optional, gets its index and length
+} rn487x_charact_def_t;
+
+typedef struct
+{
+  const char *uuid;
+  const rn487x_charact_def_t *characts;
+  uint8_t count;
+} rn487x_service_def_t;
+
+// Characteristic handles saved by the application (NVM, flash) to skip the
+// LS listing at boot. hash covers the service and characteristic definitions
+// accepted by the module since the last PZ; the cache is used only on a match.
+typedef struct
+{
+  uint32_t hash;
+  uint16_t count;
+  uint16_t handles[BLE_MAX_NUMBER_OF_CHARACTERISTICS];
+} rn487x_handle_cache_t;
+
+typedef bool (*rn487x_cache_load_t)(rn487x_handle_cache_t *cache, void *arg);
+typedef bool (*rn487x_cache_store_t)(const rn487x_handle_cache_t *cache, void *arg);
+
+// Command flags
+#define RN487X_CMD_FLAG_RAW 0x01      // send the text as is, without the trailing CR
+#define RN487X_CMD_FLAG_PIPELINE 0x02 // may be sent while other pipelined commands are in flight
+#define RN487X_CMD_FLAG_RETRY 0x04    // idempotent, resent on a timeout if it expects a bare AOK (SHW always is)
+
+typedef enum
+{
+  RN487X_CMD_QUEUED = 0, // waiting for the previous commands to complete
+  RN487X_CMD_SENT,       // sent, waiting for the reply
+  RN487X_CMD_OK,         // expected reply received
+  RN487X_CMD_ERR,        // a different reply was received
+  RN487X_CMD_TIMEOUT     // no reply within the timeout
+} rn487x_status_t;
+
+// Replies told apart by the response matcher, as the bytes come in
+typedef enum
+{
+  RN487X_REPLY_UNKNOWN = 0, // no reply (yet), or another line (data)
+  RN487X_REPLY_AOK,
+  RN487X_REPLY_ERR,         // Err or ERR
+  RN487X_REPLY_PROMPT,      // CMD>
+  RN487X_REPLY_END,
+  RN487X_REPLY_NONE,        // none
+  RN487X_REPLY_NA,          // N/A
+  RN487X_REPLY_REBOOTING
+} rn487x_reply_t;
+
+// Event view, valid only during the handler call
+typedef struct
+{
+  const char *name; // not NUL terminated
+  uint16_t nameLen;
+  const char *args; // text after the first comma, not NUL terminated
+  uint16_t argsLen;
+} rn487x_event_t;
+
+typedef void (*rn487x_event_cb_t)(const rn487x_event_t *evt, void *arg);
+
+// Data received from the peer in data mode, valid only during the call
+typedef void (*rn487x_data_cb_t)(const uint8_t *data, uint16_t len, void *arg);
+
+// Command text builder, tracks the length so nothing is cleared or rescanned
+typedef struct
+{
+  char *buf;
+  uint16_t size; // including the terminating NUL
+  uint16_t len;
+  bool overflow;
+} rn487x_cmdbuf_t;
+
+typedef struct rn487x rn487x_t;
+typedef struct rn487x_cmd rn487x_cmd_t;
+typedef void (*rn487x_cmd_cb_t)(rn487x_cmd_t *cmd);
+typedef void (*rn487x_line_cb_t)(rn487x_cmd_t *cmd, const char *line, uint16_t len);
+
+// Asynchronous command. The memory is owned by the caller and must stay
+// valid until the command completes (status >= RN487X_CMD_OK).
+struct rn487x_cmd
+{
+  char text[RN487X_CMD_LEN];
+  const char *expected;     // reply completing the command with RN487X_CMD_OK (NULL: any line)
+  uint16_t timeout;         // [ms] from the moment the command is sent
+  uint8_t flags;            // RN487X_CMD_FLAG_*
+  rn487x_cmd_cb_t callback; // optional, called from rn487x_process() on completion
+  rn487x_line_cb_t onLine;  // optional, receives the lines before the expected reply
+  void *arg;                // free for the caller
+  char *resp;               // optional buffer receiving the completing reply line
+  uint16_t respSize;
+  uint16_t respLen;
+  volatile rn487x_status_t status;
+  rn487x_reply_t reply; // known reply that completed the command
+  // private
+  uint8_t expectKind; // rn487x_reply_t of expected, matched without scanning the line
+  uint32_t sentAt;
+  uint16_t wait;   // [ms] timeout of the current attempt
+  uint8_t cls;     // rn487x_metric_class_t
+  uint8_t attempt; // resends so far
+  uint16_t txEnd;  // TX ring position after the command (RN487X_TX_DMA)
+  rn487x_t *dev;  // instance the command was submitted to
+  rn487x_cmd_t *next;
+#ifdef RN487X_METRICS
+  uint32_t metricAt; // first sent at, sentAt moves with the pipeline
+#endif
+};
+
+// Advertisement report of a scan
+typedef struct
+{
+  uint8_t address[6];  // most significant byte first, as printed
+  uint8_t addressType; // 0 public, 1 random
+  int8_t rssi;         // [dBm]
+  uint8_t dataLen;
+  uint8_t data[31];    // raw advertising data (Brcst reports)
+} rn487x_scan_report_t;
+
+typedef struct
+{
+  uint32_t reports;     // reports parsed
+  uint32_t duplicates;  // reports dropped by the duplicate filter
+  uint32_t overwritten; // results lost on a full ring
+  uint32_t invalid;     // reports that could not be parsed
+} rn487x_scan_stats_t;
+
+// Cost of the beacon rotation since rn487x_startBeaconRotation. The CPU
+// time is that of rn487x_process() putting the slots on air, UART writes
+// included unless they are interrupt or DMA driven.
+typedef struct
+{
+  uint32_t rotations; // slots put on air, all their commands answered
+  uint32_t failures;  // rotations with a command not acknowledged
+  uint32_t commands;  // IB commands sent, IB,Z included
+  uint32_t txBytes;   // bytes of those commands, CRs included
+  uint32_t cpuUs;
+  uint32_t cpuMaxUs;  // longest rotation
+} rn487x_beacon_stats_t;
+
+// IB commands of a beacon frame, NUL separated: "IB,tt,<hex>" for each
+// AD structure, at most 2 hex digits per payload byte plus 5 characters
+#define RN487X_BEACON_TEXT_LEN (2 * MAX_ADV_DATA_LEN + 3 * RN487X_BEACON_ADS)
+
+// Element of a batch of local characteristic writes
+typedef struct
+{
+  ble_charact_t *charact;
+  const uint8_t *value;   // charact->length octets
+  rn487x_status_t status; // set by rn487x_writeLocalCharacts
+} rn487x_charact_write_t;
+
+// Element of a pipelined read of remote characteristics
+typedef struct
+{
+  const char *uuid;       // as listed by LC, case does not matter
+  uint8_t *value;
+  uint8_t size;           // capacity of value
+  uint8_t length;         // octets read
+  rn487x_status_t status; // set by rn487x_readRemoteCharacts
+} rn487x_remote_read_t;
+
+// Power states of the module as driven by the driver (rn487x_powerConfig)
+typedef enum
+{
+  RN487X_POWER_AWAKE = 0, // wake line low, UART usable
+  RN487X_POWER_WAKING,    // wake line low for less than RN487X_WAKE_TIME_MS
+  RN487X_POWER_SLEEP,     // wake line high, the module sleeps in low power mode (SO,1)
+  RN487X_POWER_DORMANT,   // O,0 sent, back on a hardware reset
+  RN487X_POWER_STATES
+} rn487x_power_state_t;
+
+typedef struct
+{
+  uint32_t ms[RN487X_POWER_STATES]; // time spent in each state
+  uint32_t wakeups;                 // sleep to awake transitions
+  uint32_t commands;                // commands sent, per wake-up: the batching
+} rn487x_power_stats_t;
+
+// Command classes of the metrics and the adaptive timeouts, by command
+// text prefix
+typedef enum
+{
+  RN487X_METRIC_PS = 0, // PS, service definition
+  RN487X_METRIC_PC,     // PC, characteristic definition
+  RN487X_METRIC_SHW,
+  RN487X_METRIC_SHR,
+  RN487X_METRIC_LS,
+  RN487X_METRIC_CMD,    // $$$
+  RN487X_METRIC_REBOOT, // R,1
+  RN487X_METRIC_OTHER,
+  RN487X_METRIC_CLASSES
+} rn487x_metric_class_t;
+
+// Counters saturate rather than wrap
+typedef struct
+{
+  uint32_t calls;    // completed commands
+  uint16_t timeouts; // no reply within the timeout
+  uint16_t errors;   // a different reply than the expected one
+  uint16_t maxMs;    // replies only, like the histogram
+  uint16_t retries;  // resends after a timeout
+  uint32_t totalMs;
+  uint16_t histogram[RN487X_METRIC_BUCKETS];
+} rn487x_metric_t;
+
+typedef struct
+{
+  rn487x_metric_t classes[RN487X_METRIC_CLASSES];
+  uint32_t since; // [ms] instance setup or last rn487x_metricsReset
+} rn487x_metrics_t;
+
+// Serial link and control lines of a module. Every function gets arg
+// back. dmaStart is used with RN487X_TX_DMA only; setReset and setWake
+// may be NULL when the line is not wired, setBaudrate and
+// setFlowControl when the host UART settings are fixed
+// (rn487x_dev_setBaudrate then fails).
+typedef struct
+{
+  int (*available)(void *arg);
+  int (*read)(void *arg);
+  void (*write)(void *arg, uint8_t c);
+  void (*dmaStart)(void *arg, const uint8_t *buf, uint16_t len);
+  void (*setBaudrate)(void *arg, uint32_t baudrate);
+  void (*setFlowControl)(void *arg, bool enable);
+  void (*setReset)(void *arg, bool level); // RST_N, low holds the module in reset
+  void (*setWake)(void *arg, bool level);  // P2_7 (RN4871), low wakes the module up
+  void *arg;
+} rn487x_io_t;
+
+// Driver instance, one per module. The fields are private: set it up
+// with rn487x_dev_setup() and use the rn487x_dev_* functions. Instances
+// share nothing, so each one may be driven from its own loop or task.
+struct rn487x
+{
+  rn487x_io_t io;
+  char uartBuffer[RN487X_LINE_LEN]; // reply line of the blocking functions
+  char deviceName[MAX_DEVICE_NAME_LEN];
+  uint16_t charactHandles[BLE_MAX_NUMBER_OF_CHARACTERISTICS];
+  uint8_t operationMode;
+  uint32_t baudrate;
+  uint16_t charactIdCnt;
+
+  // Command engine
+  rn487x_cmd_t syncCmd;  // used by the blocking functions
+  rn487x_cmd_t *cmdHead; // in flight once its status is RN487X_CMD_SENT
+  rn487x_cmd_t *cmdTail;
+  rn487x_cmd_t *cmdNext; // first command not sent yet
+  uint8_t cmdInflight;
+
+  // RX ring, single producer (rn487x_dev_rxFeed) and single consumer (the
+  // line framer). Indexes are free running and masked on access.
+  uint8_t rxRing[RN487X_RX_RING_LEN];
+  volatile uint16_t rxHead; // written by the producer only
+  volatile uint16_t rxTail; // start of the line being framed
+  uint16_t rxScan;          // next byte to frame
+  volatile uint16_t rxOverruns;
+  char rxLine[RN487X_LINE_LEN]; // lines wrapping around the ring end
+  bool rxInEvent;
+  bool rxCr;           // last byte framed was a CR
+  uint16_t rxEventAt;  // start of the event being framed
+  uint8_t rxDataMatch; // bytes of %DISCONNECT% matched in data mode
+  uint8_t rxMatch;     // known replies the line being framed may still be
+
+#ifdef RN487X_TX_DMA
+  // TX ring, the bytes between txTail and txTail + txDmaLen are being
+  // transmitted and must not be touched
+  uint8_t txRing[RN487X_TX_RING_LEN];
+  volatile uint16_t txHead; // free running, written by the driver
+  volatile uint16_t txTail; // free running, written on DMA completion
+  volatile uint16_t txDmaLen;
+#endif
+
+  // Events
+  struct
+  {
+    const char *name;
+    rn487x_event_cb_t callback;
+    void *arg;
+  } eventHandlers[RN487X_MAX_EVENT_HANDLERS];
+  rn487x_event_cb_t eventDefault;
+  void *eventDefaultArg;
+  rn487x_data_cb_t dataHandler;
+  void *dataArg;
+  bool connected;
+  volatile bool booted; // %REBOOT% seen since the last _bootArm()
+
+  // $$$ guard time, only needed after transparent UART data
+  uint32_t dataTxAt;
+  bool dataTxPending;
+
+#ifdef RN487X_STREAM
+  // Transparent UART stream, paced by a token bucket in milli-bytes
+  uint8_t streamBuf[RN487X_STREAM_BUF_LEN];
+  uint16_t streamHead; // free running, like the RX ring
+  uint16_t streamTail;
+  uint16_t streamChunk;
+  uint32_t streamRate;
+  uint32_t streamCredit;
+  uint32_t streamCreditAt;
+#endif
+
+#ifdef RN487X_SHADOW
+  // Shadow copy of the local characteristic values, by characteristic index
+  struct
+  {
+    uint8_t value[MAX_CHARACT_VALUE_LEN];
+    uint8_t length;
+    uint8_t flags;    // SHADOW_*
+    uint32_t dirtyAt; // first write of the pending value
+  } shadow[BLE_MAX_NUMBER_OF_CHARACTERISTICS];
+  uint8_t shadowDirty; // entries with SHADOW_DIRTY
+  uint16_t shadowWindow;
+  rn487x_cmd_t shadowCmd;
+  bool shadowBusy;   // shadowCmd in flight
+  bool shadowFailed; // an SHW of shadowCmd failed
+#endif
+
+#ifdef RN487X_SCAN
+  // Scan results, written and read from the main loop only. The filter
+  // is 2-way set associative on the address hash; an entry holds the
+  // upper half of the address hash and 16 bits of the report hash.
+  bool scanning;
+  rn487x_scan_report_t scanRing[RN487X_SCAN_RING_LEN];
+  uint16_t scanHead; // free running
+  uint16_t scanTail;
+  uint32_t scanFilter[RN487X_SCAN_FILTER_LEN];
+  rn487x_scan_stats_t scanStats;
+#endif
+
+#ifdef RN487X_BEACON
+  // Beacon rotation, encoded once by rn487x_dev_beaconSlot and put on
+  // air by rn487x_dev_process(), IB,Z first
+  struct
+  {
+    char text[RN487X_BEACON_TEXT_LEN];
+    uint8_t count;  // IB commands in text, 0: empty slot
+    uint16_t dwell; // [ms] on air
+  } beaconSlots[RN487X_BEACON_SLOTS];
+  rn487x_cmd_t beaconCmds[1 + RN487X_BEACON_ADS];
+  uint8_t beaconSlot;    // on air, or being put on air
+  uint8_t beaconPending; // beaconCmds in flight
+  bool beaconRunning;
+  bool beaconOnAir;  // beaconSlot put on air since the start
+  bool beaconFailed; // a command of the rotation in flight failed
+  uint32_t beaconAt; // beaconSlot put on air at
+  rn487x_beacon_stats_t beaconStats;
+#endif
+
+#ifdef RN487X_BATCH
+  // Batch commands, reused as their replies come in
+  rn487x_cmd_t batchCmds[RN487X_PIPELINE_DEPTH];
+#endif
+
+  // Client role: remote characteristics found by the last discovery
+  struct
+  {
+    uint32_t uuid; // FNV-1a of the upper case UUID
+    uint16_t handle;
+    uint8_t property;
+  } remote[RN487X_REMOTE_MAX_CHARACTS];
+  uint8_t remoteCnt;
+  bool remoteOverflow;
+
+  // LS parsing
+  uint16_t listIndex;
+  bool listOverflow;
+
+  // GATT schema diff against the LS listing
+  struct
+  {
+    const rn487x_service_def_t *services;
+    uint8_t count;
+    uint8_t service;                  // services listed so far
+    uint8_t charact;                  // characteristics listed in the current service
+    const rn487x_charact_def_t *last; // last characteristic listed
+    bool match;
+  } schema;
+
+  // Power manager, sleeps after powerIdle ms without traffic and holds
+  // the commands submitted while asleep for powerHold ms
+  uint8_t powerState; // rn487x_power_state_t
+  uint16_t powerIdle; // 0: never sleeps on its own
+  uint16_t powerHold;
+  uint32_t powerSince;    // state entered at
+  uint32_t powerActiveAt; // last byte sent
+  uint32_t powerHeldAt;   // first command held back
+  bool powerHeld;
+  rn487x_power_stats_t powerStats;
+
+  // Adaptive timeouts: reply time of each command class, smoothed as
+  // TCP does (RFC 6298), in 1/8 ms and 1/4 ms
+  struct
+  {
+    uint32_t srtt8;
+    uint32_t rttvar4;
+    uint16_t samples;
+  } rtt[RN487X_METRIC_CLASSES];
+  uint8_t retries; // resends allowed per command, 0: fixed timeouts
+  uint16_t timeoutMin;
+  uint32_t retryAt;      // backoff started at
+  uint16_t retryBackoff; // [ms] commands held back, 0 when not backing off
+  uint8_t replyOwed;     // replies of the attempts sent again, still to come
+  bool replyDrain;       // the backoff waits for replyOwed, not for a resend
+
+#ifdef RN487X_METRICS
+  // Command metrics, updated on completion
+  rn487x_metrics_t metrics;
+#endif
+
+#ifdef RN487X_TRACE
+  // Trace ring, written from the main loop only. Indexes are free
+  // running; the oldest records are overwritten.
+  rn487x_trace_rec_t trace[RN487X_TRACE_LEN];
+  uint32_t traceHead;
+  uint32_t traceTail;
+  uint32_t traceLost;      // records overwritten before being read
+  uint16_t traceOverruns;  // rxOverruns already traced
+#endif
+
+  // Handle cache
+  uint32_t definitionHash; // FNV-1a of the accepted PS/PC commands
+  rn487x_cache_load_t cacheLoad;
+  rn487x_cache_store_t cacheStore;
+  void *cacheArg;
+};
+
 // Advertising types
 #define BLE_ADTYPE_FLAGS 0x01
 #define BLE_ADTYPE_INCOMPLETE_16_UUID 0x02
@@ -41,6 +612,16 @@ typedef struct
 #define BLE_ADTYPE_SERVICE_DATA 0x16
 #define BLE_ADTYPE_MANUFACTURE_SPECIFIC_DATA 0xFF
 
+// Events (%NAME,args%) sent by the module
+#define BLE_EVENT_REBOOT "REBOOT"
+#define BLE_EVENT_CONNECT "CONNECT"           // %CONNECT,<addr type>,<address>%
+#define BLE_EVENT_DISCONNECT "DISCONNECT"
+#define BLE_EVENT_CONN_PARAM "CONN_PARAM"     // %CONN_PARAM,<interval>,<latency>,<timeout>%
+#define BLE_EVENT_STREAM_OPEN "STREAM_OPEN"
+#define BLE_EVENT_WRITE_VALUE "WV"            // %WV,<handle>,<hex value>%
+#define BLE_EVENT_INDICATION "IND"            // %IND,<handle>,<hex value>%
+#define BLE_EVENT_NOTIFICATION "NOTI"         // %NOTI,<handle>,<hex value>%
+
 // BLE Properties
 #define BLE_PROPERTY_INDICATE 0b00100000
 #define BLE_PROPERTY_NOTIFY 0b00010000
@@ -54,22 +635,233 @@ typedef struct
  ===============================================================================
  */
 
+// Instance setup
+
+void rn487x_dev_setup(rn487x_t *dev, const rn487x_io_t *io);
+
+// Init and general functions
+
+bool rn487x_dev_init(rn487x_t *dev);
+void rn487x_dev_hwReset(rn487x_t *dev);
+void rn487x_dev_hwWakeUp(rn487x_t *dev);
+void rn487x_dev_hwSleep(rn487x_t *dev);
+bool rn487x_dev_setSerializedName(rn487x_t *dev, const char *newName);
+bool rn487x_dev_setDeviceName(rn487x_t *dev, const char *dName);
+bool rn487x_dev_reboot(rn487x_t *dev);
+int8_t rn487x_dev_getConnectionStatus(rn487x_t *dev);
+// A failed switch restores the old settings and returns false in
+// BAUD_SWITCH_MAX_MS (12.25 s) at most, about 3.5 s when only the
+// module replies are lost at the new rate
+bool rn487x_dev_setBaudrate(rn487x_t *dev, uint32_t baudrate, bool flowControl);
+uint32_t rn487x_dev_getBaudrate(rn487x_t *dev);
+
+// Modes
+
+bool rn487x_dev_dataMode(rn487x_t *dev);
+bool rn487x_dev_cmdMode(rn487x_t *dev);
+
+// Power
+
+bool rn487x_dev_setLowPower(rn487x_t *dev, bool enable);
+bool rn487x_dev_powerConfig(rn487x_t *dev, uint16_t idleMs, uint16_t holdMs);
+rn487x_power_state_t rn487x_dev_powerState(rn487x_t *dev);
+void rn487x_dev_powerStats(rn487x_t *dev, rn487x_power_stats_t *stats);
+void rn487x_dev_dormant(rn487x_t *dev);
+
+// Timeouts
+
+void rn487x_dev_retryConfig(rn487x_t *dev, uint8_t retries, uint16_t timeoutMinMs);
+uint16_t rn487x_dev_adaptiveTimeout(rn487x_t *dev, rn487x_metric_class_t cls);
+
+#ifdef RN487X_METRICS
+// Metrics
+
+void rn487x_dev_metrics(rn487x_t *dev, rn487x_metrics_t *snapshot);
+void rn487x_dev_metricsReset(rn487x_t *dev);
+#endif
+
+#ifdef RN487X_TRACE
+// Trace
+
+uint16_t rn487x_dev_traceRead(rn487x_t *dev, rn487x_trace_rec_t *recs, uint16_t max);
+uint32_t rn487x_dev_traceLost(rn487x_t *dev);
+void rn487x_dev_traceMark(rn487x_t *dev, uint8_t a, uint16_t b, uint32_t c);
+#endif
+
+// Advertisements
+
+bool rn487x_dev_setAdvPower(rn487x_t *dev, uint8_t value);
+bool rn487x_dev_setConnPower(rn487x_t *dev, uint8_t value);
+bool rn487x_dev_stopAdvertising(rn487x_t *dev);
+bool rn487x_dev_clearImmediateAdvertising(rn487x_t *dev);
+bool rn487x_dev_startImmediateAdvertising(rn487x_t *dev, uint8_t advType, const uint8_t *advData, size_t size);
+
+// Beacon
+
+bool rn487x_dev_setBeaconFeatures(rn487x_t *dev, const char *mode);
+bool rn487x_dev_clearImmediateBeacon(rn487x_t *dev);
+bool rn487x_dev_startImmediateBeacon(rn487x_t *dev, uint8_t adType, const uint8_t *adData, size_t size);
+bool rn487x_dev_clearPermanentBeacon(rn487x_t *dev);
+bool rn487x_dev_startPermanentBeacon(rn487x_t *dev, uint8_t adType, const uint8_t *adData, size_t size);
+#ifdef RN487X_BEACON
+bool rn487x_dev_beaconSlot(rn487x_t *dev, uint8_t slot, const uint8_t *frame, uint8_t size, uint16_t dwellMs);
+bool rn487x_dev_startBeaconRotation(rn487x_t *dev);
+void rn487x_dev_stopBeaconRotation(rn487x_t *dev);
+void rn487x_dev_beaconStats(rn487x_t *dev, rn487x_beacon_stats_t *stats);
+#endif
+
+#ifdef RN487X_SCAN
+// Scan
+
+bool rn487x_dev_startScan(rn487x_t *dev, uint16_t interval, uint16_t window);
+bool rn487x_dev_stopScan(rn487x_t *dev);
+bool rn487x_dev_scanRead(rn487x_t *dev, rn487x_scan_report_t *report);
+void rn487x_dev_scanStats(rn487x_t *dev, rn487x_scan_stats_t *stats);
+#endif
+
+// Send command
+
+void rn487x_dev_sendCommand(rn487x_t *dev, const char *cmd);
+
+// Transparent UART data
+
+void rn487x_dev_sendData(rn487x_t *dev, const char *data, uint16_t dataLen);
+void rn487x_dev_onData(rn487x_t *dev, rn487x_data_cb_t callback, void *arg);
+#ifdef RN487X_STREAM
+uint16_t rn487x_dev_streamWrite(rn487x_t *dev, const uint8_t *data, uint16_t len);
+uint16_t rn487x_dev_streamFree(rn487x_t *dev);
+uint16_t rn487x_dev_streamPending(rn487x_t *dev);
+void rn487x_dev_streamConfig(rn487x_t *dev, uint16_t chunkLen, uint32_t rate);
+#endif
+
+// Command builder
+
+void rn487x_cmdbufInit(rn487x_cmdbuf_t *cb, char *buf, uint16_t size);
+void rn487x_cmdbufAppend(rn487x_cmdbuf_t *cb, const char *data, uint16_t len);
+void rn487x_cmdbufAppendChar(rn487x_cmdbuf_t *cb, char c);
+void rn487x_cmdbufAppendHex(rn487x_cmdbuf_t *cb, const uint8_t *data, uint16_t len);
+void rn487x_cmdbufAppendHexU8(rn487x_cmdbuf_t *cb, uint8_t value);
+void rn487x_cmdbufAppendHexU16(rn487x_cmdbuf_t *cb, uint16_t value);
+bool rn487x_cmdbufEnd(rn487x_cmdbuf_t *cb);
+// Constant prefix, its length is known at compile time
+#define rn487x_cmdbufAppendLit(__cb__, __lit__) rn487x_cmdbufAppend((__cb__), (__lit__), sizeof(__lit__) - 1)
+
+// Command engine (non-blocking)
+
+bool rn487x_cmdPrepare(rn487x_cmd_t *cmd, const char *text, const char *expected, uint16_t timeout);
+bool rn487x_dev_submit(rn487x_t *dev, rn487x_cmd_t *cmd);
+bool rn487x_cmdDone(const rn487x_cmd_t *cmd);
+bool rn487x_dev_isIdle(rn487x_t *dev);
+void rn487x_dev_process(rn487x_t *dev);
+void rn487x_dev_rxFeed(rn487x_t *dev, uint8_t c);
+void rn487x_dev_txDmaDone(rn487x_t *dev);
+bool rn487x_dev_txIdle(rn487x_t *dev);
+uint16_t rn487x_dev_rxOverruns(rn487x_t *dev);
+rn487x_reply_t rn487x_dev_lastReply(rn487x_t *dev);
+
+// Events
+
+bool rn487x_dev_onEvent(rn487x_t *dev, const char *name, rn487x_event_cb_t callback, void *arg);
+bool rn487x_dev_isConnected(rn487x_t *dev);
+uint8_t rn487x_dev_pipeline(rn487x_t *dev, rn487x_cmd_t *cmds, uint8_t count);
+
+// Services
+
+bool rn487x_dev_deviceService_setManufName(rn487x_t *dev, const char *name);
+bool rn487x_dev_setServiceUUID(rn487x_t *dev, const char *uuid);
+bool rn487x_dev_prepareServiceUUID(rn487x_t *dev, rn487x_cmd_t *cmd, const char *uuid);
+bool rn487x_dev_clearAllServices(rn487x_t *dev);
+
+// Characteristics
+
+bool rn487x_dev_setCharactUUID(rn487x_t *dev, ble_charact_t *bc, const char *uuid, uint8_t property, uint8_t octetLen);
+bool rn487x_dev_prepareCharactUUID(rn487x_t *dev, rn487x_cmd_t *cmd, ble_charact_t *bc, const char *uuid, uint8_t property, uint8_t octetLen);
+bool rn487x_dev_writeLocalCharact(rn487x_t *dev, ble_charact_t *bc, const uint8_t *value);
+bool rn487x_dev_prepareWriteLocalCharact(rn487x_t *dev, rn487x_cmd_t *cmd, ble_charact_t *bc, const uint8_t *value);
+#ifdef RN487X_BATCH
+uint8_t rn487x_dev_writeLocalCharacts(rn487x_t *dev, rn487x_charact_write_t *writes, uint8_t count);
+#endif
+int8_t rn487x_dev_readLocalCharact(rn487x_t *dev, ble_charact_t *bc, uint8_t *vbuff);
+#ifdef RN487X_SHADOW
+void rn487x_dev_shadowConfig(rn487x_t *dev, uint16_t windowMs);
+bool rn487x_dev_shadowFlush(rn487x_t *dev);
+#endif
+bool rn487x_dev_buildCharacts(rn487x_t *dev);
+void rn487x_dev_setHandleCache(rn487x_t *dev, rn487x_cache_load_t load, rn487x_cache_store_t store, void *arg);
+uint32_t rn487x_dev_definitionHash(rn487x_t *dev);
+
+// Client role
+
+bool rn487x_dev_discoverRemote(rn487x_t *dev);
+uint16_t rn487x_dev_remoteHandle(rn487x_t *dev, const char *uuid);
+int8_t rn487x_dev_readRemoteCharact(rn487x_t *dev, const char *uuid, uint8_t *vbuff, uint8_t size);
+bool rn487x_dev_writeRemoteCharact(rn487x_t *dev, const char *uuid, const uint8_t *value, uint8_t len);
+#ifdef RN487X_BATCH
+uint8_t rn487x_dev_readRemoteCharacts(rn487x_t *dev, rn487x_remote_read_t *reads, uint8_t count);
+#endif
+
+// GATT schema
+
+int8_t rn487x_dev_applySchema(rn487x_t *dev, const rn487x_service_def_t *services, uint8_t count);
+
+/** 
+ ===============================================================================
+            ##### Default instance #####
+ ===============================================================================
+ */
+// The functions without _dev_ drive a single module wired to the
+// BLE_SERIAL_* macros, RN487X_RESET_PIN and RN487X_WAKE_PIN, as before
+// instances existed (rn487x_default.c). It is set up on first use.
+
+rn487x_t *rn487x_defaultDevice(void);
+
 // Init and general functions
 
 bool rn487x_init(void);
 void rn487x_hwReset(void);
 void rn487x_hwWakeUp(void);
-void nr487x_hwSleep(void);
+void rn487x_hwSleep(void);
+void nr487x_hwSleep(void); // former misspelled name of rn487x_hwSleep
 bool rn487x_setSerializedName(const char *newName);
 bool rn487x_setDeviceName(const char *dName);
 bool rn487x_reboot(void);
 int8_t rn487x_getConnectionStatus(void);
+bool rn487x_setBaudrate(uint32_t baudrate, bool flowControl);
+uint32_t rn487x_getBaudrate(void);
 
 // Modes
 
 bool rn487x_dataMode(void);
 bool rn487x_cmdMode(void);
 
+// Power
+
+bool rn487x_setLowPower(bool enable);
+bool rn487x_powerConfig(uint16_t idleMs, uint16_t holdMs);
+rn487x_power_state_t rn487x_powerState(void);
+void rn487x_powerStats(rn487x_power_stats_t *stats);
+void rn487x_dormant(void);
+
+// Timeouts
+
+void rn487x_retryConfig(uint8_t retries, uint16_t timeoutMinMs);
+uint16_t rn487x_adaptiveTimeout(rn487x_metric_class_t cls);
+
+#ifdef RN487X_METRICS
+// Metrics
+
+void rn487x_metrics(rn487x_metrics_t *snapshot);
+void rn487x_metricsReset(void);
+#endif
+
+#ifdef RN487X_TRACE
+// Trace
+
+uint16_t rn487x_traceRead(rn487x_trace_rec_t *recs, uint16_t max);
+uint32_t rn487x_traceLost(void);
+void rn487x_traceMark(uint8_t a, uint16_t b, uint32_t c);
+#endif
+
 // Advertisements
 
 bool rn487x_setAdvPower(uint8_t value);
@@ -78,22 +870,99 @@ bool rn487x_stopAdvertising(void);
 bool rn487x_clearImmediateAdvertising(void);
 bool rn487x_startImmediateAdvertising(uint8_t advType, const uint8_t *advData, size_t size);
 
+// Beacon
+
+bool rn487x_setBeaconFeatures(const char *mode);
+bool rn487x_clearImmediateBeacon(void);
+bool rn487x_startImmediateBeacon(uint8_t adType, const uint8_t *adData, size_t size);
+bool rn487x_clearPermanentBeacon(void);
+bool rn487x_startPermanentBeacon(uint8_t adType, const uint8_t *adData, size_t size);
+#ifdef RN487X_BEACON
+bool rn487x_beaconSlot(uint8_t slot, const uint8_t *frame, uint8_t size, uint16_t dwellMs);
+bool rn487x_startBeaconRotation(void);
+void rn487x_stopBeaconRotation(void);
+void rn487x_beaconStats(rn487x_beacon_stats_t *stats);
+#endif
+
+#ifdef RN487X_SCAN
+// Scan
+
+bool rn487x_startScan(uint16_t interval, uint16_t window);
+bool rn487x_stopScan(void);
+bool rn487x_scanRead(rn487x_scan_report_t *report);
+void rn487x_scanStats(rn487x_scan_stats_t *stats);
+#endif
+
 // Send command
 
 void rn487x_sendCommand(const char *cmd);
 
+// Transparent UART data
+
+void rn487x_sendData(const char *data, uint16_t dataLen);
+void rn487x_onData(rn487x_data_cb_t callback, void *arg);
+#ifdef RN487X_STREAM
+uint16_t rn487x_streamWrite(const uint8_t *data, uint16_t len);
+uint16_t rn487x_streamFree(void);
+uint16_t rn487x_streamPending(void);
+void rn487x_streamConfig(uint16_t chunkLen, uint32_t rate);
+#endif
+
+// Command engine (non-blocking)
+
+bool rn487x_submit(rn487x_cmd_t *cmd);
+bool rn487x_isIdle(void);
+void rn487x_process(void);
+void rn487x_rxFeed(uint8_t c);
+void rn487x_txDmaDone(void);
+bool rn487x_txIdle(void);
+uint16_t rn487x_rxOverruns(void);
+rn487x_reply_t rn487x_lastReply(void);
+
+// Events
+
+bool rn487x_onEvent(const char *name, rn487x_event_cb_t callback, void *arg);
+bool rn487x_isConnected(void);
+uint8_t rn487x_pipeline(rn487x_cmd_t *cmds, uint8_t count);
+
 // Services
 
 bool rn487x_deviceService_setManufName(const char *name);
 bool rn487x_setServiceUUID(const char *uuid);
+bool rn487x_prepareServiceUUID(rn487x_cmd_t *cmd, const char *uuid);
 bool rn487x_clearAllServices(void);
 
 // Characteristics
 
 bool rn487x_setCharactUUID(ble_charact_t *bc, const char *uuid, uint8_t property, uint8_t octetLen);
+bool rn487x_prepareCharactUUID(rn487x_cmd_t *cmd, ble_charact_t *bc, const char *uuid, uint8_t property, uint8_t octetLen);
 bool rn487x_writeLocalCharact(ble_charact_t *bc, const uint8_t *value);
+bool rn487x_prepareWriteLocalCharact(rn487x_cmd_t *cmd, ble_charact_t *bc, const uint8_t *value);
+#ifdef RN487X_BATCH
+uint8_t rn487x_writeLocalCharacts(rn487x_charact_write_t *writes, uint8_t count);
+#endif
 int8_t rn487x_readLocalCharact(ble_charact_t *bc, uint8_t *vbuff);
+#ifdef RN487X_SHADOW
+void rn487x_shadowConfig(uint16_t windowMs);
+bool rn487x_shadowFlush(void);
+#endif
 bool rn487x_buildCharacts(void);
+void rn487x_setHandleCache(rn487x_cache_load_t load, rn487x_cache_store_t store, void *arg);
+uint32_t rn487x_definitionHash(void);
+
+// Client role
+
+bool rn487x_discoverRemote(void);
+uint16_t rn487x_remoteHandle(const char *uuid);
+int8_t rn487x_readRemoteCharact(const char *uuid, uint8_t *vbuff, uint8_t size);
+bool rn487x_writeRemoteCharact(const char *uuid, const uint8_t *value, uint8_t len);
+#ifdef RN487X_BATCH
+uint8_t rn487x_readRemoteCharacts(rn487x_remote_read_t *reads, uint8_t count);
+#endif
+
+// GATT schema
+
+int8_t rn487x_applySchema(const rn487x_service_def_t *services, uint8_t count);
 
 // privates
 
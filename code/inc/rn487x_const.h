@@ -27,7 +27,14 @@
 #define DELAY_BEFORE_CMD 100     // delay before the first '$' to enter into command mode
 #define DEFAULT_CMD_TIMEOUT 1000 // default timeout
 #define RESET_CMD_TIMEOUT 2000
+#define RESET_BOOT_TIMEOUT 500   // upper bound from the reset release to %REBOOT%
 #define LIST_CMD_TIMEOUT 3000
+#define DISCOVER_CMD_TIMEOUT 5000 // client discovery of the remote services
+#define BLIND_CMD_GAP 50          // pause after a command whose reply cannot be read
+// Upper bound of a rate switch that falls back: GR, SB, SR, R,1 and the
+// boot, the $$$ check, the blind restore, the boot at the old rate, $$$ and V
+#define BAUD_SWITCH_MAX_MS (3 * DEFAULT_CMD_TIMEOUT + 2 * RESET_CMD_TIMEOUT + DEFAULT_CMD_TIMEOUT + \
+                            DELAY_BEFORE_CMD + 3 * BLIND_CMD_GAP + RESET_CMD_TIMEOUT + 2 * DEFAULT_CMD_TIMEOUT)
 #define RN487X_DEFAULT_BAUDRATE 115200
 #define CRLF "\r\n"
 #define CR '\r'
@@ -57,11 +64,13 @@
 #define MAX_DEVICE_NAME_LEN 20
 #define SET_LOW_POWER_ON "SO,1"
 #define SET_LOW_POWER_OFF "SO,0"
-#define SET_DORMANT_MODE "O,0"
+#define SET_DORMANT_MODE "O,0" // no reply, only a reset brings the module back
 #define SET_SETTINGS "S:,"
+#define SET_BAUDRATE "SB,"
 
 #define SET_SUPPORTED_FEATURES "SR,"
 // > Bitmap of supported features
+#define FLOW_CONTROL_BMP 0x8000
 #define NO_BEACON_SCAN_BMP 0x1000
 #define NO_CONNECT_SCAN_BMP 0x0800
 #define NO_DUPLICATE_SCAN_BMP 0x0400
@@ -82,6 +91,7 @@
 #define MAX_SETTINGS_LEN (32u)
 #define GET_DEVICE_NAME "GN"
 #define GET_CONNECTION_STATUS "GK"
+#define GET_SUPPORTED_FEATURES "GR"
 
 //--- Action Commands
 #define START_DEFAULT_ADV "A"
@@ -98,6 +108,8 @@
 #define START_DEFAULT_SCAN "F"
 #define START_CUSTOM_SCAN "F,"
 #define STOP_SCAN "X"
+#define MAX_ADV_DATA_LEN 31
+#define BROADCAST_DATA "Brcst:" // scan report field of the raw advertising data
 #define ADD_WHITE_LIST "JA,"
 #define MAX_WHITE_LIST_SIZE (16u)
 #define MAC_ADDRESS_LEN (12u)
@@ -112,11 +124,13 @@
 
 // --- List Commands
 #define LIST_CHARACTERISTICS "LS"
+#define LIST_CLIENT "LC" // remote services found by CI
 
 // --- Service Definition
 #define DEFINE_CHARACT_UUID "PC,"
 #define DEFINE_SERVICE_UUID "PS,"
 #define CLEAR_ALL_SERVICES "PZ"
+#define MAX_CHARACT_VALUE_LEN 0x14 // octets
 #define PRIVATE_SERVICE_LEN 32 // 128-bit
 #define PUBLIC_SERVICE_LEN 4   // 16-bit
 
@@ -134,6 +148,8 @@
 //-- Response
 #define AOK_RESP "AOK"
 #define ERR_RESP "Err"
+#define ERR_UPPER_RESP "ERR" // SHR and SHW of an invalid handle
+#define NA_RESP "N/A"        // SHR of a value never written
 #define FACTORY_RESET_RESP "Reboot after Factory Reset"
 #define DEVICE_MODEL "RN"
 #define REBOOTING_RESP "Rebooting"
@@ -141,6 +157,7 @@
 #define SCANNING_RESP "Scanning"
 
 //-- Events
+#define EVENT_DELIMITER '%'
 #define REBOOT_EVENT "%REBOOT%"
 
 #endif
\ No newline at end of file
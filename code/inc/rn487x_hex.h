@@ -0,0 +1,31 @@
+#ifndef __RN487X_HEX
+#define __RN487X_HEX
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ ===============================================================================
+            ##### Hex codec #####
+ ===============================================================================
+    Table-driven conversion between binary buffers and the upper case hex
+    text used by the RN487x commands. The bulk functions run a 32-bit word
+    at a time when the buffers are suitably aligned, a byte at a time
+    otherwise. Output is not NUL terminated.
+ */
+
+// Encodes len bytes into 2 * len hex characters
+void rn487x_hexEncode(const uint8_t *src, size_t len, char *dst);
+
+// Decodes hexLen characters (even) into hexLen / 2 bytes. Lower case digits
+// are accepted. Returns false if a character is not a hex digit.
+bool rn487x_hexDecode(const char *src, size_t hexLen, uint8_t *dst);
+
+// Fixed width helpers for command fields
+void rn487x_hexEncodeU8(uint8_t value, char *dst);   // 2 characters
+void rn487x_hexEncodeU16(uint16_t value, char *dst); // 4 characters
+bool rn487x_hexDecodeU8(const char *src, uint8_t *value);
+bool rn487x_hexDecodeU16(const char *src, uint16_t *value);
+
+#endif
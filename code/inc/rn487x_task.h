@@ -0,0 +1,140 @@
+#ifndef __RN487X_TASK
+#define __RN487X_TASK
+
+#include "rn487x.h"
+
+/**
+ ===============================================================================
+            ##### Driver task #####
+ ===============================================================================
+    Optional RTOS integration. One driver task owns the instance: it
+    alone calls rn487x_dev_* on it, from rn487x_task_run() or its own loop
+    around rn487x_task_poll(). The other tasks hand commands over as
+    requests, queued in priority lanes and notified one by one on
+    completion, so nobody shares the reply buffer and a waiting task
+    blocks on its own request only.
+
+    A request leaves its lane when the module can take it: when nothing
+    is in flight, or when it and every command in flight are pipelined.
+    The highest lane goes first at that moment, so an SHW posted on
+    RN487X_LANE_HIGH waits for the command in flight and, at most, for
+    one request of an overtaken lane. A lane whose head was overtaken
+    RN487X_TASK_BURST times in a row goes first once: no lane starves,
+    at most RN487X_TASK_BURST + RN487X_LANES - 1 requests of the other
+    lanes leave before the head of a lane, however busy they are.
+
+    The RTOS is reached through rn487x_os_t. host/rn487x_task_posix.c is
+    a pthreads port; on FreeRTOS, lock/unlock map to a mutex, wake/sleep
+    to the driver task notification and notify/wait to the notification
+    of the task in req->waiter.
+ */
+
+// Driver task sleep with nothing in flight [ms]: events, shadow window
+// and stream pacing are served at this period
+#ifndef RN487X_TASK_IDLE_MS
+#define RN487X_TASK_IDLE_MS 10
+#endif
+
+// Requests of the other lanes leaving before the head of a lane, after
+// which it goes first
+#ifndef RN487X_TASK_BURST
+#define RN487X_TASK_BURST 8
+#endif
+
+typedef enum
+{
+  RN487X_LANE_HIGH = 0, // short, latency bound (SHW of live values)
+  RN487X_LANE_NORMAL,
+  RN487X_LANE_LOW,      // long or background (LS, discovery)
+  RN487X_LANES
+} rn487x_lane_t;
+
+typedef struct rn487x_task rn487x_task_t;
+typedef struct rn487x_req rn487x_req_t;
+typedef void (*rn487x_req_cb_t)(rn487x_req_t *req);
+// Builds the command from the driver task, for the commands that depend
+// on the instance state (characteristic handles)
+typedef bool (*rn487x_req_prepare_t)(rn487x_t *dev, rn487x_cmd_t *cmd, void *arg);
+
+// Request of a task. The memory is owned by the caller and must stay
+// valid until done is set.
+struct rn487x_req
+{
+  rn487x_cmd_t cmd;             // status and reply once done
+  rn487x_req_prepare_t prepare; // optional, fills cmd before it is submitted
+  void *prepareArg;
+  rn487x_req_cb_t callback;     // optional, called from the driver task on completion
+  void *arg;                    // free for the caller
+  void *waiter;                 // RTOS object of the caller, for rn487x_os_t notify/wait
+  volatile bool done;
+  uint32_t queuedAt;            // [us] set by the first driver poll that saw the request
+  // private
+  rn487x_task_t *task;
+  uint8_t lane;
+  uint8_t pipeline;             // RN487X_CMD_FLAG_PIPELINE as posted
+  rn487x_cmd_cb_t cmdCallback;  // callback of cmd, chained
+  rn487x_req_t *next;
+};
+
+// RTOS services. Every function gets arg back.
+typedef struct
+{
+  void (*lock)(void *arg);   // guards the lanes, from any task
+  void (*unlock)(void *arg);
+  void (*wake)(void *arg);   // work for the driver task; a wake before sleep is not lost
+  void (*sleep)(void *arg, uint32_t ms);        // driver task: until wake() or ms elapsed
+  void (*notify)(void *arg, rn487x_req_t *req); // req->done was set, wake req->waiter
+  void (*wait)(void *arg, rn487x_req_t *req);   // caller: block until req->done
+  void *arg;
+} rn487x_os_t;
+
+typedef struct
+{
+  uint32_t completed;
+  uint32_t failed;     // completed with a status other than RN487X_CMD_OK
+  uint32_t latencyMaxUs;
+  uint64_t latencyTotalUs; // queued to completed
+  uint32_t passedMax;      // most requests of other lanes that left before a head
+} rn487x_lane_stats_t;
+
+// The fields are private
+struct rn487x_task
+{
+  rn487x_t *dev;
+  rn487x_os_t os;
+  struct
+  {
+    rn487x_req_t *head;
+    rn487x_req_t *tail;
+    rn487x_req_t *fresh; // first request not time stamped yet
+    uint8_t passed;      // requests of other lanes that left before head
+    rn487x_lane_stats_t stats;
+  } lanes[RN487X_LANES];
+  uint8_t inflight;      // requests submitted to the engine
+  uint8_t inflightPlain; // those without RN487X_CMD_FLAG_PIPELINE
+};
+
+/**
+ ===============================================================================
+            ##### Functions #####
+ ===============================================================================
+ */
+
+// Setup, before the driver task starts
+void rn487x_task_setup(rn487x_task_t *task, rn487x_t *dev, const rn487x_os_t *os);
+
+// Driver task body: rn487x_task_poll() and sleep, forever
+void rn487x_task_run(rn487x_task_t *task);
+// One round of the driver task. Returns how long it may sleep [ms].
+uint32_t rn487x_task_poll(rn487x_task_t *task);
+
+// Requests, from any task. A request may be posted again once done;
+// rn487x_task_call() blocks the caller until its request is done.
+bool rn487x_reqCommand(rn487x_req_t *req, const char *text, const char *expected, uint16_t timeout);
+void rn487x_reqWriteLocalCharact(rn487x_req_t *req, rn487x_charact_write_t *write);
+bool rn487x_task_post(rn487x_task_t *task, rn487x_req_t *req, rn487x_lane_t lane);
+rn487x_status_t rn487x_task_call(rn487x_task_t *task, rn487x_req_t *req, rn487x_lane_t lane);
+
+void rn487x_task_stats(rn487x_task_t *task, rn487x_lane_t lane, rn487x_lane_stats_t *stats);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef __RN487X_TRACE
+#define __RN487X_TRACE
+
+#include <stdint.h>
+
+/**
+ ===============================================================================
+            ##### Trace #####
+ ===============================================================================
+    Binary trace of the command engine (RN487X_TRACE), a lighter
+    alternative to RN487X_DEBUG for production builds. A trace point
+    stores one fixed-size record in a RAM ring of the instance and prints
+    nothing, so the timing under trace stays that of the release build.
+    The ring keeps the latest RN487X_TRACE_LEN records; read them with
+    rn487x_traceRead() from the main loop, lazily or after a failure, and
+    ship them as they are. host/rn487x_tracedump.c turns them back into
+    text.
+
+    Dump format: the records one after the other, 12 bytes each, little
+    endian: us (uint32), id (uint8), a (uint8), b (uint16), c (uint32).
+    Text arguments hold up to 4 characters, the first one in the low byte.
+ */
+
+typedef struct
+{
+  uint32_t us; // micros() when the record was written
+  uint8_t id;  // rn487x_trace_id_t
+  uint8_t a;
+  uint16_t b;
+  uint32_t c;
+} rn487x_trace_rec_t;
+
+#define RN487X_TRACE_REC_SIZE 12
+
+// Trace points: id, label, then the meaning of a, b and c. A NULL
+// argument name is not printed; a c named "text" holds characters.
+#define RN487X_TRACE_IDS(X)                                   \
+  X(CMD_SENT, "sent", "flags", "len", "text")                 \
+  X(CMD_DONE, "done", "status", "wait [ms]", "text")          \
+  X(CMD_TIMEOUT, "timeout", "inflight", "timeout [ms]", "text") \
+  X(LINE, "line", NULL, "len", "text")                        \
+  X(EVENT, "event", NULL, "len", "text")                      \
+  X(TX_STALL, "tx stall", NULL, "dropped [B]", NULL)          \
+  X(RX_OVERRUN, "rx overrun", NULL, "overruns", NULL)         \
+  X(POWER, "power", "from", "to", NULL)                       \
+  X(MARK, "mark", "a", "b", "c")                              \
+  X(BEACON, "beacon", "slot", "tx [B]", "cpu [us]")
+
+#define RN487X_TRACE_ID(__id__, __label__, __a__, __b__, __c__) RN487X_TRACE_##__id__,
+typedef enum
+{
+  RN487X_TRACE_IDS(RN487X_TRACE_ID)
+  RN487X_TRACE_ID_COUNT
+} rn487x_trace_id_t;
+#undef RN487X_TRACE_ID
+
+#endif
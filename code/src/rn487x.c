@@ -1,5 +1,6 @@
 #include "rn487x.h"
 #include "rn487x_const.h"
+#include "rn487x_hex.h"
 
 /** 
  ===============================================================================
@@ -15,24 +16,68 @@
 #endif
 
 #define _IS_HEXCOMMA(__x__) (((__x__) >= 'A' && (__x__) <= 'F') || ((__x__) >= '0' && (__x__) <= '9') || ((__x__) == ','))
-#define _IS_ENDWORD(__x__) ((__x__) == 'E' || (__x__) == 'N' || (__x__) == 'D')
 #define HANDLE_POS 33 // 32 from UUID, 1 from comma
 #define PROPERTY_POS (HANDLE_POS + 5)
+#define PROMPT_LEN 5 // "CMD> "
+#define RX_RING_MASK (RN487X_RX_RING_LEN - 1)
+#define STREAM_MASK (RN487X_STREAM_BUF_LEN - 1)
+#define TX_RING_MASK (RN487X_TX_RING_LEN - 1)
 
-#define UART_BUFF_LEN 500
+#if defined(RN487X_TX_DMA) && (RN487X_TX_RING_LEN <= RN487X_CMD_LEN)
+#error "RN487X_TX_RING_LEN must be larger than RN487X_CMD_LEN"
+#endif
+#if defined(RN487X_TRACE) && (RN487X_TRACE_LEN & (RN487X_TRACE_LEN - 1)) != 0
+#error "RN487X_TRACE_LEN must be a power of two"
+#endif
+
+#define UART_BUFF_LEN RN487X_LINE_LEN // reply line of the blocking functions
+#define _CMD_LEN(__lit__) (sizeof(__lit__) - 1)
+#define CCCD_PROPERTY 0x10 // LS line of the configuration descriptor
+#define FNV_OFFSET 2166136261UL
+#define FNV_PRIME 16777619UL
+#define SCAN_RING_MASK (RN487X_SCAN_RING_LEN - 1)
+#define SCAN_SET_MASK (RN487X_SCAN_FILTER_LEN / 2 - 1) // 2-way sets
+#define SHADOW_VALID 0x01 // the module holds the shadow value
+#define SHADOW_DIRTY 0x02 // the shadow value waits for its SHW
+#define SHADOW_SENT 0x04  // the shadow value is in the SHW in flight
 #define CMD_MODE 1
 #define DATA_MODE 0
+#define TRACE_MASK (RN487X_TRACE_LEN - 1)
+
+#ifdef RN487X_TRACE
+#define TRACE(__dev__, __id__, __a__, __b__, __c__) _trace((__dev__), RN487X_TRACE_##__id__, (__a__), (__b__), (__c__))
+#else
+#define TRACE(__dev__, __id__, __a__, __b__, __c__)
+#endif
 
 /** 
  ===============================================================================
             ##### Private variables #####
  ===============================================================================
 */
-static char _uart_buffer[UART_BUFF_LEN] = {0};
-static char _device_name[MAX_DEVICE_NAME_LEN] = {0};
-static uint16_t _charact_handles[BLE_MAX_NUMBER_OF_CHARACTERISTICS] = {0};
-static uint8_t _operation_mode = DATA_MODE;
-static uint16_t _charact_id_cnt = 0;
+// Replies known to the response matcher, none a prefix of another.
+// The prompt is framed by its trailing space, never decided early.
+#define _REPLY(__token__, __kind__) {__token__, sizeof(__token__) - 1, __kind__}
+static const struct
+{
+  const char *token;
+  uint8_t len;
+  uint8_t kind; // rn487x_reply_t
+} _replies[] = {
+    _REPLY(AOK_RESP, RN487X_REPLY_AOK),
+    _REPLY(ERR_RESP, RN487X_REPLY_ERR),
+    _REPLY(ERR_UPPER_RESP, RN487X_REPLY_ERR),
+    _REPLY(PROMPT, RN487X_REPLY_PROMPT),
+    _REPLY(PROMPT_END, RN487X_REPLY_END),
+    _REPLY(NONE_RESP, RN487X_REPLY_NONE),
+    _REPLY(NA_RESP, RN487X_REPLY_NA),
+    _REPLY(REBOOTING_RESP, RN487X_REPLY_REBOOTING),
+};
+#define REPLIES_ALL ((uint8_t)((1U << (sizeof(_replies) / sizeof(_replies[0]))) - 1))
+
+// Rates of the SB command, the index is the command argument
+static const uint32_t _baud_rates[] = {921600, 460800, 230400, 115200, 57600, 38400,
+                                       28800, 19200, 14400, 9600, 4800, 2400};
 
 /** 
  ===============================================================================
@@ -40,734 +85,3975 @@ static uint16_t _charact_id_cnt = 0;
  ===============================================================================
  */
 
+#ifdef RN487X_TRACE
 // ------------------------------------------------------------
-// Clear hardware input uart buffer
+// Store a trace record, over the oldest one on a full ring
 // ------------------------------------------------------------
-static void _serialFlush(void)
+static void _trace(rn487x_t *dev, uint8_t id, uint8_t a, uint16_t b, uint32_t c)
 {
-  while (BLE_SERIAL_AVAILABLE() > 0)
-  {
-    BLE_SERIAL_READ();
-  }
+  rn487x_trace_rec_t *rec = &dev->trace[dev->traceHead & TRACE_MASK];
+  rec->us = micros();
+  rec->id = id;
+  rec->a = a;
+  rec->b = b;
+  rec->c = c;
+  dev->traceHead++;
 }
 
 // ------------------------------------------------------------
-// Clear private buffer
+// First 4 characters of a text, the first one in the low byte
 // ------------------------------------------------------------
-static void _clearBuffer(void)
+static uint32_t _traceText(const char *text, uint16_t len)
 {
-  memset(_uart_buffer, 0, UART_BUFF_LEN);
+  uint32_t c = 0;
+  for (uint8_t i = 0; i < 4 && i < len && text[i] != 0; i++)
+  {
+    c |= (uint32_t)(uint8_t)text[i] << (8 * i);
+  }
+  return c;
 }
+#endif
 
 // ------------------------------------------------------------
-// Reads a buffer until the carriage return
+// Clear hardware input uart buffer
 // ------------------------------------------------------------
-static uint16_t _readUntilCR(uint16_t timeout)
+static void _serialFlush(rn487x_t *dev)
 {
-  uint16_t i = 0;
-  int c = 0;
-  unsigned long previous;
-  previous = millis();
-  while (c != CR && i < UART_BUFF_LEN && (millis() - previous < timeout))
+#ifndef RN487X_RX_ISR
+  while (dev->io.available(dev->io.arg) > 0)
   {
-    if (BLE_SERIAL_AVAILABLE())
-    {
-      c = BLE_SERIAL_READ();
-      if (c == CR)
-        return i;
-      _uart_buffer[i] = c;
-      i++;
-    }
+    dev->io.read(dev->io.arg);
   }
-  return i;
+#endif
+  dev->rxScan = dev->rxHead;
+  dev->rxTail = dev->rxScan;
+  dev->rxInEvent = false;
 }
 
 // ------------------------------------------------------------
-// Get the current operation mode
+// Close the time of the current power state, enter another
 // ------------------------------------------------------------
-// static int _getOperationMode(void) {
-//   return _operation_mode;
-// }
+static void _powerEnter(rn487x_t *dev, uint8_t state)
+{
+  uint32_t now = millis();
+  TRACE(dev, POWER, dev->powerState, state, 0);
+  dev->powerStats.ms[dev->powerState] += now - dev->powerSince;
+  dev->powerSince = now;
+  dev->powerState = state;
+}
 
 // ------------------------------------------------------------
-// Check if response is equals to the one specify
+// Release the wake line, the module sleeps in low power mode
 // ------------------------------------------------------------
-static bool _expectResponse(const char *expected_response, uint16_t timeout)
+static void _powerSleep(rn487x_t *dev)
 {
-  DEBUG_PRINT("  => expectedResponse: ");
-  DEBUG_PRINTLN(expected_response);
-  _clearBuffer();
-  if (_readUntilCR(timeout) > 0)
-  {
-    DEBUG_PRINT("  => Received (");
-    DEBUG_PRINT(_uart_buffer);
-    DEBUG_PRINT(")");
-    if (strstr(_uart_buffer, expected_response) != NULL)
-    {
-      DEBUG_PRINTLN(" found match!");
-      return true;
-    }
-    DEBUG_PRINTLN(" not match...!");
-    return false;
-  }
-  DEBUG_PRINTLN("  => TIMEOUT!");
-  return false;
+  DEBUG_PRINTLN("[info] sleep");
+  dev->io.setWake(dev->io.arg, true);
+  _powerEnter(dev, RN487X_POWER_SLEEP);
+}
+
+// ------------------------------------------------------------
+// Pull the wake line, the UART is usable RN487X_WAKE_TIME_MS
+// later (rn487x_dev_process() or _powerAwait())
+// ------------------------------------------------------------
+static void _powerWake(rn487x_t *dev)
+{
+  DEBUG_PRINTLN("[info] wakeUp");
+  dev->io.setWake(dev->io.arg, false);
+  dev->powerStats.wakeups++;
+  _powerEnter(dev, RN487X_POWER_WAKING);
 }
 
 // ------------------------------------------------------------
-// Convert decimal number to hex buffer
+// Make sure the module listens before a byte goes out: wake it
+// up and wait if needed
 // ------------------------------------------------------------
-static void _decToHex(uint16_t dec, uint8_t *hexBuff, uint8_t hexBuffLen)
+static void _powerAwait(rn487x_t *dev)
 {
-  uint16_t quotient = dec;
-  uint16_t remainder = 0;
-  uint8_t i = 0;
-  uint8_t j = hexBuffLen - 1;
-  memset(hexBuff, 0, hexBuffLen);
-  while (quotient != 0 && j >= 0)
+  if (dev->powerState == RN487X_POWER_SLEEP)
   {
-    remainder = quotient % 16;
-    if (remainder < 10)
-      hexBuff[j--] = 48 + remainder;
-    else
-      hexBuff[j--] = 55 + remainder;
-    quotient = quotient / 16;
-    i++;
+    _powerWake(dev);
   }
-  for (j = 0; j < (hexBuffLen - i); j++)
+  if (dev->powerState == RN487X_POWER_WAKING)
   {
-    hexBuff[j] = '0';
+    uint32_t spent = millis() - dev->powerSince;
+    if (spent < RN487X_WAKE_TIME_MS)
+    {
+      delay(RN487X_WAKE_TIME_MS - spent);
+    }
+    _powerEnter(dev, RN487X_POWER_AWAKE);
+    dev->powerActiveAt = millis();
   }
 }
 
 // ------------------------------------------------------------
-// Value string to number
+// True while the module is kept from the UART
 // ------------------------------------------------------------
-static uint16_t _valueStrToNum(const char *buff, uint8_t size)
+static bool _powerDown(rn487x_t *dev)
 {
-  uint16_t val = 0;
-  for (uint8_t i = 0; i < size; i++)
+  if (dev->powerState == RN487X_POWER_SLEEP || dev->powerState == RN487X_POWER_WAKING)
   {
-    uint8_t byte = buff[i];
-    if (byte >= '0' && byte <= '9')
-      byte = byte - '0';
-    else if (byte >= 'A' && byte <= 'F')
-      byte = byte - 'A' + 10;
-    val = (val << 4) | (byte & 0xF);
+    return true;
   }
-  return val;
+  return false;
 }
 
+#ifdef RN487X_TX_DMA
 // ------------------------------------------------------------
-// Hex digit to decimal digit
+// Start a transfer of the longest contiguous run of the TX ring
+// if none is running. Called with the TX interrupt masked.
 // ------------------------------------------------------------
-static uint8_t _hexDigitToDec(char hexDigit)
+static void _txKick(rn487x_t *dev)
 {
-  if ((hexDigit >= '0') && (hexDigit <= '9'))
+  uint16_t start = dev->txTail & TX_RING_MASK;
+  uint16_t len = dev->txHead - dev->txTail;
+  if (dev->txDmaLen != 0 || len == 0)
   {
-    return (hexDigit - '0');
+    return;
   }
-  if ((hexDigit >= 'A') && (hexDigit <= 'F'))
+  if (len > (RN487X_TX_RING_LEN - start))
   {
-    return (hexDigit - 'A' + 10);
+    len = RN487X_TX_RING_LEN - start;
   }
-  return 0;
+  dev->txDmaLen = len;
+  dev->io.dmaStart(dev->io.arg, &dev->txRing[start], len);
 }
 
-/** 
- ===============================================================================
-            ##### Public functions #####
- ===============================================================================
- */
-
 // ------------------------------------------------------------
-// Send a command
+// Room left in the TX ring
 // ------------------------------------------------------------
-void rn487x_sendCommand(const char *cmd)
+static uint16_t _txFree(rn487x_t *dev)
 {
-  DEBUG_PRINT(" => sendCommand: ");
-  DEBUG_PRINTLN(cmd);
+  return RN487X_TX_RING_LEN - (uint16_t)(dev->txHead - dev->txTail);
+}
 
-  BLE_SERIAL_PRINT(cmd);
-  // This should be after print the command 'cause there are commands
-  // that use _uart_buffer to be generated
-  _clearBuffer();
-  _serialFlush();
-  BLE_SERIAL_PRINT("\r");
+// ------------------------------------------------------------
+// True once the TX ring position end is on the wire
+// ------------------------------------------------------------
+static bool _txSent(rn487x_t *dev, uint16_t end)
+{
+  return (int16_t)(dev->txTail - end) >= 0;
 }
 
 // ------------------------------------------------------------
-// Send data
+// Queue len bytes and return, waiting only for ring room
 // ------------------------------------------------------------
-void rn487x_sendData(char *data, uint16_t dataLen)
+static void _txWrite(rn487x_t *dev, const uint8_t *data, uint16_t len)
 {
-  for (uint8_t i = 0; i < dataLen; i++)
+  uint32_t start = millis();
+  _powerAwait(dev);
+  while (len > 0)
   {
-    BLE_SERIAL_WRITE(data[i]);
+    uint16_t n = _txFree(dev);
+    if (n == 0)
+    {
+      // A transfer never completing would hang the caller
+      if ((millis() - start) >= DEFAULT_CMD_TIMEOUT)
+      {
+        DEBUG_PRINTLN("[error] TX stalled, data dropped");
+        TRACE(dev, TX_STALL, 0, len, 0);
+        return;
+      }
+      continue;
+    }
+    if (n > len)
+    {
+      n = len;
+    }
+    for (uint16_t i = 0; i < n; i++)
+    {
+      dev->txRing[(dev->txHead + i) & TX_RING_MASK] = data[i];
+    }
+    data += n;
+    len -= n;
+    RN487X_TX_LOCK();
+    dev->txHead += n;
+    _txKick(dev);
+    RN487X_TX_UNLOCK();
   }
 }
 
 // ------------------------------------------------------------
-// Hardware reset
+// Wait until every queued byte is on the wire
 // ------------------------------------------------------------
-void rn487x_hwReset(void)
+static void _txDrain(rn487x_t *dev)
 {
-  DEBUG_PRINTLN("[info] hwReset");
-  gpio_mode(RN487X_RESET_PIN, OUTPUT_PP, NOPULL, SPEED_HIGH);
-  gpio_reset(RN487X_RESET_PIN);
-  delay(5);
-  gpio_set(RN487X_RESET_PIN);
-  delay(500);
+  uint32_t start = millis();
+  while (dev->txHead != dev->txTail && (millis() - start) < DEFAULT_CMD_TIMEOUT)
+  {
+  }
+}
+#else
+static uint16_t _txFree(rn487x_t *dev)
+{
+  (void)dev;
+  return UINT16_MAX;
 }
 
-// ------------------------------------------------------------
-// Hardware wake up (available only in RN4871)
-// ------------------------------------------------------------
-void rn487x_hwWakeUp(void)
+static void _txDrain(rn487x_t *dev)
 {
-#ifdef RN487X_WAKE_PIN
-  DEBUG_PRINTLN("[info] wakeUp");
-  gpio_mode(RN487X_WAKE_PIN, OUTPUT_PP, NOPULL, SPEED_HIGH);
-  gpio_reset(RN487X_WAKE_PIN);
-  delay(5);
-#endif
+  (void)dev;
 }
 
 // ------------------------------------------------------------
-// Reboot the module
+// Blocking write, the CPU pushes every byte
 // ------------------------------------------------------------
-bool rn487x_reboot(void)
+static void _txWrite(rn487x_t *dev, const uint8_t *data, uint16_t len)
 {
-  DEBUG_PRINTLN("[info] reboot");
-  rn487x_sendCommand(REBOOT);
-  if (_expectResponse(REBOOTING_RESP, RESET_CMD_TIMEOUT))
+  _powerAwait(dev);
+  for (uint16_t i = 0; i < len; i++)
   {
-    delay(RESET_CMD_TIMEOUT);
-    return true;
+    dev->io.write(dev->io.arg, data[i]);
   }
-  return false;
 }
+#endif
+
+// Command text prefixes of the command classes, in rn487x_metric_class_t order
+static const char *const _class_prefixes[RN487X_METRIC_OTHER] = {
+    DEFINE_SERVICE_UUID, DEFINE_CHARACT_UUID, WRITE_LOCAL_CHARACT, READ_LOCAL_CHARACT,
+    LIST_CHARACTERISTICS, ENTER_CMD, REBOOT};
 
 // ------------------------------------------------------------
-// Initialization
+// Command class of a command text
 // ------------------------------------------------------------
-bool rn487x_init(void)
+static uint8_t _cmdClass(const char *text)
 {
-  DEBUG_PRINTLN("[info] init");
-  rn487x_hwReset();
-  rn487x_hwWakeUp();
-  _clearBuffer();
-  _serialFlush();
-  if (rn487x_reboot())
+  uint8_t c = 0;
+  while (c < RN487X_METRIC_OTHER && strncmp(text, _class_prefixes[c], strlen(_class_prefixes[c])) != 0)
   {
-    _operation_mode = DATA_MODE;
-    return true;
-  }
-  if (rn487x_cmdMode())
-  {
-    if (rn487x_reboot())
-    {
-      _operation_mode = DATA_MODE;
-      return true;
-    }
+    c++;
   }
-  return false;
+  return c;
 }
 
 // ------------------------------------------------------------
-// Enter into command mode
+// Check whether a command may be sent again after a timeout.
+// SHW is, rewriting the same value. Only a bare AOK can complete
+// the resend whatever attempt it answers: a value reply, SHR
+// included, could be that of an older attempt.
 // ------------------------------------------------------------
-bool rn487x_cmdMode(void)
+static bool _cmdRetryable(const rn487x_cmd_t *cmd)
 {
-  DEBUG_PRINTLN("[info] commandMode");
-  delay(DELAY_BEFORE_CMD);
-  _serialFlush();
-  _clearBuffer();
-  BLE_SERIAL_PRINT(ENTER_CMD);
-  if (_expectResponse(PROMPT, DEFAULT_CMD_TIMEOUT))
+  if (((cmd->flags & RN487X_CMD_FLAG_RETRY) || cmd->cls == RN487X_METRIC_SHW) &&
+      cmd->expectKind == RN487X_REPLY_AOK)
   {
-    _operation_mode = CMD_MODE;
     return true;
   }
   return false;
 }
 
-// ------------------------------------------------------------------
-// Set Serialized Device Name
-// ------------------------------------------------------------------
-bool rn487x_setSerializedName(const char *newName)
+// ------------------------------------------------------------
+// Reply timeout of the current attempt. Commands that are not
+// resent keep their own timeout: cutting it short would only
+// fail them sooner.
+// ------------------------------------------------------------
+static uint16_t _cmdWait(rn487x_t *dev, const rn487x_cmd_t *cmd)
 {
-  DEBUG_PRINT("[info] setSerializedName: ");
-  DEBUG_PRINTLN(newName);
-
-  uint8_t cmdLen = strlen(SET_SERIALIZED_NAME);
-  uint8_t nameLen = strlen(newName);
-  if (nameLen > MAX_SERIALIZED_NAME_LEN)
+  if (dev->retries == 0 || !_cmdRetryable(cmd) || dev->rtt[cmd->cls].samples == 0)
   {
-    nameLen = MAX_SERIALIZED_NAME_LEN;
-    DEBUG_PRINTLN("[warn] Too many characters, name truncated");
+    return cmd->timeout;
   }
-
-  // Fill the device name without the last two bytes of the Bluetooth MAC address
-  memset(_device_name, 0, nameLen);
-  memcpy(_device_name, newName, nameLen);
-  // Fill the buffer
-  _clearBuffer();
-  memcpy(_uart_buffer, SET_SERIALIZED_NAME, cmdLen);
-  memcpy(&_uart_buffer[cmdLen], newName, nameLen);
-  rn487x_sendCommand(_uart_buffer);
-  if (_expectResponse(AOK_RESP, DEFAULT_CMD_TIMEOUT))
+  uint32_t wait = (dev->rtt[cmd->cls].srtt8 >> 3) + dev->rtt[cmd->cls].rttvar4;
+  if (wait < dev->timeoutMin)
   {
-    return true;
+    wait = dev->timeoutMin;
   }
-  return false;
+  wait <<= cmd->attempt;
+  return (wait < cmd->timeout) ? wait : cmd->timeout;
 }
 
-// ------------------------------------------------------------------
-// Set Device Name
-// ------------------------------------------------------------------
-bool rn487x_setDeviceName(const char *dName)
+// ------------------------------------------------------------
+// Reply time sample of a command class (RFC 6298, scaled)
+// ------------------------------------------------------------
+static void _rttSample(rn487x_t *dev, uint8_t cls, uint32_t ms)
 {
-  DEBUG_PRINT("[info] setDeviceName: ");
-  DEBUG_PRINTLN(dName);
-  uint8_t cmdLen = strlen(SET_DEVICE_NAME);
-  uint8_t nameLen = strlen(dName);
-  if (nameLen > MAX_DEVICE_NAME_LEN)
+  if (dev->rtt[cls].samples == 0)
   {
-    nameLen = MAX_DEVICE_NAME_LEN;
-    DEBUG_PRINTLN("[warn] Too many characters, name truncated");
+    dev->rtt[cls].srtt8 = ms << 3;
+    dev->rtt[cls].rttvar4 = ms << 1;
   }
-
-  memset(_device_name, 0, nameLen);
-  memcpy(_device_name, dName, nameLen);
-  _clearBuffer();
-  memcpy(_uart_buffer, SET_DEVICE_NAME, cmdLen);
-  memcpy(&_uart_buffer[cmdLen], dName, nameLen);
-  rn487x_sendCommand(_uart_buffer);
-  if (_expectResponse(AOK_RESP, DEFAULT_CMD_TIMEOUT))
+  else
   {
-    return true;
+    int32_t err = (int32_t)ms - (int32_t)(dev->rtt[cls].srtt8 >> 3);
+    dev->rtt[cls].srtt8 += err;
+    dev->rtt[cls].rttvar4 += (uint32_t)(err < 0 ? -err : err) - (dev->rtt[cls].rttvar4 >> 2);
+  }
+  if (dev->rtt[cls].samples != UINT16_MAX)
+  {
+    dev->rtt[cls].samples++;
   }
-  return false;
 }
 
-// ---------------------------------------------------------------------------------
-// Get the current connection status
-// ---------------------------------------------------------------------------------
-// If the RN4870/71 is not connected, the output is none.
-// If the RN4870/71 is connected, the buffer must contains the information:
-// <Peer BT Address>,<Address Type>,<Connection Type>
-// where <Peer BT Address> is the 6-byte hex address of the peer device;
-//       <Address Type> is either 0 for public address or 1 for random address;
-//       <Connection Type> specifies if the connection enables UART Transparent
-//                         feature [1: enabled, 0: disabled]
-// ---------------------------------------------------------------------------------
-int8_t rn487x_getConnectionStatus(void)
+// ------------------------------------------------------------
+// Send the commands in flight again after a backoff. Each of
+// them owes the reply of the attempt given up; those arriving
+// while nothing is in flight are dropped as unsolicited, the
+// others drained once the resends completed.
+// ------------------------------------------------------------
+static bool _cmdRetry(rn487x_t *dev)
 {
-  DEBUG_PRINTLN("[info] getConnectionStatus");
-
-  rn487x_sendCommand(GET_CONNECTION_STATUS);
-  _clearBuffer();
-  if (_readUntilCR(DEFAULT_CMD_TIMEOUT) > 0)
+  rn487x_cmd_t *cmd = dev->cmdHead;
+  for (uint8_t i = 0; i < dev->cmdInflight; i++, cmd = cmd->next)
   {
-    // Check for the connection
-    if (strstr(_uart_buffer, NONE_RESP) != NULL)
+    if (!_cmdRetryable(cmd) || cmd->attempt >= dev->retries)
     {
-      return 0; // Not connected
+      return false; // the replies of the others can no longer be matched
     }
-    return 1; // Connected
   }
-  DEBUG_PRINTLN("[warn] getConnectionStatus: Timeout without a response !");
-  return -1;
+  cmd = dev->cmdHead;
+  for (uint8_t i = 0; i < dev->cmdInflight; i++, cmd = cmd->next)
+  {
+    cmd->status = RN487X_CMD_QUEUED;
+    cmd->attempt++;
+#ifdef RN487X_METRICS
+    dev->metrics.classes[cmd->cls].retries += (dev->metrics.classes[cmd->cls].retries != UINT16_MAX) ? 1 : 0;
+#endif
+  }
+  dev->replyOwed += dev->cmdInflight;
+  dev->cmdNext = dev->cmdHead;
+  dev->cmdInflight = 0;
+  dev->retryAt = millis();
+  dev->retryBackoff = RN487X_RETRY_BACKOFF_MS << (dev->cmdHead->attempt - 1);
+  return true;
 }
 
-/********************** Advertisements ******************************/
+#ifdef RN487X_METRICS
 
-// ------------------------------------------------------------------
-// Adjust the output power under advertisement [ Range from (0-5) ]
-// ------------------------------------------------------------------
-bool rn487x_setAdvPower(uint8_t value)
+// ------------------------------------------------------------
+// Saturating counter increment
+// ------------------------------------------------------------
+static void _metricInc(uint16_t *counter)
 {
-  DEBUG_PRINTLN("[info] setAdvPower");
+  if (*counter != UINT16_MAX)
+  {
+    (*counter)++;
+  }
+}
 
-  if (value > MAX_POWER_OUTPUT)
+// ------------------------------------------------------------
+// Account a completed command to its class
+// ------------------------------------------------------------
+static void _metricRecord(rn487x_t *dev, const rn487x_cmd_t *cmd, rn487x_status_t status)
+{
+  rn487x_metric_t *m = &dev->metrics.classes[cmd->cls];
+  if (m->calls != UINT32_MAX)
   {
-    value = MAX_POWER_OUTPUT;
+    m->calls++;
   }
-  uint8_t len = strlen(SET_ADV_POWER);
-  _clearBuffer();
-  memcpy(_uart_buffer, SET_ADV_POWER, len);
-  _uart_buffer[len] = value + '0'; // convert to a string
-  rn487x_sendCommand(_uart_buffer);
-  if (_expectResponse(AOK_RESP, DEFAULT_CMD_TIMEOUT))
+  if (status == RN487X_CMD_TIMEOUT)
   {
-    return true;
+    _metricInc(&m->timeouts);
+    return;
   }
-  return false;
+  if (status == RN487X_CMD_ERR)
+  {
+    _metricInc(&m->errors);
+  }
+  uint32_t ms = millis() - cmd->metricAt;
+  uint8_t b = 0;
+  while (b < RN487X_METRIC_BUCKETS - 1 && ms >= (2UL << b))
+  {
+    b++;
+  }
+  _metricInc(&m->histogram[b]);
+  m->maxMs = (ms > m->maxMs) ? ((ms > UINT16_MAX) ? UINT16_MAX : ms) : m->maxMs;
+  m->totalMs = (m->totalMs > UINT32_MAX - ms) ? UINT32_MAX : m->totalMs + ms;
 }
+#endif
 
-// ------------------------------------------------------------------
-// Adjust the output power under connected state [ Range from (0-5) ]
-// ------------------------------------------------------------------
-bool rn487x_setConnPower(uint8_t value)
+// ------------------------------------------------------------
+// Write a command to the module
+// ------------------------------------------------------------
+static void _cmdSend(rn487x_t *dev, rn487x_cmd_t *cmd, uint16_t len)
 {
-  DEBUG_PRINTLN("[info] setConnPower");
+  DEBUG_PRINT(" => sendCommand: ");
+  DEBUG_PRINTLN(cmd->text);
 
-  if (value > MAX_POWER_OUTPUT)
+  _txWrite(dev, (const uint8_t *)cmd->text, len);
+  if ((cmd->flags & RN487X_CMD_FLAG_RAW) == 0)
   {
-    value = MAX_POWER_OUTPUT;
+    _txWrite(dev, (const uint8_t *)"\r", 1);
   }
-  uint8_t len = strlen(SET_CONN_POWER);
-  memcpy(_uart_buffer, SET_CONN_POWER, len);
-  _uart_buffer[len] = value + '0'; // convert to a string
-  rn487x_sendCommand(_uart_buffer);
-  if (_expectResponse(AOK_RESP, DEFAULT_CMD_TIMEOUT))
+#ifdef RN487X_TX_DMA
+  cmd->txEnd = dev->txHead;
+#endif
+  cmd->sentAt = millis();
+  cmd->wait = _cmdWait(dev, cmd);
+#ifdef RN487X_METRICS
+  if (cmd->attempt == 0)
   {
-    return true;
+    cmd->metricAt = cmd->sentAt;
   }
-  return false;
+#endif
+  cmd->status = RN487X_CMD_SENT;
+  dev->powerStats.commands++;
+  TRACE(dev, CMD_SENT, cmd->flags, len, _traceText(cmd->text, len));
 }
 
 // ------------------------------------------------------------
-// Stops Advertisement
+// Send queued commands. A pipelined command may follow other
+// pipelined ones in flight, up to RN487X_PIPELINE_DEPTH; any
+// other command waits until nothing is in flight. While the
+// module sleeps, they wait for the power manager; after a
+// timeout, for the retry backoff.
 // ------------------------------------------------------------
-bool rn487x_stopAdvertising(void)
+static void _cmdPump(rn487x_t *dev)
 {
-  DEBUG_PRINTLN("[info] stopAdvertising");
-  rn487x_sendCommand(STOP_ADV);
-  if (_expectResponse(AOK_RESP, DEFAULT_CMD_TIMEOUT))
+  if (_powerDown(dev))
   {
-    return true;
+    return;
+  }
+  if (dev->retryBackoff != 0)
+  {
+    if ((millis() - dev->retryAt) < dev->retryBackoff)
+    {
+      return;
+    }
+    dev->retryBackoff = 0;
+    if (dev->replyDrain)
+    {
+      dev->replyDrain = false;
+      dev->replyOwed = 0; // lost, not late
+    }
+  }
+  while (dev->cmdNext != NULL)
+  {
+    if (dev->cmdInflight > 0 &&
+        ((dev->cmdNext->flags & RN487X_CMD_FLAG_PIPELINE) == 0 ||
+         (dev->cmdHead->flags & RN487X_CMD_FLAG_PIPELINE) == 0 ||
+         dev->cmdInflight >= RN487X_PIPELINE_DEPTH))
+    {
+      return;
+    }
+    rn487x_cmd_t *cmd = dev->cmdNext;
+    uint16_t len = strlen(cmd->text);
+    if (_txFree(dev) <= len)
+    {
+      return; // sent once the TX ring has room for the text and its CR
+    }
+    dev->cmdNext = cmd->next;
+    dev->cmdInflight++;
+    _cmdSend(dev, cmd, len);
   }
-  return false;
 }
 
-// ------------------------------------------------------------------
-// Clear the advertising structure Immediately
-// ------------------------------------------------------------------
-bool rn487x_clearImmediateAdvertising(void)
+// ------------------------------------------------------------
+// Unlink the command in flight and report its result
+// ------------------------------------------------------------
+static void _cmdComplete(rn487x_t *dev, rn487x_status_t status, const char *line, uint16_t len)
 {
-  DEBUG_PRINTLN("[info] clearImmediateAdvertising");
-
-  rn487x_sendCommand(CLEAR_IMMEDIATE_ADV);
-  if (_expectResponse(AOK_RESP, DEFAULT_CMD_TIMEOUT))
+  rn487x_cmd_t *cmd = dev->cmdHead;
+  dev->cmdHead = cmd->next;
+  if (dev->cmdHead == NULL)
   {
-    return true;
+    dev->cmdTail = NULL;
   }
-  return false;
+  else if (dev->cmdHead->status == RN487X_CMD_SENT)
+  {
+    // Replies come in order: a pipelined command starts waiting
+    // for its own reply once the previous one has been answered
+    dev->cmdHead->sentAt = millis();
+  }
+  cmd->next = NULL;
+  dev->cmdInflight--;
+  if (dev->replyOwed > 0 && dev->cmdInflight == 0)
+  {
+    // Drain the replies of the attempts given up for one more timeout
+    dev->retryAt = millis();
+    dev->retryBackoff = cmd->wait;
+    dev->replyDrain = true;
+  }
+  if (dev->powerIdle != 0)
+  {
+    dev->powerActiveAt = millis(); // idle time runs from the last reply
+  }
+  if (cmd->resp != NULL && cmd->respSize > 0)
+  {
+    if (len > cmd->respSize - 1)
+    {
+      len = cmd->respSize - 1;
+    }
+    memcpy(cmd->resp, line, len);
+    cmd->resp[len] = 0;
+    cmd->respLen = len;
+  }
+  if (status != RN487X_CMD_TIMEOUT && cmd->attempt == 0 && dev->retries != 0 && _cmdRetryable(cmd))
+  {
+    // Only first attempts: a reply after a resend may be that of
+    // the first one (Karn)
+    _rttSample(dev, cmd->cls, millis() - cmd->sentAt);
+  }
+#ifdef RN487X_METRICS
+  _metricRecord(dev, cmd, status);
+#endif
+  TRACE(dev, CMD_DONE, status, millis() - cmd->sentAt, _traceText(cmd->text, RN487X_CMD_LEN));
+  cmd->status = status;
+  if (cmd->callback != NULL)
+  {
+    cmd->callback(cmd);
+  }
+  _cmdPump(dev);
 }
 
-// ------------------------------------------------------------------
-// Start Advertising immediately
-// ------------------------------------------------------------------
-bool rn487x_startImmediateAdvertising(uint8_t advType, const uint8_t *advData, size_t size)
+// ------------------------------------------------------------
+// Search a token in a line view (not NUL terminated)
+// ------------------------------------------------------------
+static bool _viewContains(const char *line, uint16_t len, const char *token)
 {
-  DEBUG_PRINTLN("[info] startImmediateAdvertising");
-
-  uint8_t cmdLen = strlen(START_IMMEDIATE_ADV);
-  uint8_t hexBuff[2] = {0};
-  _decToHex(advType, hexBuff, 2);
-
-  _clearBuffer();
-  memcpy(_uart_buffer, START_IMMEDIATE_ADV, cmdLen);
-  _uart_buffer[cmdLen] = hexBuff[0];
-  _uart_buffer[cmdLen + 1] = hexBuff[1];
-  _uart_buffer[cmdLen + 2] = ',';
-  for (uint8_t i = 0, j = 0; i < size; i++, j += 2)
-  {
-    _decToHex(advData[i], hexBuff, 2);
-    _uart_buffer[cmdLen + 3 + j] = hexBuff[0];
-    _uart_buffer[cmdLen + 3 + j + 1] = hexBuff[1];
-  }
-  rn487x_sendCommand(_uart_buffer);
-  if (_expectResponse(AOK_RESP, DEFAULT_CMD_TIMEOUT))
+  uint16_t tokenLen = strlen(token);
+  for (uint16_t i = 0; i + tokenLen <= len; i++)
   {
-    return true;
+    if (line[i] == token[0] && memcmp(&line[i], token, tokenLen) == 0)
+    {
+      return true;
+    }
   }
   return false;
 }
 
-/**************************** Services *********************************/
-
-// ----------------------------------------------------------------------
-// Clears all settings of services and characteristics.
-// A power cycle is required afterwards to make the changes effective.
-// ----------------------------------------------------------------------
-bool rn487x_clearAllServices(void)
+// ------------------------------------------------------------
+// Compare a view (not NUL terminated) with a string
+// ------------------------------------------------------------
+static bool _viewEquals(const char *view, uint16_t len, const char *str)
 {
-  DEBUG_PRINTLN("[info] cleanAllServices");
+  return strlen(str) == len && memcmp(view, str, len) == 0;
+}
 
-  rn487x_sendCommand(CLEAR_ALL_SERVICES);
-  if (_expectResponse(AOK_RESP, DEFAULT_CMD_TIMEOUT))
+#ifdef RN487X_SHADOW
+// ------------------------------------------------------------
+// Check whether a characteristic fits the shadow table
+// ------------------------------------------------------------
+static bool _shadowed(const ble_charact_t *bc)
+{
+  if (bc->index < BLE_MAX_NUMBER_OF_CHARACTERISTICS && bc->length <= MAX_CHARACT_VALUE_LEN)
   {
     return true;
   }
   return false;
 }
 
-// ------------------------------------------------------------------
-// Set Manufacturer Name in Device Info Service
-// ------------------------------------------------------------------
-bool rn487x_deviceService_setManufName(const char *name)
+// ------------------------------------------------------------
+// Drop the given flags from every shadow entry
+// ------------------------------------------------------------
+static void _shadowForget(rn487x_t *dev, uint8_t flags)
+{
+  for (uint8_t i = 0; i < BLE_MAX_NUMBER_OF_CHARACTERISTICS; i++)
+  {
+    if (dev->shadow[i].flags & flags & SHADOW_DIRTY)
+    {
+      dev->shadowDirty--;
+    }
+    dev->shadow[i].flags &= ~flags;
+  }
+}
+
+// ------------------------------------------------------------
+// Drop the shadow value of a characteristic, its pending SHW
+// included
+// ------------------------------------------------------------
+static void _shadowDrop(rn487x_t *dev, uint16_t index)
+{
+  if (dev->shadow[index].flags & SHADOW_DIRTY)
+  {
+    dev->shadowDirty--;
+  }
+  dev->shadow[index].flags = 0;
+}
+
+// ------------------------------------------------------------
+// A central wrote a local characteristic (%WV,<handle>,<value>%):
+// its value is newer than the shadow one, pending or not
+// ------------------------------------------------------------
+static void _shadowRemoteWrite(rn487x_t *dev, const char *args, uint16_t len)
+{
+  uint16_t handle;
+  if (len < 4 || !rn487x_hexDecodeU16(args, &handle))
+  {
+    return;
+  }
+  for (uint8_t i = 0; i < BLE_MAX_NUMBER_OF_CHARACTERISTICS; i++)
+  {
+    if (dev->charactHandles[i] == handle)
+    {
+      _shadowDrop(dev, i);
+    }
+  }
+}
+#else
+#define _shadowForget(__dev__, __flags__)
+#define _shadowRemoteWrite(__dev__, __args__, __len__)
+#endif
+
+#ifdef RN487X_SCAN
+// ------------------------------------------------------------
+// Fold a view into an FNV-1a hash
+// ------------------------------------------------------------
+static uint32_t _fnv(uint32_t hash, const char *data, uint16_t len)
+{
+  for (uint16_t i = 0; i < len; i++)
+  {
+    hash = (hash ^ (uint8_t)data[i]) * FNV_PRIME;
+  }
+  return hash;
+}
+
+// ------------------------------------------------------------
+// RSSI field of a scan report, signed decimal or 8-bit hex
+// ------------------------------------------------------------
+static bool _scanRssi(const char *field, uint16_t len, int8_t *rssi)
+{
+  uint8_t value = 0;
+  if (len >= 2 && len <= 4 && field[0] == '-')
+  {
+    int16_t dbm = 0;
+    for (uint16_t i = 1; i < len; i++)
+    {
+      if (field[i] < '0' || field[i] > '9')
+      {
+        return false;
+      }
+      dbm = 10 * dbm + (field[i] - '0');
+    }
+    *rssi = -dbm;
+    return true;
+  }
+  if (len == 2 && rn487x_hexDecodeU8(field, &value))
+  {
+    *rssi = (int8_t)value;
+    return true;
+  }
+  return false;
+}
+
+// ------------------------------------------------------------
+// Check a report against the duplicate filter and record it.
+// A device sending a new payload takes over its own entry.
+// ------------------------------------------------------------
+static bool _scanSeen(rn487x_t *dev, uint32_t addrHash, uint32_t hash)
+{
+  uint32_t *set = &dev->scanFilter[2 * (addrHash & SCAN_SET_MASK)];
+  uint32_t entry = (addrHash & 0xFFFF0000UL) | ((hash ^ (hash >> 16)) & 0xFFFF);
+  entry = (entry == 0) ? 1 : entry;
+  for (uint8_t way = 0; way < 2; way++)
+  {
+    if ((set[way] ^ entry) <= 0xFFFF && set[way] != 0)
+    {
+      bool seen = (set[way] == entry);
+      set[way] = entry;
+      return seen;
+    }
+  }
+  set[1] = set[0];
+  set[0] = entry;
+  return false;
+}
+
+// ------------------------------------------------------------
+// Parse a scan report in place, one pass over its fields:
+//   <address>,<type>,<name>,<UUIDs>,<RSSI>
+//   <address>,<type>,<RSSI>,Brcst:<data>
+// The duplicate filter hashes every field but the RSSI and
+// stops the duplicates before any hex is decoded; a malformed
+// report is invalid once, its repeats are duplicates. New
+// reports go to the result ring, over the oldest one if full.
+// ------------------------------------------------------------
+static void _scanReport(rn487x_t *dev, const char *text, uint16_t len)
+{
+  rn487x_scan_report_t report;
+  const char *rssiField = NULL;
+  uint16_t rssiLen = 0;
+  const char *data = NULL;
+  uint16_t dataLen = 0;
+  uint16_t start = MAC_ADDRESS_LEN + 1;
+  uint32_t hash = FNV_OFFSET;
+
+  dev->scanStats.reports++;
+  if (len < start + 1 || text[MAC_ADDRESS_LEN] != ',')
+  {
+    dev->scanStats.invalid++;
+    return;
+  }
+  for (uint8_t field = 1; start <= len; field++)
+  {
+    uint16_t end = start;
+    while (end < len && text[end] != ',')
+    {
+      end++;
+    }
+    const char *f = &text[start];
+    uint16_t flen = end - start;
+    if (flen > _CMD_LEN(BROADCAST_DATA) && memcmp(f, BROADCAST_DATA, _CMD_LEN(BROADCAST_DATA)) == 0)
+    {
+      data = &f[_CMD_LEN(BROADCAST_DATA)];
+      dataLen = flen - _CMD_LEN(BROADCAST_DATA);
+      if (dataLen > 2 * MAX_ADV_DATA_LEN)
+      {
+        dev->scanStats.invalid++;
+        return;
+      }
+      hash = _fnv(hash, f, flen);
+      break; // the RSSI field came just before
+    }
+    if (field > 1)
+    {
+      // Hashed once it is known not to be the RSSI
+      hash = _fnv(hash, rssiField, rssiLen);
+      rssiField = f;
+      rssiLen = flen;
+    }
+    else
+    {
+      hash = _fnv(hash, f, flen);
+    }
+    start = end + 1;
+  }
+  if (rssiField == NULL || !_scanRssi(rssiField, rssiLen, &report.rssi))
+  {
+    dev->scanStats.invalid++;
+    return;
+  }
+
+  if (_scanSeen(dev, _fnv(FNV_OFFSET, text, MAC_ADDRESS_LEN), hash))
+  {
+    dev->scanStats.duplicates++;
+    return;
+  }
+  if (!rn487x_hexDecode(text, MAC_ADDRESS_LEN, report.address) ||
+      (data != NULL && !rn487x_hexDecode(data, dataLen, report.data)))
+  {
+    dev->scanStats.invalid++;
+    return;
+  }
+  report.addressType = text[MAC_ADDRESS_LEN + 1] - '0';
+  report.dataLen = dataLen / 2;
+  if ((uint16_t)(dev->scanHead - dev->scanTail) == RN487X_SCAN_RING_LEN)
+  {
+    dev->scanTail++;
+    dev->scanStats.overwritten++;
+  }
+  dev->scanRing[dev->scanHead & SCAN_RING_MASK] = report;
+  dev->scanHead++;
+}
+#endif
+
+// ------------------------------------------------------------
+// Known reply a string is, RN487X_REPLY_UNKNOWN if none
+// ------------------------------------------------------------
+static uint8_t _replyKind(const char *str)
+{
+  for (uint8_t i = 0; str != NULL && i < sizeof(_replies) / sizeof(_replies[0]); i++)
+  {
+    if (strcmp(str, _replies[i].token) == 0)
+    {
+      return _replies[i].kind;
+    }
+  }
+  return RN487X_REPLY_UNKNOWN;
+}
+
+// ------------------------------------------------------------
+// Match a reply line against the command in flight. kind is the
+// known reply the line is, from the response matcher. A known
+// expected reply is compared by kind; Err completes any command
+// not expecting it, a listing included.
+// ------------------------------------------------------------
+static void _dispatchLine(rn487x_t *dev, const char *line, uint16_t len, uint8_t kind)
+{
+  rn487x_cmd_t *cmd = dev->cmdHead;
+  bool isPrompt = (kind == RN487X_REPLY_PROMPT);
+
+#ifdef RN487X_DEBUG
+  char dbg[RN487X_LINE_LEN + 1]; // a line is up to RN487X_LINE_LEN long
+  memcpy(dbg, line, len);
+  dbg[len] = 0;
+  DEBUG_PRINT("  => Received (");
+  DEBUG_PRINT(dbg);
+  DEBUG_PRINTLN(")");
+#endif
+  TRACE(dev, LINE, 0, len, _traceText(line, len));
+  if (cmd == NULL || cmd->status != RN487X_CMD_SENT)
+  {
+    // Unsolicited, or owed by an attempt sent again
+    if (!isPrompt && dev->replyOwed > 0 && --dev->replyOwed == 0 && dev->replyDrain)
+    {
+      dev->replyDrain = false;
+      dev->retryBackoff = 0;
+    }
+    return;
+  }
+  cmd->reply = (rn487x_reply_t)kind;
+  if (kind == RN487X_REPLY_ERR && cmd->expectKind != RN487X_REPLY_ERR)
+  {
+    _cmdComplete(dev, RN487X_CMD_ERR, line, len);
+  }
+  else if (cmd->expectKind != RN487X_REPLY_UNKNOWN  ? kind == cmd->expectKind
+           : cmd->expected != NULL                  ? _viewContains(line, len, cmd->expected)
+                                                    : !isPrompt)
+  {
+    _cmdComplete(dev, RN487X_CMD_OK, line, len);
+  }
+  else if (isPrompt)
+  {
+    // Prompt left over from the previous command
+  }
+  else if (cmd->onLine != NULL)
+  {
+    cmd->onLine(cmd, line, len);
+  }
+  else
+  {
+    _cmdComplete(dev, RN487X_CMD_ERR, line, len);
+  }
+}
+
+// ------------------------------------------------------------
+// Split an event "NAME,args" and call the handler registered
+// for NAME, or the default handler
+// ------------------------------------------------------------
+static void _dispatchEvent(rn487x_t *dev, const char *text, uint16_t len)
+{
+  rn487x_event_t evt;
+  rn487x_event_cb_t callback = dev->eventDefault;
+  void *arg = dev->eventDefaultArg;
+
+#ifdef RN487X_SCAN
+  // Scan reports are the bulk of the traffic while scanning
+  if (dev->scanning && len > MAC_ADDRESS_LEN && text[MAC_ADDRESS_LEN] == ',')
+  {
+    _scanReport(dev, text, len);
+    return;
+  }
+#endif
+
+  evt.name = text;
+  evt.nameLen = 0;
+  while (evt.nameLen < len && text[evt.nameLen] != ',')
+  {
+    evt.nameLen++;
+  }
+  evt.args = (evt.nameLen < len) ? &text[evt.nameLen + 1] : &text[len];
+  evt.argsLen = (evt.nameLen < len) ? len - evt.nameLen - 1 : 0;
+
+  if (_viewEquals(evt.name, evt.nameLen, BLE_EVENT_CONNECT))
+  {
+    dev->connected = true;
+  }
+  else if (_viewEquals(evt.name, evt.nameLen, BLE_EVENT_DISCONNECT))
+  {
+    dev->connected = false;
+  }
+  else if (_viewEquals(evt.name, evt.nameLen, BLE_EVENT_REBOOT))
+  {
+    // Booted in data mode, nothing sent before the reboot matters
+    dev->connected = false;
+    dev->booted = true;
+    dev->operationMode = DATA_MODE;
+    dev->dataTxPending = false;
+#ifdef RN487X_SCAN
+    dev->scanning = false;
+#endif
+    _shadowForget(dev, SHADOW_VALID);
+  }
+  else if (_viewEquals(evt.name, evt.nameLen, BLE_EVENT_WRITE_VALUE))
+  {
+    _shadowRemoteWrite(dev, evt.args, evt.argsLen);
+  }
+  for (uint8_t i = 0; i < RN487X_MAX_EVENT_HANDLERS; i++)
+  {
+    if (dev->eventHandlers[i].name != NULL && _viewEquals(evt.name, evt.nameLen, dev->eventHandlers[i].name))
+    {
+      callback = dev->eventHandlers[i].callback;
+      arg = dev->eventHandlers[i].arg;
+      break;
+    }
+  }
+
+  DEBUG_PRINTLN("  => Event");
+  TRACE(dev, EVENT, 0, len, _traceText(text, len));
+  if (callback != NULL)
+  {
+    callback(&evt, arg);
+  }
+}
+
+// ------------------------------------------------------------
+// Contiguous view of len bytes of the ring from 'from'. Only
+// bytes wrapping around the end of the ring are copied.
+// ------------------------------------------------------------
+static const char *_rxView(rn487x_t *dev, uint16_t from, uint16_t len)
+{
+  uint16_t start = from & RX_RING_MASK;
+  if (start + len <= RN487X_RX_RING_LEN)
+  {
+    return (const char *)&dev->rxRing[start];
+  }
+  uint16_t first = RN487X_RX_RING_LEN - start;
+  memcpy(dev->rxLine, &dev->rxRing[start], first);
+  memcpy(&dev->rxLine[first], dev->rxRing, len - first);
+  return dev->rxLine;
+}
+
+// ------------------------------------------------------------
+// Hand the line [dev->rxTail, end) to the dispatcher. It is a
+// known reply if the matcher kept one as long as the whole line.
+// ------------------------------------------------------------
+static void _rxDeliver(rn487x_t *dev, uint16_t end)
+{
+  uint16_t len = end - dev->rxTail;
+  uint8_t kind = RN487X_REPLY_UNKNOWN;
+  if (len == 0)
+  {
+    return;
+  }
+  for (uint8_t i = 0; i < sizeof(_replies) / sizeof(_replies[0]); i++)
+  {
+    if ((dev->rxMatch & (1U << i)) && _replies[i].len == len)
+    {
+      kind = _replies[i].kind;
+    }
+  }
+  _dispatchLine(dev, _rxView(dev, dev->rxTail, len), len, kind);
+}
+
+// ------------------------------------------------------------
+// Response matcher: drop the known replies the byte at the end
+// of the line rules out. The reply is decided once the line
+// ends (_rxDeliver): "AOK" is a reply, "AOKAY" is not.
+// ------------------------------------------------------------
+static void _rxMatch(rn487x_t *dev, char c)
+{
+  uint16_t pos = dev->rxScan - 1 - dev->rxTail;
+  uint8_t mask = dev->rxMatch;
+  for (uint8_t i = 0; (mask >> i) != 0; i++)
+  {
+    if ((mask & (1U << i)) && (pos >= _replies[i].len || _replies[i].token[pos] != c))
+    {
+      mask &= ~(1U << i);
+    }
+  }
+  dev->rxMatch = mask;
+}
+
+// ------------------------------------------------------------
+// Hand the event [dev->rxEventAt, end), delimiters included, to
+// the event dispatcher, then drop it from the ring: the start of
+// the line it was cut into moves up to the bytes after it.
+// ------------------------------------------------------------
+static void _rxDeliverEvent(rn487x_t *dev, uint16_t end)
+{
+  uint16_t len = end - dev->rxEventAt - 2;
+  uint16_t from = dev->rxEventAt;
+  uint16_t to = end;
+  _dispatchEvent(dev, _rxView(dev, dev->rxEventAt + 1, len), len);
+  while (from != dev->rxTail)
+  {
+    from--;
+    to--;
+    dev->rxRing[to & RX_RING_MASK] = dev->rxRing[from & RX_RING_MASK];
+  }
+  dev->rxTail = to;
+}
+
+// ------------------------------------------------------------
+// Data mode while connected: the bytes are the peer's and go to
+// the data handler as they are, '%' included. Only %DISCONNECT%,
+// which ends the stream, is looked for; its bytes are passed on
+// too and the bytes after it are framed again.
+// ------------------------------------------------------------
+static bool _rxDataMode(rn487x_t *dev)
+{
+  if (dev->operationMode == DATA_MODE && dev->connected && dev->cmdHead == NULL)
+  {
+    return true;
+  }
+  return false;
+}
+
+static void _rxData(rn487x_t *dev, uint16_t head)
+{
+  static const char marker[] = "%" BLE_EVENT_DISCONNECT "%";
+  bool disconnected = false;
+  while (dev->rxScan != head && !disconnected)
+  {
+    char c = dev->rxRing[dev->rxScan & RX_RING_MASK];
+    dev->rxScan++;
+    dev->rxDataMatch = (c == marker[dev->rxDataMatch]) ? dev->rxDataMatch + 1 : (c == marker[0]);
+    if (dev->rxDataMatch == sizeof(marker) - 1)
+    {
+      dev->rxDataMatch = 0;
+      disconnected = true;
+    }
+  }
+  while (dev->rxTail != dev->rxScan)
+  {
+    uint16_t start = dev->rxTail & RX_RING_MASK;
+    uint16_t len = dev->rxScan - dev->rxTail;
+    if (start + len > RN487X_RX_RING_LEN)
+    {
+      len = RN487X_RX_RING_LEN - start;
+    }
+    if (dev->dataHandler != NULL)
+    {
+      dev->dataHandler(&dev->rxRing[start], len, dev->dataArg);
+    }
+    dev->rxTail += len;
+  }
+  if (disconnected)
+  {
+    _dispatchEvent(dev, BLE_EVENT_DISCONNECT, sizeof(BLE_EVENT_DISCONNECT) - 1);
+  }
+}
+
+// ------------------------------------------------------------
+// Check whether the bytes just before 'end' are the prompt
+// "CMD> ", which is not followed by CR
+// ------------------------------------------------------------
+static bool _rxIsPrompt(rn487x_t *dev, uint16_t end)
+{
+  if ((uint16_t)(end - dev->rxTail) < PROMPT_LEN)
+  {
+    return false;
+  }
+  for (uint8_t i = 0; i < PROMPT_LEN; i++)
+  {
+    if (dev->rxRing[(end - PROMPT_LEN + i) & RX_RING_MASK] != (uint8_t)(PROMPT " ")[i])
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// ------------------------------------------------------------
+// Frame the received bytes into lines: CR terminates a line,
+// LF at the start of a line is skipped and the prompt ends a
+// line by itself. Over-long lines are split.
+// Events (%...%) are pulled out of the stream wherever they
+// appear; a line cut by an event goes on after it, the event
+// counting toward the line length. In data mode the peer's
+// bytes are not framed (_rxData).
+// ------------------------------------------------------------
+static void _rxFrame(rn487x_t *dev)
+{
+  uint16_t head = dev->rxHead;
+  while (dev->rxScan != head)
+  {
+    if (dev->rxScan == dev->rxTail)
+    {
+      if (_rxDataMode(dev))
+      {
+        // The LF ending the reply that entered data mode is no data
+        if (dev->rxCr && dev->rxRing[dev->rxScan & RX_RING_MASK] == LF)
+        {
+          dev->rxScan++;
+          dev->rxTail = dev->rxScan;
+        }
+        dev->rxCr = false;
+        _rxData(dev, head);
+        continue;
+      }
+      dev->rxMatch = REPLIES_ALL;
+    }
+    char c = dev->rxRing[dev->rxScan & RX_RING_MASK];
+    dev->rxScan++;
+    dev->rxCr = (c == CR);
+    if (c == EVENT_DELIMITER)
+    {
+      if (dev->rxInEvent)
+      {
+        dev->rxInEvent = false;
+        _rxDeliverEvent(dev, dev->rxScan);
+      }
+      else
+      {
+        dev->rxEventAt = dev->rxScan - 1;
+        dev->rxInEvent = true;
+      }
+      continue;
+    }
+    if (dev->rxInEvent)
+    {
+      if (c != CR && (uint16_t)(dev->rxScan - dev->rxTail) < RN487X_LINE_LEN)
+      {
+        continue;
+      }
+      // Not an event after all, frame it as part of the line
+      dev->rxInEvent = false;
+      dev->rxMatch = 0;
+    }
+    if (c == CR)
+    {
+      _rxDeliver(dev, dev->rxScan - 1);
+      dev->rxTail = dev->rxScan;
+    }
+    else if (c == LF && (uint16_t)(dev->rxScan - 1) == dev->rxTail)
+    {
+      dev->rxTail = dev->rxScan;
+    }
+    else if (c == ' ' && _rxIsPrompt(dev, dev->rxScan))
+    {
+      _rxDeliver(dev, dev->rxScan - 1);
+      dev->rxTail = dev->rxScan;
+    }
+    else
+    {
+      if (dev->rxMatch != 0)
+      {
+        _rxMatch(dev, c);
+      }
+      if ((uint16_t)(dev->rxScan - dev->rxTail) >= RN487X_LINE_LEN)
+      {
+        _rxDeliver(dev, dev->rxScan);
+        dev->rxTail = dev->rxScan;
+      }
+    }
+  }
+}
+
+// ------------------------------------------------------------
+// Submit a command and run the engine until it completes
+// ------------------------------------------------------------
+static rn487x_status_t _wait(rn487x_t *dev, rn487x_cmd_t *cmd)
+{
+  if (!rn487x_dev_submit(dev, cmd))
+  {
+    return RN487X_CMD_ERR;
+  }
+  while (!rn487x_cmdDone(cmd))
+  {
+    rn487x_dev_process(dev);
+  }
+  return cmd->status;
+}
+
+// ------------------------------------------------------------
+// Reset a command, text excluded, and start building its text
+// ------------------------------------------------------------
+static void _cmdBegin(rn487x_cmd_t *cmd, rn487x_cmdbuf_t *cb, const char *expected, uint16_t timeout)
+{
+  cmd->expected = expected;
+  cmd->timeout = timeout;
+  cmd->flags = 0;
+  cmd->callback = NULL;
+  cmd->onLine = NULL;
+  cmd->arg = NULL;
+  cmd->resp = NULL;
+  cmd->respSize = 0;
+  cmd->respLen = 0;
+  cmd->status = RN487X_CMD_QUEUED;
+  cmd->next = NULL;
+  rn487x_cmdbufInit(cb, cmd->text, RN487X_CMD_LEN);
+}
+
+// ------------------------------------------------------------
+// Start building the command of a blocking function, its reply
+// line is left in dev->uartBuffer
+// ------------------------------------------------------------
+static void _syncBegin(rn487x_t *dev, rn487x_cmdbuf_t *cb, const char *expected, uint16_t timeout)
+{
+  _cmdBegin(&dev->syncCmd, cb, expected, timeout);
+  dev->syncCmd.resp = dev->uartBuffer;
+  dev->syncCmd.respSize = UART_BUFF_LEN;
+}
+
+// ------------------------------------------------------------
+// Terminate the command of a blocking function and run it
+// ------------------------------------------------------------
+static rn487x_status_t _syncRun(rn487x_t *dev, rn487x_cmdbuf_t *cb)
+{
+  if (!rn487x_cmdbufEnd(cb))
+  {
+    DEBUG_PRINTLN("[error] Command too long");
+    return RN487X_CMD_ERR;
+  }
+  return _wait(dev, &dev->syncCmd);
+}
+
+// ------------------------------------------------------------
+// Blocking command made of a single constant text
+// ------------------------------------------------------------
+static rn487x_status_t _execute(rn487x_t *dev, const char *text, uint16_t len, const char *expected, uint16_t timeout)
+{
+  rn487x_cmdbuf_t cb;
+  _syncBegin(dev, &cb, expected, timeout);
+  rn487x_cmdbufAppend(&cb, text, len);
+  return _syncRun(dev, &cb);
+}
+
+// ------------------------------------------------------------
+// Build the SHW of a characteristic value
+// ------------------------------------------------------------
+static bool _writePrepare(rn487x_t *dev, rn487x_cmd_t *cmd, uint16_t index, const uint8_t *value, uint8_t length)
+{
+  rn487x_cmdbuf_t cb;
+  _cmdBegin(cmd, &cb, AOK_RESP, DEFAULT_CMD_TIMEOUT);
+  rn487x_cmdbufAppendLit(&cb, WRITE_LOCAL_CHARACT);
+  rn487x_cmdbufAppendHexU16(&cb, dev->charactHandles[index]);
+  rn487x_cmdbufAppendChar(&cb, ',');
+  rn487x_cmdbufAppendHex(&cb, value, length);
+  return rn487x_cmdbufEnd(&cb);
+}
+
+#ifdef RN487X_SHADOW
+// ------------------------------------------------------------
+// Completion of a combined SHW. A value written again or
+// dropped in the meantime is not the one the module holds. A
+// value that failed is dirty again, sent once its window
+// elapses anew, unless it changed in the meantime.
+// ------------------------------------------------------------
+static void _shadowSent(rn487x_cmd_t *cmd)
+{
+  rn487x_t *dev = cmd->dev;
+  uint16_t index = (uint16_t)(uintptr_t)cmd->arg;
+  uint8_t flags = dev->shadow[index].flags;
+  dev->shadowBusy = false;
+  dev->shadow[index].flags &= ~SHADOW_SENT;
+  if ((flags & (SHADOW_SENT | SHADOW_DIRTY)) != SHADOW_SENT)
+  {
+    flags = 0; // written again or dropped in the meantime
+  }
+  if (cmd->status != RN487X_CMD_OK)
+  {
+    DEBUG_PRINTLN("[error] Combined write failed");
+    dev->shadowFailed = true;
+    if (flags)
+    {
+      dev->shadow[index].flags |= SHADOW_DIRTY;
+      dev->shadow[index].dirtyAt = millis();
+      dev->shadowDirty++;
+    }
+  }
+  else if (flags)
+  {
+    dev->shadow[index].flags |= SHADOW_VALID;
+  }
+}
+
+// ------------------------------------------------------------
+// Send the SHW of the oldest shadow value whose window has
+// elapsed (any dirty value with force), one at a time and only
+// while the command engine is idle in command mode
+// ------------------------------------------------------------
+static void _shadowPump(rn487x_t *dev, bool force)
+{
+  if (dev->shadowDirty == 0 || dev->shadowBusy || dev->cmdHead != NULL || dev->operationMode != CMD_MODE)
+  {
+    return;
+  }
+  uint32_t now = millis();
+  int16_t oldest = -1;
+  for (uint8_t i = 0; i < BLE_MAX_NUMBER_OF_CHARACTERISTICS; i++)
+  {
+    if ((dev->shadow[i].flags & SHADOW_DIRTY) &&
+        (oldest < 0 || (now - dev->shadow[i].dirtyAt) > (now - dev->shadow[oldest].dirtyAt)))
+    {
+      oldest = i;
+    }
+  }
+  if (!force && (now - dev->shadow[oldest].dirtyAt) < dev->shadowWindow)
+  {
+    return;
+  }
+  if (!_writePrepare(dev, &dev->shadowCmd, oldest, dev->shadow[oldest].value, dev->shadow[oldest].length))
+  {
+    // The SHW does not fit a command, the value can never be sent
+    DEBUG_PRINTLN("[error] Combined write too long");
+    dev->shadowFailed = true;
+    _shadowDrop(dev, oldest);
+    return;
+  }
+  dev->shadowCmd.callback = _shadowSent;
+  dev->shadowCmd.arg = (void *)(uintptr_t)oldest;
+  dev->shadowBusy = true;
+  dev->shadow[oldest].flags = (dev->shadow[oldest].flags & ~SHADOW_DIRTY) | SHADOW_SENT;
+  dev->shadowDirty--;
+  rn487x_dev_submit(dev, &dev->shadowCmd);
+}
+#else
+#define _shadowPump(__dev__, __force__)
+#endif
+
+// ------------------------------------------------------------
+// AD structure of a beacon or advertisement command: the AD
+// type, then the data in hex
+// ------------------------------------------------------------
+static void _adAppend(rn487x_cmdbuf_t *cb, uint8_t adType, const uint8_t *adData, size_t size)
+{
+  rn487x_cmdbufAppendHexU8(cb, adType);
+  rn487x_cmdbufAppendChar(cb, ',');
+  rn487x_cmdbufAppendHex(cb, adData, size);
+}
+
+#ifdef RN487X_BEACON
+// ------------------------------------------------------------
+// Completion of a command of the beacon rotation
+// ------------------------------------------------------------
+static void _beaconSent(rn487x_cmd_t *cmd)
+{
+  rn487x_t *dev = cmd->dev;
+  if (cmd->status != RN487X_CMD_OK)
+  {
+    DEBUG_PRINTLN("[error] Beacon command failed");
+    dev->beaconFailed = true;
+  }
+  if (--dev->beaconPending == 0)
+  {
+    dev->beaconStats.rotations++;
+    dev->beaconStats.failures += dev->beaconFailed ? 1 : 0;
+  }
+}
+
+// ------------------------------------------------------------
+// Put the next beacon slot on air once the current one has had
+// its dwell time: IB,Z, then the IB commands of the slot as
+// encoded by rn487x_dev_beaconSlot(), pipelined. Only while the
+// command engine is idle in command mode, like the combined
+// writes. A failed rotation is not repeated, the next one
+// starts from IB,Z anyway.
+// ------------------------------------------------------------
+static void _beaconPump(rn487x_t *dev)
+{
+  if (!dev->beaconRunning || dev->beaconPending > 0 || dev->cmdHead != NULL || dev->operationMode != CMD_MODE)
+  {
+    return;
+  }
+  uint32_t now = millis();
+  if (dev->beaconOnAir && (now - dev->beaconAt) < dev->beaconSlots[dev->beaconSlot].dwell)
+  {
+    return;
+  }
+  uint8_t slot = dev->beaconSlot;
+  for (uint8_t i = 0; i < RN487X_BEACON_SLOTS; i++)
+  {
+    slot = (slot + 1) % RN487X_BEACON_SLOTS;
+    if (dev->beaconSlots[slot].count > 0)
+    {
+      break;
+    }
+  }
+  if (dev->beaconSlots[slot].count == 0)
+  {
+    return;
+  }
+  dev->beaconAt = now;
+  if (dev->beaconOnAir && slot == dev->beaconSlot)
+  {
+    return; // the only slot, still on air
+  }
+
+  uint32_t from = micros();
+  uint8_t count = 1 + dev->beaconSlots[slot].count;
+  const char *text = dev->beaconSlots[slot].text;
+  uint16_t bytes = 0;
+  rn487x_cmdPrepare(&dev->beaconCmds[0], CLEAR_IMMEDIATE_BEACON, AOK_RESP, DEFAULT_CMD_TIMEOUT);
+  for (uint8_t i = 1; i < count; i++)
+  {
+    rn487x_cmdPrepare(&dev->beaconCmds[i], text, AOK_RESP, DEFAULT_CMD_TIMEOUT);
+    text += strlen(text) + 1;
+  }
+  dev->beaconSlot = slot;
+  dev->beaconOnAir = true;
+  dev->beaconFailed = false;
+  dev->beaconPending = count;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    rn487x_cmd_t *cmd = &dev->beaconCmds[i];
+    cmd->flags = RN487X_CMD_FLAG_PIPELINE;
+    cmd->callback = _beaconSent;
+    bytes += strlen(cmd->text) + 1;
+    rn487x_dev_submit(dev, cmd);
+  }
+  uint32_t us = micros() - from;
+  dev->beaconStats.commands += count;
+  dev->beaconStats.txBytes += bytes;
+  dev->beaconStats.cpuUs += us;
+  dev->beaconStats.cpuMaxUs = (us > dev->beaconStats.cpuMaxUs) ? us : dev->beaconStats.cpuMaxUs;
+  TRACE(dev, BEACON, slot, bytes, us);
+}
+#else
+#define _beaconPump(__dev__)
+#endif
+
+#ifdef RN487X_STREAM
+// ------------------------------------------------------------
+// Refill the stream credit, the module drains its buffer at
+// dev->streamRate whether or not we are sending
+// ------------------------------------------------------------
+static void _streamCredit(rn487x_t *dev)
+{
+  uint32_t now = millis();
+  uint32_t elapsed = now - dev->streamCreditAt;
+  dev->streamCreditAt = now;
+  if (dev->streamRate == 0)
+  {
+    return;
+  }
+  if (elapsed >= (RN487X_STREAM_BURST * 1000UL) / dev->streamRate)
+  {
+    dev->streamCredit = RN487X_STREAM_BURST * 1000UL;
+    return;
+  }
+  dev->streamCredit += elapsed * dev->streamRate;
+  if (dev->streamCredit > RN487X_STREAM_BURST * 1000UL)
+  {
+    dev->streamCredit = RN487X_STREAM_BURST * 1000UL;
+  }
+}
+
+// ------------------------------------------------------------
+// Send the stream in chunks while there is credit. Data only
+// goes out in data mode, to a connected peer, with no command
+// pending and the module awake.
+// ------------------------------------------------------------
+static void _streamPump(rn487x_t *dev)
+{
+  _streamCredit(dev);
+  if (dev->operationMode != DATA_MODE || !dev->connected || dev->cmdHead != NULL || _powerDown(dev))
+  {
+    return;
+  }
+  while (dev->streamHead != dev->streamTail)
+  {
+    uint16_t n = dev->streamHead - dev->streamTail;
+    if (n > dev->streamChunk)
+    {
+      n = dev->streamChunk;
+    }
+    if (dev->streamRate != 0)
+    {
+      if (dev->streamCredit < n * 1000UL)
+      {
+        return;
+      }
+      dev->streamCredit -= n * 1000UL;
+    }
+    if (_txFree(dev) < n)
+    {
+      return;
+    }
+    uint16_t start = dev->streamTail & STREAM_MASK;
+    uint16_t first = (n > RN487X_STREAM_BUF_LEN - start) ? RN487X_STREAM_BUF_LEN - start : n;
+    _txWrite(dev, &dev->streamBuf[start], first);
+    _txWrite(dev, dev->streamBuf, n - first);
+    dev->streamTail += n;
+    dev->dataTxAt = millis();
+    dev->dataTxPending = true;
+    dev->powerActiveAt = dev->dataTxAt;
+  }
+}
+
+static bool _streamIdle(rn487x_t *dev)
+{
+  return dev->streamHead == dev->streamTail;
+}
+#else
+#define _streamPump(__dev__)
+#define _streamIdle(__dev__) true
+#endif
+
+// ------------------------------------------------------------
+// Power manager tick. Asleep, the first command or stream data
+// starts the hold time, then one wake-up serves everything
+// queued by then. Awake, powerIdle ms without traffic and with
+// nothing queued put the module back to sleep.
+// ------------------------------------------------------------
+static void _powerPump(rn487x_t *dev)
+{
+  uint32_t now;
+  switch (dev->powerState)
+  {
+  case RN487X_POWER_SLEEP:
+    if (dev->cmdNext == NULL && _streamIdle(dev))
+    {
+      dev->powerHeld = false;
+      break;
+    }
+    now = millis();
+    if (!dev->powerHeld)
+    {
+      dev->powerHeld = true;
+      dev->powerHeldAt = now;
+    }
+    if ((now - dev->powerHeldAt) >= dev->powerHold)
+    {
+      dev->powerHeld = false;
+      _powerWake(dev);
+    }
+    break;
+  case RN487X_POWER_WAKING:
+    now = millis();
+    if ((now - dev->powerSince) >= RN487X_WAKE_TIME_MS)
+    {
+      _powerEnter(dev, RN487X_POWER_AWAKE);
+      dev->powerActiveAt = now;
+      _cmdPump(dev);
+      _streamPump(dev);
+    }
+    break;
+  case RN487X_POWER_AWAKE:
+    if (dev->powerIdle != 0 && dev->cmdHead == NULL && _streamIdle(dev) &&
+        rn487x_dev_txIdle(dev) && (millis() - dev->powerActiveAt) >= dev->powerIdle)
+    {
+      _powerSleep(dev);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+// ------------------------------------------------------------
+// Forget any earlier %REBOOT% before resetting the module, which
+// comes back in data mode without a link: its %REBOOT% must be
+// framed as an event, not passed on as peer data
+// ------------------------------------------------------------
+static void _bootArm(rn487x_t *dev)
+{
+  dev->booted = false;
+  dev->connected = false;
+  dev->operationMode = DATA_MODE;
+  dev->replyOwed = 0;
+}
+
+// ------------------------------------------------------------
+// Wait for the %REBOOT% event, timeout is only an upper bound
+// ------------------------------------------------------------
+static bool _bootWait(rn487x_t *dev, uint16_t timeout)
+{
+  uint32_t start = millis();
+  while (!dev->booted)
+  {
+    if ((millis() - start) >= timeout)
+    {
+      DEBUG_PRINTLN("[warn] No %REBOOT% event");
+      return false;
+    }
+    rn487x_dev_process(dev);
+  }
+  return true;
+}
+
+// ------------------------------------------------------------
+// Get the current operation mode
+// ------------------------------------------------------------
+// static int _getOperationMode(void) {
+//   return dev->operationMode;
+// }
+
+// ------------------------------------------------------------
+// Fold an accepted definition command into the definition hash,
+// the NUL keeps "AB"+"C" apart from "A"+"BC"
+// ------------------------------------------------------------
+static void _hashDefinition(rn487x_t *dev, const char *text)
+{
+  uint32_t h = dev->definitionHash;
+  do
+  {
+    h = (h ^ (uint8_t)*text) * FNV_PRIME;
+  } while (*text++ != 0);
+  dev->definitionHash = h;
+}
+
+// ------------------------------------------------------------
+// Completion of a service definition (PS)
+// ------------------------------------------------------------
+static void _serviceDefined(rn487x_cmd_t *cmd)
+{
+  rn487x_t *dev = cmd->dev;
+  if (cmd->status == RN487X_CMD_OK)
+  {
+    _hashDefinition(dev, cmd->text);
+  }
+}
+
+// ------------------------------------------------------------
+// Completion of a characteristic definition (PC): the index
+// follows the order in which the module accepted them
+// ------------------------------------------------------------
+static void _charactDefined(rn487x_cmd_t *cmd)
+{
+  rn487x_t *dev = cmd->dev;
+  if (cmd->status == RN487X_CMD_OK)
+  {
+    ((ble_charact_t *)cmd->arg)->index = dev->charactIdCnt;
+    dev->charactIdCnt++;
+    _hashDefinition(dev, cmd->text);
+  }
+}
+
+// ------------------------------------------------------------
+// Restore the handles from the application cache, only if it
+// was saved for the current definitions
+// ------------------------------------------------------------
+static bool _cacheRestore(rn487x_t *dev)
+{
+  rn487x_handle_cache_t cache;
+  if (dev->cacheLoad == NULL || !dev->cacheLoad(&cache, dev->cacheArg))
+  {
+    return false;
+  }
+  if (cache.hash != dev->definitionHash || cache.count > BLE_MAX_NUMBER_OF_CHARACTERISTICS)
+  {
+    DEBUG_PRINTLN("[info] Handle cache mismatch");
+    return false;
+  }
+  memcpy(dev->charactHandles, cache.handles, cache.count * sizeof(uint16_t));
+  return true;
+}
+
+// ------------------------------------------------------------
+// Save the handles of the last LS listing
+// ------------------------------------------------------------
+static void _cacheSave(rn487x_t *dev)
+{
+  rn487x_handle_cache_t cache;
+  if (dev->cacheStore == NULL)
+  {
+    return;
+  }
+  memset(&cache, 0, sizeof(cache));
+  cache.hash = dev->definitionHash;
+  cache.count = dev->listIndex;
+  memcpy(cache.handles, dev->charactHandles, dev->listIndex * sizeof(uint16_t));
+  if (!dev->cacheStore(&cache, dev->cacheArg))
+  {
+    DEBUG_PRINTLN("[warn] Handle cache not saved");
+  }
+}
+
+// ------------------------------------------------------------
+// Parse one line of the LS listing. Only the hex digits and
+// commas are kept: <128-bit UUID>,<handle>,<property>
+// ------------------------------------------------------------
+static void _listLine(rn487x_cmd_t *cmd, const char *line, uint16_t len)
+{
+  rn487x_t *dev = cmd->dev;
+  char entry[PROPERTY_POS + 2];
+  uint16_t n = 0;
+  for (uint16_t k = 0; k < len && n < sizeof(entry); k++)
+  {
+    if (_IS_HEXCOMMA(line[k]))
+    {
+      entry[n++] = line[k];
+    }
+  }
+  if (dev->listOverflow || n < (PROPERTY_POS + 2))
+  {
+    return;
+  }
+  uint8_t prop = 0;
+  rn487x_hexDecodeU8(&entry[PROPERTY_POS], &prop);
+  if ((prop & (BLE_PROPERTY_INDICATE | BLE_PROPERTY_NOTIFY)) == 0)
+  {
+    rn487x_hexDecodeU16(&entry[HANDLE_POS], &dev->charactHandles[dev->listIndex]);
+    dev->listIndex++;
+  }
+  if (dev->listIndex > (BLE_MAX_NUMBER_OF_CHARACTERISTICS - 1))
+  {
+    dev->listOverflow = true;
+  }
+}
+
+// ------------------------------------------------------------
+// Run LS, the listing lines go to onLine
+// ------------------------------------------------------------
+static rn487x_status_t _listRun(rn487x_t *dev, rn487x_line_cb_t onLine)
+{
+  dev->listIndex = 0;
+  dev->listOverflow = false;
+  rn487x_cmdbuf_t cb;
+  _syncBegin(dev, &cb, PROMPT_END, LIST_CMD_TIMEOUT);
+  dev->syncCmd.onLine = onLine;
+  rn487x_cmdbufAppendLit(&cb, LIST_CHARACTERISTICS);
+  return _syncRun(dev, &cb);
+}
+
+// ------------------------------------------------------------
+// Compare one LS line with the next schema entry:
+//   <service UUID>
+//     <charact UUID>,<handle>,<property>
+// The configuration descriptor line following a notify or
+// indicate characteristic repeats its UUID and is skipped.
+// ------------------------------------------------------------
+static void _schemaLine(rn487x_cmd_t *cmd, const char *line, uint16_t len)
+{
+  rn487x_t *dev = cmd->dev;
+  const rn487x_charact_def_t *def;
+  uint16_t uuidLen = 0;
+  uint8_t prop = 0;
+
+  _listLine(cmd, line, len);
+  while (len > 0 && *line == ' ')
+  {
+    line++;
+    len--;
+  }
+  if (!dev->schema.match || len == 0)
+  {
+    return;
+  }
+  while (uuidLen < len && line[uuidLen] != ',')
+  {
+    uuidLen++;
+  }
+  if (uuidLen == len)
+  {
+    // Service: the previous one must be complete
+    if (dev->schema.service >= dev->schema.count ||
+        (dev->schema.service > 0 && dev->schema.charact != dev->schema.services[dev->schema.service - 1].count) ||
+        !_viewEquals(line, len, dev->schema.services[dev->schema.service].uuid))
+    {
+      dev->schema.match = false;
+      return;
+    }
+    dev->schema.service++;
+    dev->schema.charact = 0;
+    dev->schema.last = NULL;
+    return;
+  }
+  if (len < 3 || !rn487x_hexDecodeU8(&line[len - 2], &prop))
+  {
+    dev->schema.match = false;
+    return;
+  }
+  def = dev->schema.last;
+  if (def != NULL && (def->property & (BLE_PROPERTY_INDICATE | BLE_PROPERTY_NOTIFY)) &&
+      prop == CCCD_PROPERTY && _viewEquals(line, uuidLen, def->uuid))
+  {
+    return;
+  }
+  if (dev->schema.service == 0 || dev->schema.charact >= dev->schema.services[dev->schema.service - 1].count)
+  {
+    dev->schema.match = false;
+    return;
+  }
+  def = &dev->schema.services[dev->schema.service - 1].characts[dev->schema.charact];
+  if (!_viewEquals(line, uuidLen, def->uuid) || prop != def->property)
+  {
+    dev->schema.match = false;
+    return;
+  }
+  dev->schema.charact++;
+  dev->schema.last = def;
+}
+
+/** 
+ ===============================================================================
+            ##### Public functions #####
+ ===============================================================================
+ */
+
+// ------------------------------------------------------------
+// Set up an instance for the module behind io, nothing is sent.
+// rn487x_dev_init() resets and boots the module.
+// ------------------------------------------------------------
+void rn487x_dev_setup(rn487x_t *dev, const rn487x_io_t *io)
+{
+  memset(dev, 0, sizeof(*dev));
+  dev->io = *io;
+  dev->operationMode = DATA_MODE;
+  dev->baudrate = RN487X_DEFAULT_BAUDRATE;
+#ifdef RN487X_STREAM
+  dev->streamChunk = RN487X_STREAM_CHUNK;
+  dev->streamRate = RN487X_STREAM_RATE;
+  dev->streamCredit = RN487X_STREAM_BURST * 1000UL;
+#endif
+#ifdef RN487X_SHADOW
+  dev->shadowWindow = RN487X_SHADOW_WINDOW;
+#endif
+  dev->definitionHash = FNV_OFFSET;
+  dev->powerState = RN487X_POWER_AWAKE;
+  dev->powerSince = millis();
+  dev->retries = RN487X_RETRIES;
+  dev->timeoutMin = RN487X_TIMEOUT_MIN_MS;
+#ifdef RN487X_METRICS
+  dev->metrics.since = dev->powerSince;
+#endif
+}
+
+// ------------------------------------------------------------
+// Send a command
+// ------------------------------------------------------------
+void rn487x_dev_sendCommand(rn487x_t *dev, const char *cmd)
+{
+  DEBUG_PRINT(" => sendCommand: ");
+  DEBUG_PRINTLN(cmd);
+
+  _txWrite(dev, (const uint8_t *)cmd, strlen(cmd));
+  _txWrite(dev, (const uint8_t *)"\r", 1);
+}
+
+// ------------------------------------------------------------
+// Start building a command text in buf, one byte is kept for
+// the terminating NUL
+// ------------------------------------------------------------
+void rn487x_cmdbufInit(rn487x_cmdbuf_t *cb, char *buf, uint16_t size)
+{
+  cb->buf = buf;
+  cb->size = size;
+  cb->len = 0;
+  cb->overflow = false;
+}
+
+// ------------------------------------------------------------
+// Reserve n bytes at the end of the text, NULL on overflow
+// ------------------------------------------------------------
+static char *_cmdbufReserve(rn487x_cmdbuf_t *cb, uint16_t n)
+{
+  if (cb->overflow || n >= (cb->size - cb->len))
+  {
+    cb->overflow = true;
+    return NULL;
+  }
+  char *p = &cb->buf[cb->len];
+  cb->len += n;
+  return p;
+}
+
+void rn487x_cmdbufAppend(rn487x_cmdbuf_t *cb, const char *data, uint16_t len)
+{
+  char *p = _cmdbufReserve(cb, len);
+  if (p != NULL)
+  {
+    memcpy(p, data, len);
+  }
+}
+
+void rn487x_cmdbufAppendChar(rn487x_cmdbuf_t *cb, char c)
+{
+  char *p = _cmdbufReserve(cb, 1);
+  if (p != NULL)
+  {
+    *p = c;
+  }
+}
+
+void rn487x_cmdbufAppendHex(rn487x_cmdbuf_t *cb, const uint8_t *data, uint16_t len)
+{
+  char *p = _cmdbufReserve(cb, 2 * len);
+  if (p != NULL)
+  {
+    rn487x_hexEncode(data, len, p);
+  }
+}
+
+void rn487x_cmdbufAppendHexU8(rn487x_cmdbuf_t *cb, uint8_t value)
+{
+  char *p = _cmdbufReserve(cb, 2);
+  if (p != NULL)
+  {
+    rn487x_hexEncodeU8(value, p);
+  }
+}
+
+void rn487x_cmdbufAppendHexU16(rn487x_cmdbuf_t *cb, uint16_t value)
+{
+  char *p = _cmdbufReserve(cb, 4);
+  if (p != NULL)
+  {
+    rn487x_hexEncodeU16(value, p);
+  }
+}
+
+// ------------------------------------------------------------
+// NUL terminate the text, false if anything did not fit
+// ------------------------------------------------------------
+bool rn487x_cmdbufEnd(rn487x_cmdbuf_t *cb)
+{
+  if (cb->overflow)
+  {
+    return false;
+  }
+  cb->buf[cb->len] = 0;
+  return true;
+}
+
+// ------------------------------------------------------------
+// Prepare an asynchronous command, the optional fields are cleared
+// ------------------------------------------------------------
+bool rn487x_cmdPrepare(rn487x_cmd_t *cmd, const char *text, const char *expected, uint16_t timeout)
+{
+  rn487x_cmdbuf_t cb;
+  _cmdBegin(cmd, &cb, expected, timeout);
+  rn487x_cmdbufAppend(&cb, text, strlen(text));
+  return rn487x_cmdbufEnd(&cb);
+}
+
+// ------------------------------------------------------------
+// Queue a command. It is sent right away when nothing else is
+// pending, otherwise when the previous commands complete.
+// ------------------------------------------------------------
+bool rn487x_dev_submit(rn487x_t *dev, rn487x_cmd_t *cmd)
+{
+  if (cmd == NULL || cmd->text[0] == 0)
+  {
+    return false;
+  }
+  cmd->status = RN487X_CMD_QUEUED;
+  cmd->respLen = 0;
+  cmd->dev = dev;
+  cmd->cls = _cmdClass(cmd->text);
+  cmd->attempt = 0;
+  cmd->reply = RN487X_REPLY_UNKNOWN;
+  cmd->expectKind = _replyKind(cmd->expected);
+  cmd->next = NULL;
+  if (dev->cmdTail != NULL)
+  {
+    dev->cmdTail->next = cmd;
+  }
+  else
+  {
+    dev->cmdHead = cmd;
+  }
+  dev->cmdTail = cmd;
+  if (dev->cmdNext == NULL)
+  {
+    dev->cmdNext = cmd;
+  }
+  _cmdPump(dev);
+  return true;
+}
+
+// ------------------------------------------------------------
+// Check whether a submitted command has completed
+// ------------------------------------------------------------
+bool rn487x_cmdDone(const rn487x_cmd_t *cmd)
+{
+  return cmd->status >= RN487X_CMD_OK;
+}
+
+// ------------------------------------------------------------
+// Check whether no command is queued or in flight
+// ------------------------------------------------------------
+bool rn487x_dev_isIdle(rn487x_t *dev)
+{
+  return dev->cmdHead == NULL;
+}
+
+// ------------------------------------------------------------
+// Store a received byte in the RX ring. With RN487X_RX_ISR
+// defined, call it from the UART RX interrupt; otherwise
+// rn487x_dev_process() feeds the ring from the io read function.
+// ------------------------------------------------------------
+void rn487x_dev_rxFeed(rn487x_t *dev, uint8_t c)
+{
+  uint16_t head = dev->rxHead;
+  if ((uint16_t)(head - dev->rxTail) >= RN487X_RX_RING_LEN)
+  {
+    dev->rxOverruns++;
+    return;
+  }
+  dev->rxRing[head & RX_RING_MASK] = c;
+  dev->rxHead = head + 1;
+}
+
+// ------------------------------------------------------------
+// Number of bytes dropped because the RX ring was full
+// ------------------------------------------------------------
+uint16_t rn487x_dev_rxOverruns(rn487x_t *dev)
+{
+  return dev->rxOverruns;
+}
+
+// ------------------------------------------------------------
+// Known reply that completed the last blocking command, e.g.
+// RN487X_REPLY_ERR when a function returned false on an Err,
+// RN487X_REPLY_UNKNOWN on a timeout
+// ------------------------------------------------------------
+rn487x_reply_t rn487x_dev_lastReply(rn487x_t *dev)
+{
+  return dev->syncCmd.reply;
+}
+
+// ------------------------------------------------------------
+// Register the handler of an event, e.g. BLE_EVENT_CONNECT.
+// A NULL name sets the handler of the events nobody handles,
+// a NULL callback removes the handler.
+// ------------------------------------------------------------
+bool rn487x_dev_onEvent(rn487x_t *dev, const char *name, rn487x_event_cb_t callback, void *arg)
+{
+  int8_t freeSlot = -1;
+  if (name == NULL)
+  {
+    dev->eventDefault = callback;
+    dev->eventDefaultArg = arg;
+    return true;
+  }
+  for (uint8_t i = 0; i < RN487X_MAX_EVENT_HANDLERS; i++)
+  {
+    if (dev->eventHandlers[i].name != NULL && strcmp(dev->eventHandlers[i].name, name) == 0)
+    {
+      freeSlot = i;
+      break;
+    }
+    if (dev->eventHandlers[i].name == NULL && freeSlot < 0)
+    {
+      freeSlot = i;
+    }
+  }
+  if (freeSlot < 0)
+  {
+    DEBUG_PRINTLN("[error] Too many event handlers");
+    return false;
+  }
+  dev->eventHandlers[freeSlot].name = (callback != NULL) ? name : NULL;
+  dev->eventHandlers[freeSlot].callback = callback;
+  dev->eventHandlers[freeSlot].arg = arg;
+  return true;
+}
+
+// ------------------------------------------------------------
+// Connection state tracked from the events, no command sent
+// ------------------------------------------------------------
+bool rn487x_dev_isConnected(rn487x_t *dev)
+{
+  return dev->connected;
+}
+
+// ------------------------------------------------------------
+// Engine tick: frame received bytes, expire the command in
+// flight and send the next queued one. Call it from the main
+// loop; completion callbacks run from here.
+// ------------------------------------------------------------
+void rn487x_dev_process(rn487x_t *dev)
+{
+#ifndef RN487X_RX_ISR
+  while (dev->io.available(dev->io.arg) > 0)
+  {
+    rn487x_dev_rxFeed(dev, dev->io.read(dev->io.arg));
+    if ((uint16_t)(dev->rxHead - dev->rxTail) >= RN487X_RX_RING_LEN)
+    {
+      _rxFrame(dev);
+    }
+  }
+#endif
+  _rxFrame(dev);
+#ifdef RN487X_TRACE
+  if (dev->rxOverruns != dev->traceOverruns)
+  {
+    dev->traceOverruns = dev->rxOverruns;
+    TRACE(dev, RX_OVERRUN, 0, dev->traceOverruns, 0);
+  }
+#endif
+#ifdef RN487X_TX_DMA
+  // The reply timeout runs from the end of the transmit
+  if (dev->cmdHead != NULL && dev->cmdHead->status == RN487X_CMD_SENT && !_txSent(dev, dev->cmdHead->txEnd))
+  {
+    dev->cmdHead->sentAt = millis();
+  }
+#endif
+  if (dev->cmdHead != NULL && dev->cmdHead->status == RN487X_CMD_SENT &&
+      (millis() - dev->cmdHead->sentAt) >= dev->cmdHead->wait)
+  {
+    // Once a reply is missing, the replies of the other pipelined
+    // commands in flight can no longer be matched: resend them all
+    // or fail them all
+    uint8_t n = dev->cmdInflight;
+    DEBUG_PRINTLN("  => TIMEOUT!");
+    TRACE(dev, CMD_TIMEOUT, n, dev->cmdHead->wait, _traceText(dev->cmdHead->text, RN487X_CMD_LEN));
+    if (!_cmdRetry(dev))
+    {
+      while (n-- > 0)
+      {
+        _cmdComplete(dev, RN487X_CMD_TIMEOUT, "", 0);
+      }
+    }
+  }
+  _shadowPump(dev, false);
+  _beaconPump(dev);
+  _cmdPump(dev);
+  _streamPump(dev);
+  _powerPump(dev);
+}
+
+// ------------------------------------------------------------
+// Stream the commands back to back, up to RN487X_PIPELINE_DEPTH
+// in flight, and wait for all of them. Replies are matched in
+// order. Returns how many completed with RN487X_CMD_OK, the
+// status of each one is left in cmds[i].status; a command the
+// engine refuses (empty text) gets RN487X_CMD_ERR.
+// The time saved is the reply round trip of each command but
+// the last (module latency and reply bytes), not a factor of
+// the depth: the commands still go out one after the other on
+// the UART. At 115200 baud, PS and 10 PC take 44.8 ms blocking
+// and 40.1 ms pipelined, of which 39.6 ms of transmit.
+// ------------------------------------------------------------
+uint8_t rn487x_dev_pipeline(rn487x_t *dev, rn487x_cmd_t *cmds, uint8_t count)
+{
+  uint8_t ok = 0;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    cmds[i].flags |= RN487X_CMD_FLAG_PIPELINE;
+    if (!rn487x_dev_submit(dev, &cmds[i]))
+    {
+      cmds[i].status = RN487X_CMD_ERR;
+    }
+  }
+  for (uint8_t i = 0; i < count; i++)
+  {
+    while (!rn487x_cmdDone(&cmds[i]))
+    {
+      rn487x_dev_process(dev);
+    }
+    if (cmds[i].status == RN487X_CMD_OK)
+    {
+      ok++;
+    }
+  }
+  return ok;
+}
+
+// ------------------------------------------------------------
+// Send data at once, without pacing (see rn487x_streamWrite)
+// ------------------------------------------------------------
+void rn487x_dev_sendData(rn487x_t *dev, const char *data, uint16_t dataLen)
+{
+  _txWrite(dev, (const uint8_t *)data, dataLen);
+  dev->dataTxAt = millis();
+  dev->dataTxPending = true;
+}
+
+// ------------------------------------------------------------
+// DMA transfer complete, called from the platform interrupt:
+// release the bytes sent and start the next run
+// ------------------------------------------------------------
+void rn487x_dev_txDmaDone(rn487x_t *dev)
+{
+#ifdef RN487X_TX_DMA
+  dev->txTail += dev->txDmaLen;
+  dev->txDmaLen = 0;
+  _txKick(dev);
+#else
+  (void)dev;
+#endif
+}
+
+// ------------------------------------------------------------
+// True when every queued byte is on the wire
+// ------------------------------------------------------------
+bool rn487x_dev_txIdle(rn487x_t *dev)
+{
+#ifdef RN487X_TX_DMA
+  return dev->txHead == dev->txTail;
+#else
+  (void)dev;
+  return true;
+#endif
+}
+
+// ------------------------------------------------------------
+// Register the handler of the data the peer sends in data mode,
+// NULL drops it. It is called from rn487x_dev_process().
+// ------------------------------------------------------------
+void rn487x_dev_onData(rn487x_t *dev, rn487x_data_cb_t callback, void *arg)
+{
+  dev->dataHandler = callback;
+  dev->dataArg = arg;
+}
+
+#ifdef RN487X_STREAM
+// ------------------------------------------------------------
+// Queue transparent UART data, sent from rn487x_dev_process() in
+// chunks paced for the module buffer. Never blocks: returns how
+// many bytes were accepted, less than len when the buffer is full.
+// ------------------------------------------------------------
+uint16_t rn487x_dev_streamWrite(rn487x_t *dev, const uint8_t *data, uint16_t len)
+{
+  uint16_t room = rn487x_dev_streamFree(dev);
+  if (len > room)
+  {
+    len = room;
+  }
+  for (uint16_t i = 0; i < len; i++)
+  {
+    dev->streamBuf[(dev->streamHead + i) & STREAM_MASK] = data[i];
+  }
+  dev->streamHead += len;
+  return len;
+}
+
+uint16_t rn487x_dev_streamFree(rn487x_t *dev)
+{
+  return RN487X_STREAM_BUF_LEN - rn487x_dev_streamPending(dev);
+}
+
+uint16_t rn487x_dev_streamPending(rn487x_t *dev)
+{
+  return (uint16_t)(dev->streamHead - dev->streamTail);
+}
+
+// ------------------------------------------------------------
+// Stream chunk length (ATT MTU - 3 of the connection) and rate
+// [B/s] the link sustains, 0 turns the pacing off
+// ------------------------------------------------------------
+void rn487x_dev_streamConfig(rn487x_t *dev, uint16_t chunkLen, uint32_t rate)
+{
+  dev->streamChunk = (chunkLen > 0) ? chunkLen : 1;
+  dev->streamRate = rate;
+}
+#endif
+
+// ------------------------------------------------------------
+// Hardware reset, returns as soon as the module reports %REBOOT%
+// (500 ms at most)
+// ------------------------------------------------------------
+void rn487x_dev_hwReset(rn487x_t *dev)
+{
+  DEBUG_PRINTLN("[info] hwReset");
+  if (dev->io.setReset == NULL)
+  {
+    DEBUG_PRINTLN("[warn] No reset line");
+    return;
+  }
+  dev->io.setReset(dev->io.arg, false);
+  delay(5);
+  _serialFlush(dev);
+  _bootArm(dev);
+  dev->io.setReset(dev->io.arg, true);
+  if (dev->powerState == RN487X_POWER_DORMANT)
+  {
+    _powerEnter(dev, RN487X_POWER_AWAKE);
+  }
+  _bootWait(dev, RESET_BOOT_TIMEOUT);
+}
+
+// ------------------------------------------------------------
+// Hardware wake up (available only in RN4871)
+// ------------------------------------------------------------
+void rn487x_dev_hwWakeUp(rn487x_t *dev)
+{
+  if (dev->io.setWake != NULL)
+  {
+    DEBUG_PRINTLN("[info] wakeUp");
+    dev->io.setWake(dev->io.arg, false);
+    delay(RN487X_WAKE_TIME_MS);
+    _powerEnter(dev, RN487X_POWER_AWAKE);
+    dev->powerActiveAt = millis();
+  }
+}
+
+// ------------------------------------------------------------
+// Hardware sleep (available only in RN4871, with SO,1): the
+// next command wakes the module up again
+// ------------------------------------------------------------
+void rn487x_dev_hwSleep(rn487x_t *dev)
+{
+  if (dev->io.setWake == NULL)
+  {
+    DEBUG_PRINTLN("[warn] No wake line");
+    return;
+  }
+  _txDrain(dev);
+  _powerSleep(dev);
+}
+
+// ------------------------------------------------------------
+// Reboot the module, returns once it reports %REBOOT%
+// (RESET_CMD_TIMEOUT at most)
+// ------------------------------------------------------------
+bool rn487x_dev_reboot(rn487x_t *dev)
+{
+  DEBUG_PRINTLN("[info] reboot");
+  _bootArm(dev);
+  if (_execute(dev, REBOOT, _CMD_LEN(REBOOT), REBOOTING_RESP, RESET_CMD_TIMEOUT) == RN487X_CMD_OK)
+  {
+    _bootWait(dev, RESET_CMD_TIMEOUT);
+    dev->operationMode = DATA_MODE;
+    return true;
+  }
+  return false;
+}
+
+// ------------------------------------------------------------
+// Initialization
+// ------------------------------------------------------------
+bool rn487x_dev_init(rn487x_t *dev)
+{
+  DEBUG_PRINTLN("[info] init");
+  rn487x_dev_hwReset(dev);
+  rn487x_dev_hwWakeUp(dev);
+  // A slow boot gets the R,1 timeout on top of the reset bound
+  if (dev->io.setReset != NULL && (dev->booted || _bootWait(dev, RESET_CMD_TIMEOUT)))
+  {
+    return true;
+  }
+  // No boot event: the reset line may not be wired, reboot from command mode
+  if (rn487x_dev_cmdMode(dev))
+  {
+    if (rn487x_dev_reboot(dev))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+// ------------------------------------------------------------
+// Store the line settings in the module, applied at its next boot
+// ------------------------------------------------------------
+static bool _lineConfig(rn487x_t *dev, uint8_t baudId, uint16_t features)
+{
+  rn487x_cmdbuf_t cb;
+  _syncBegin(dev, &cb, AOK_RESP, DEFAULT_CMD_TIMEOUT);
+  rn487x_cmdbufAppendLit(&cb, SET_BAUDRATE);
+  rn487x_cmdbufAppendHexU8(&cb, baudId);
+  bool ok = (_syncRun(dev, &cb) == RN487X_CMD_OK);
+  _syncBegin(dev, &cb, AOK_RESP, DEFAULT_CMD_TIMEOUT);
+  rn487x_cmdbufAppendLit(&cb, SET_SUPPORTED_FEATURES);
+  rn487x_cmdbufAppendHexU16(&cb, features);
+  return (_syncRun(dev, &cb) == RN487X_CMD_OK) && ok;
+}
+
+// ------------------------------------------------------------
+// Reboot the module, move the host UART to the new settings
+// while it boots and check the link with a CMD> round trip.
+// Without the reboot reply, the host stays at the old settings.
+// ------------------------------------------------------------
+static bool _lineSwitch(rn487x_t *dev, uint32_t baudrate, bool flowControl)
+{
+  _bootArm(dev);
+  if (_execute(dev, REBOOT, _CMD_LEN(REBOOT), REBOOTING_RESP, RESET_CMD_TIMEOUT) != RN487X_CMD_OK)
+  {
+    DEBUG_PRINTLN("[error] No reboot reply");
+    return false;
+  }
+  _txDrain(dev);
+  dev->io.setBaudrate(dev->io.arg, baudrate);
+  dev->io.setFlowControl(dev->io.arg, flowControl);
+  dev->baudrate = baudrate;
+  _serialFlush(dev);
+  _bootWait(dev, RESET_CMD_TIMEOUT);
+  // Bytes sent across the rate change arrive garbled, and an event
+  // keeps the partial line it was cut into
+  _serialFlush(dev);
+  return rn487x_dev_cmdMode(dev);
+}
+
+// ------------------------------------------------------------
+// Write a command line whose reply the host cannot read, then
+// give the module the time to act on it
+// ------------------------------------------------------------
+static void _lineBlind(rn487x_t *dev, const char *text, uint16_t len)
+{
+  _txWrite(dev, (const uint8_t *)text, len);
+  _txDrain(dev);
+  delay(BLIND_CMD_GAP);
+}
+
+// ------------------------------------------------------------
+// Store the old line settings and reboot the module without
+// reading any reply, lost at the rate that failed, then move the
+// host back to the old settings and confirm the link with V
+// ------------------------------------------------------------
+static bool _lineRestore(rn487x_t *dev, uint32_t baudrate, uint8_t baudId, uint16_t features)
+{
+  char text[16];
+  rn487x_cmdbuf_t cb;
+  bool flowControl = (features & FLOW_CONTROL_BMP) != 0;
+
+  // A CR ends what the module holds of a garbled line, $$$ gets it
+  // into command mode if the check did not
+  _lineBlind(dev, "\r", 1);
+  delay(DELAY_BEFORE_CMD);
+  _lineBlind(dev, ENTER_CMD, _CMD_LEN(ENTER_CMD));
+  rn487x_cmdbufInit(&cb, text, sizeof(text));
+  rn487x_cmdbufAppendLit(&cb, SET_BAUDRATE);
+  rn487x_cmdbufAppendHexU8(&cb, baudId);
+  rn487x_cmdbufAppendChar(&cb, CR);
+  _lineBlind(dev, text, cb.len);
+  rn487x_cmdbufInit(&cb, text, sizeof(text));
+  rn487x_cmdbufAppendLit(&cb, SET_SUPPORTED_FEATURES);
+  rn487x_cmdbufAppendHexU16(&cb, features);
+  rn487x_cmdbufAppendChar(&cb, CR);
+  _lineBlind(dev, text, cb.len);
+  _bootArm(dev);
+  _txWrite(dev, (const uint8_t *)REBOOT "\r", _CMD_LEN(REBOOT) + 1);
+  _txDrain(dev);
+
+  dev->io.setBaudrate(dev->io.arg, baudrate);
+  dev->io.setFlowControl(dev->io.arg, flowControl);
+  dev->baudrate = baudrate;
+  _serialFlush(dev);
+  _bootWait(dev, RESET_CMD_TIMEOUT);
+  _serialFlush(dev);
+  if (rn487x_dev_cmdMode(dev) &&
+      _execute(dev, DISPLAY_FW_VERSION, _CMD_LEN(DISPLAY_FW_VERSION), NULL, DEFAULT_CMD_TIMEOUT) == RN487X_CMD_OK)
+  {
+    return true;
+  }
+  return false;
+}
+
+// ------------------------------------------------------------------
+// Move the link to another rate, optionally with RTS/CTS flow control,
+// from command mode. The new settings are stored in the module and
+// checked after its reboot; when the check fails, both ends go back
+// to the settings in use before the call and false is returned, in
+// BAUD_SWITCH_MAX_MS at most. With flow control, the stream pacing can
+// be turned off (rn487x_streamConfig) since CTS holds the host back
+// instead.
+// ------------------------------------------------------------------
+bool rn487x_dev_setBaudrate(rn487x_t *dev, uint32_t baudrate, bool flowControl)
+{
+  DEBUG_PRINTLN("[info] setBaudrate");
+
+  if (dev->io.setBaudrate == NULL || dev->io.setFlowControl == NULL)
+  {
+    DEBUG_PRINTLN("[error] Fixed host UART settings");
+    return false;
+  }
+  uint8_t id = 0;
+  uint8_t oldId = 0;
+  uint16_t features = 0;
+  uint32_t oldBaudrate = dev->baudrate;
+  for (uint8_t i = 0; i < sizeof(_baud_rates) / sizeof(_baud_rates[0]); i++)
+  {
+    id = (_baud_rates[i] == baudrate) ? i : id;
+    oldId = (_baud_rates[i] == oldBaudrate) ? i : oldId;
+  }
+  if (_baud_rates[id] != baudrate)
+  {
+    DEBUG_PRINTLN("[error] Unsupported baud rate");
+    return false;
+  }
+  if (_execute(dev, GET_SUPPORTED_FEATURES, _CMD_LEN(GET_SUPPORTED_FEATURES), NULL, DEFAULT_CMD_TIMEOUT) != RN487X_CMD_OK ||
+      dev->syncCmd.respLen != 4 || !rn487x_hexDecodeU16(dev->uartBuffer, &features))
+  {
+    return false;
+  }
+  uint16_t oldFeatures = features;
+  features = flowControl ? (features | FLOW_CONTROL_BMP) : (features & ~FLOW_CONTROL_BMP);
+  if (!_lineConfig(dev, id, features))
+  {
+    return false;
+  }
+  if (_lineSwitch(dev, baudrate, flowControl))
+  {
+    return true;
+  }
+
+  DEBUG_PRINTLN("[warn] Link check failed, back to the old rate");
+  if (!_lineRestore(dev, oldBaudrate, oldId, oldFeatures))
+  {
+    DEBUG_PRINTLN("[error] No link at the old rate either");
+  }
+  return false;
+}
+
+// ------------------------------------------------------------
+// Current host rate of the link
+// ------------------------------------------------------------
+uint32_t rn487x_dev_getBaudrate(rn487x_t *dev)
+{
+  return dev->baudrate;
+}
+
+// ------------------------------------------------------------
+// Leave command mode, back to transparent UART data
+// ------------------------------------------------------------
+bool rn487x_dev_dataMode(rn487x_t *dev)
+{
+  DEBUG_PRINTLN("[info] dataMode");
+#ifdef RN487X_SHADOW
+  rn487x_dev_shadowFlush(dev);
+#endif
+  // ENTER_DATA ends with the CR the command engine adds itself
+  if (_execute(dev, ENTER_DATA, _CMD_LEN(ENTER_DATA) - 1, PROMPT_END, DEFAULT_CMD_TIMEOUT) == RN487X_CMD_OK)
+  {
+    dev->operationMode = DATA_MODE;
+    return true;
+  }
+  return false;
+}
+
+// ------------------------------------------------------------
+// Enter into command mode
+// ------------------------------------------------------------
+bool rn487x_dev_cmdMode(rn487x_t *dev)
+{
+  DEBUG_PRINTLN("[info] commandMode");
+  // The guard time keeps $$$ apart from transparent UART data
+  if (dev->dataTxPending)
+  {
+    uint32_t elapsed = millis() - dev->dataTxAt;
+    if (elapsed < DELAY_BEFORE_CMD)
+    {
+      delay(DELAY_BEFORE_CMD - elapsed);
+    }
+    dev->dataTxPending = false;
+  }
+  rn487x_cmdbuf_t cb;
+  _syncBegin(dev, &cb, PROMPT, DEFAULT_CMD_TIMEOUT);
+  dev->syncCmd.flags = RN487X_CMD_FLAG_RAW;
+  rn487x_cmdbufAppendLit(&cb, ENTER_CMD);
+  if (_syncRun(dev, &cb) == RN487X_CMD_OK)
+  {
+    dev->operationMode = CMD_MODE;
+    return true;
+  }
+  return false;
+}
+
+// ------------------------------------------------------------------
+// Set Serialized Device Name
+// ------------------------------------------------------------------
+bool rn487x_dev_setSerializedName(rn487x_t *dev, const char *newName)
+{
+  DEBUG_PRINT("[info] setSerializedName: ");
+  DEBUG_PRINTLN(newName);
+
+  uint8_t nameLen = strlen(newName);
+  if (nameLen > MAX_SERIALIZED_NAME_LEN)
+  {
+    nameLen = MAX_SERIALIZED_NAME_LEN;
+    DEBUG_PRINTLN("[warn] Too many characters, name truncated");
+  }
+
+  // Fill the device name without the last two bytes of the Bluetooth MAC address
+  memset(dev->deviceName, 0, nameLen);
+  memcpy(dev->deviceName, newName, nameLen);
+  // Fill the command
+  rn487x_cmdbuf_t cb;
+  _syncBegin(dev, &cb, AOK_RESP, DEFAULT_CMD_TIMEOUT);
+  rn487x_cmdbufAppendLit(&cb, SET_SERIALIZED_NAME);
+  rn487x_cmdbufAppend(&cb, newName, nameLen);
+  if (_syncRun(dev, &cb) == RN487X_CMD_OK)
+  {
+    return true;
+  }
+  return false;
+}
+
+// ------------------------------------------------------------------
+// Set Device Name
+// ------------------------------------------------------------------
+bool rn487x_dev_setDeviceName(rn487x_t *dev, const char *dName)
+{
+  DEBUG_PRINT("[info] setDeviceName: ");
+  DEBUG_PRINTLN(dName);
+  uint8_t nameLen = strlen(dName);
+  if (nameLen > MAX_DEVICE_NAME_LEN)
+  {
+    nameLen = MAX_DEVICE_NAME_LEN;
+    DEBUG_PRINTLN("[warn] Too many characters, name truncated");
+  }
+
+  memset(dev->deviceName, 0, nameLen);
+  memcpy(dev->deviceName, dName, nameLen);
+  rn487x_cmdbuf_t cb;
+  _syncBegin(dev, &cb, AOK_RESP, DEFAULT_CMD_TIMEOUT);
+  rn487x_cmdbufAppendLit(&cb, SET_DEVICE_NAME);
+  rn487x_cmdbufAppend(&cb, dName, nameLen);
+  if (_syncRun(dev, &cb) == RN487X_CMD_OK)
+  {
+    return true;
+  }
+  return false;
+}
+
+// ---------------------------------------------------------------------------------
+// Get the current connection status
+// ---------------------------------------------------------------------------------
+// If the RN4870/71 is not connected, the output is none.
+// If the RN4870/71 is connected, the buffer must contains the information:
+// <Peer BT Address>,<Address Type>,<Connection Type>
+// where <Peer BT Address> is the 6-byte hex address of the peer device;
+//       <Address Type> is either 0 for public address or 1 for random address;
+//       <Connection Type> specifies if the connection enables UART Transparent
+//                         feature [1: enabled, 0: disabled]
+// ---------------------------------------------------------------------------------
+int8_t rn487x_dev_getConnectionStatus(rn487x_t *dev)
+{
+  DEBUG_PRINTLN("[info] getConnectionStatus");
+
+  if (_execute(dev, GET_CONNECTION_STATUS, _CMD_LEN(GET_CONNECTION_STATUS), NULL, DEFAULT_CMD_TIMEOUT) == RN487X_CMD_OK)
+  {
+    // Check for the connection
+    if (dev->syncCmd.reply == RN487X_REPLY_NONE)
+    {
+      return 0; // Not connected
+    }
+    return 1; // Connected
+  }
+  DEBUG_PRINTLN("[warn] getConnectionStatus: Timeout without a response !");
+  return -1;
+}
+
+/************************** Power ***********************************/
+
+// ------------------------------------------------------------------
+// Low power mode of the module (SO), applied at the next reboot.
+// The module then sleeps whenever the wake line is high.
+// ------------------------------------------------------------------
+bool rn487x_dev_setLowPower(rn487x_t *dev, bool enable)
+{
+  DEBUG_PRINTLN("[info] setLowPower");
+
+  rn487x_status_t status;
+  if (enable)
+  {
+    status = _execute(dev, SET_LOW_POWER_ON, _CMD_LEN(SET_LOW_POWER_ON), AOK_RESP, DEFAULT_CMD_TIMEOUT);
+  }
+  else
+  {
+    status = _execute(dev, SET_LOW_POWER_OFF, _CMD_LEN(SET_LOW_POWER_OFF), AOK_RESP, DEFAULT_CMD_TIMEOUT);
+  }
+  return status == RN487X_CMD_OK;
+}
+
+// ------------------------------------------------------------------
+// Power manager: sleep after idleMs without traffic (0 disables it)
+// and, asleep, hold the submitted commands for holdMs so that one
+// wake-up serves all of them. Blocking calls made while asleep
+// return up to holdMs + RN487X_WAKE_TIME_MS later. Needs the wake
+// line and the low power mode (rn487x_setLowPower).
+// ------------------------------------------------------------------
+bool rn487x_dev_powerConfig(rn487x_t *dev, uint16_t idleMs, uint16_t holdMs)
+{
+  if (dev->io.setWake == NULL && idleMs != 0)
+  {
+    DEBUG_PRINTLN("[error] No wake line");
+    return false;
+  }
+  dev->powerIdle = idleMs;
+  dev->powerHold = holdMs;
+  dev->powerActiveAt = millis();
+  return true;
+}
+
+// ------------------------------------------------------------------
+// Current power state
+// ------------------------------------------------------------------
+rn487x_power_state_t rn487x_dev_powerState(rn487x_t *dev)
+{
+  return (rn487x_power_state_t)dev->powerState;
+}
+
+// ------------------------------------------------------------------
+// Time spent in each power state since the instance setup, the
+// current state included, with the wake-ups and commands sent
+// ------------------------------------------------------------------
+void rn487x_dev_powerStats(rn487x_t *dev, rn487x_power_stats_t *stats)
+{
+  *stats = dev->powerStats;
+  stats->ms[dev->powerState] += millis() - dev->powerSince;
+}
+
+// ------------------------------------------------------------------
+// Dormant mode (O,0), the lowest current. Only a hardware reset
+// (rn487x_hwReset, rn487x_init) brings the module back.
+// ------------------------------------------------------------------
+void rn487x_dev_dormant(rn487x_t *dev)
+{
+  DEBUG_PRINTLN("[info] dormant");
+
+  rn487x_dev_sendCommand(dev, SET_DORMANT_MODE);
+  _txDrain(dev);
+  _powerEnter(dev, RN487X_POWER_DORMANT);
+}
+
+/************************* Timeouts *********************************/
+
+// ------------------------------------------------------------------
+// Retry policy of the idempotent commands: resends after a timeout
+// and floor of their adaptive timeout. With 0 resends, every
+// command waits for its fixed timeout and fails on it.
+// ------------------------------------------------------------------
+void rn487x_dev_retryConfig(rn487x_t *dev, uint8_t retries, uint16_t timeoutMinMs)
+{
+  dev->retries = retries;
+  dev->timeoutMin = timeoutMinMs;
+}
+
+// ------------------------------------------------------------------
+// Current timeout of the first attempt of a class [ms], 0 until a
+// reply has been timed
+// ------------------------------------------------------------------
+uint16_t rn487x_dev_adaptiveTimeout(rn487x_t *dev, rn487x_metric_class_t cls)
+{
+  if (dev->rtt[cls].samples == 0)
+  {
+    return 0;
+  }
+  uint32_t wait = (dev->rtt[cls].srtt8 >> 3) + dev->rtt[cls].rttvar4;
+  return (wait < dev->timeoutMin) ? dev->timeoutMin : ((wait > UINT16_MAX) ? UINT16_MAX : wait);
+}
+
+#ifdef RN487X_METRICS
+/************************* Metrics **********************************/
+
+// ------------------------------------------------------------------
+// Copy of the command metrics, consistent as long as it is taken
+// from the loop or task calling rn487x_process()
+// ------------------------------------------------------------------
+void rn487x_dev_metrics(rn487x_t *dev, rn487x_metrics_t *snapshot)
+{
+  *snapshot = dev->metrics;
+}
+
+// ------------------------------------------------------------------
+// Clear the command metrics, after they have been shipped
+// ------------------------------------------------------------------
+void rn487x_dev_metricsReset(rn487x_t *dev)
+{
+  memset(&dev->metrics, 0, sizeof(dev->metrics));
+  dev->metrics.since = millis();
+}
+#endif
+
+#ifdef RN487X_TRACE
+/************************** Trace ***********************************/
+
+// ------------------------------------------------------------------
+// Move up to max trace records, the oldest first, out of the ring.
+// Returns how many were read.
+// ------------------------------------------------------------------
+uint16_t rn487x_dev_traceRead(rn487x_t *dev, rn487x_trace_rec_t *recs, uint16_t max)
+{
+  uint16_t n = 0;
+  if (dev->traceHead - dev->traceTail > RN487X_TRACE_LEN)
+  {
+    dev->traceLost += dev->traceHead - dev->traceTail - RN487X_TRACE_LEN;
+    dev->traceTail = dev->traceHead - RN487X_TRACE_LEN;
+  }
+  while (n < max && dev->traceTail != dev->traceHead)
+  {
+    recs[n++] = dev->trace[dev->traceTail++ & TRACE_MASK];
+  }
+  return n;
+}
+
+// ------------------------------------------------------------------
+// Records overwritten before rn487x_traceRead() got them, as of
+// its last call
+// ------------------------------------------------------------------
+uint32_t rn487x_dev_traceLost(rn487x_t *dev)
+{
+  return dev->traceLost;
+}
+
+// ------------------------------------------------------------------
+// Application record, to place the driver records in context
+// ------------------------------------------------------------------
+void rn487x_dev_traceMark(rn487x_t *dev, uint8_t a, uint16_t b, uint32_t c)
+{
+  _trace(dev, RN487X_TRACE_MARK, a, b, c);
+}
+#endif
+
+/********************** Advertisements ******************************/
+
+// ------------------------------------------------------------------
+// Adjust the output power under advertisement [ Range from (0-5) ]
+// ------------------------------------------------------------------
+bool rn487x_dev_setAdvPower(rn487x_t *dev, uint8_t value)
+{
+  DEBUG_PRINTLN("[info] setAdvPower");
+
+  if (value > MAX_POWER_OUTPUT)
+  {
+    value = MAX_POWER_OUTPUT;
+  }
+  rn487x_cmdbuf_t cb;
+  _syncBegin(dev, &cb, AOK_RESP, DEFAULT_CMD_TIMEOUT);
+  rn487x_cmdbufAppendLit(&cb, SET_ADV_POWER);
+  rn487x_cmdbufAppendChar(&cb, value + '0'); // convert to a string
+  if (_syncRun(dev, &cb) == RN487X_CMD_OK)
+  {
+    return true;
+  }
+  return false;
+}
+
+// ------------------------------------------------------------------
+// Adjust the output power under connected state [ Range from (0-5) ]
+// ------------------------------------------------------------------
+bool rn487x_dev_setConnPower(rn487x_t *dev, uint8_t value)
+{
+  DEBUG_PRINTLN("[info] setConnPower");
+
+  if (value > MAX_POWER_OUTPUT)
+  {
+    value = MAX_POWER_OUTPUT;
+  }
+  rn487x_cmdbuf_t cb;
+  _syncBegin(dev, &cb, AOK_RESP, DEFAULT_CMD_TIMEOUT);
+  rn487x_cmdbufAppendLit(&cb, SET_CONN_POWER);
+  rn487x_cmdbufAppendChar(&cb, value + '0'); // convert to a string
+  if (_syncRun(dev, &cb) == RN487X_CMD_OK)
+  {
+    return true;
+  }
+  return false;
+}
+
+// ------------------------------------------------------------
+// Stops Advertisement
+// ------------------------------------------------------------
+bool rn487x_dev_stopAdvertising(rn487x_t *dev)
+{
+  DEBUG_PRINTLN("[info] stopAdvertising");
+  if (_execute(dev, STOP_ADV, _CMD_LEN(STOP_ADV), AOK_RESP, DEFAULT_CMD_TIMEOUT) == RN487X_CMD_OK)
+  {
+    return true;
+  }
+  return false;
+}
+
+// ------------------------------------------------------------------
+// Clear the advertising structure Immediately
+// ------------------------------------------------------------------
+bool rn487x_dev_clearImmediateAdvertising(rn487x_t *dev)
+{
+  DEBUG_PRINTLN("[info] clearImmediateAdvertising");
+
+  if (_execute(dev, CLEAR_IMMEDIATE_ADV, _CMD_LEN(CLEAR_IMMEDIATE_ADV), AOK_RESP, DEFAULT_CMD_TIMEOUT) == RN487X_CMD_OK)
+  {
+    return true;
+  }
+  return false;
+}
+
+// ------------------------------------------------------------------
+// Start Advertising immediately
+// ------------------------------------------------------------------
+bool rn487x_dev_startImmediateAdvertising(rn487x_t *dev, uint8_t advType, const uint8_t *advData, size_t size)
+{
+  DEBUG_PRINTLN("[info] startImmediateAdvertising");
+
+  rn487x_cmdbuf_t cb;
+  _syncBegin(dev, &cb, AOK_RESP, DEFAULT_CMD_TIMEOUT);
+  rn487x_cmdbufAppendLit(&cb, START_IMMEDIATE_ADV);
+  _adAppend(&cb, advType, advData, size);
+  if (_syncRun(dev, &cb) == RN487X_CMD_OK)
+  {
+    return true;
+  }
+  return false;
+}
+
+/************************** Beacon ***********************************/
+
+// ------------------------------------------------------------------
+// Beacon features (SC), applied at the next reboot: BEACON_OFF,
+// BEACON_ON, or BEACON_ADV_ON to keep advertising as well
+// ------------------------------------------------------------------
+bool rn487x_dev_setBeaconFeatures(rn487x_t *dev, const char *mode)
+{
+  DEBUG_PRINTLN("[info] setBeaconFeatures");
+
+  rn487x_cmdbuf_t cb;
+  _syncBegin(dev, &cb, AOK_RESP, DEFAULT_CMD_TIMEOUT);
+  rn487x_cmdbufAppendLit(&cb, SET_BEACON_FEATURES);
+  rn487x_cmdbufAppend(&cb, mode, strlen(mode));
+  if (_syncRun(dev, &cb) == RN487X_CMD_OK)
+  {
+    return true;
+  }
+  return false;
+}
+
+// ------------------------------------------------------------------
+// Clear the beacon structure immediately
+// ------------------------------------------------------------------
+bool rn487x_dev_clearImmediateBeacon(rn487x_t *dev)
+{
+  DEBUG_PRINTLN("[info] clearImmediateBeacon");
+
+  if (_execute(dev, CLEAR_IMMEDIATE_BEACON, _CMD_LEN(CLEAR_IMMEDIATE_BEACON), AOK_RESP, DEFAULT_CMD_TIMEOUT) == RN487X_CMD_OK)
+  {
+    return true;
+  }
+  return false;
+}
+
+// ------------------------------------------------------------------
+// Append an AD structure to the beacon, on air immediately
+// ------------------------------------------------------------------
+bool rn487x_dev_startImmediateBeacon(rn487x_t *dev, uint8_t adType, const uint8_t *adData, size_t size)
+{
+  DEBUG_PRINTLN("[info] startImmediateBeacon");
+
+  rn487x_cmdbuf_t cb;
+  _syncBegin(dev, &cb, AOK_RESP, DEFAULT_CMD_TIMEOUT);
+  rn487x_cmdbufAppendLit(&cb, START_IMMEDIATE_BEACON);
+  _adAppend(&cb, adType, adData, size);
+  if (_syncRun(dev, &cb) == RN487X_CMD_OK)
+  {
+    return true;
+  }
+  return false;
+}
+
+// ------------------------------------------------------------------
+// Clear the beacon structure stored in the module flash
+// ------------------------------------------------------------------
+bool rn487x_dev_clearPermanentBeacon(rn487x_t *dev)
+{
+  DEBUG_PRINTLN("[info] clearPermanentBeacon");
+
+  if (_execute(dev, CLEAR_PERMANENT_BEACON, _CMD_LEN(CLEAR_PERMANENT_BEACON), AOK_RESP, DEFAULT_CMD_TIMEOUT) == RN487X_CMD_OK)
+  {
+    return true;
+  }
+  return false;
+}
+
+// ------------------------------------------------------------------
+// Append an AD structure to the beacon stored in the module flash,
+// on air from the next reboot
+// ------------------------------------------------------------------
+bool rn487x_dev_startPermanentBeacon(rn487x_t *dev, uint8_t adType, const uint8_t *adData, size_t size)
+{
+  DEBUG_PRINTLN("[info] startPermanentBeacon");
+
+  rn487x_cmdbuf_t cb;
+  _syncBegin(dev, &cb, AOK_RESP, DEFAULT_CMD_TIMEOUT);
+  rn487x_cmdbufAppendLit(&cb, START_PERMANENT_BEACON);
+  _adAppend(&cb, adType, adData, size);
+  if (_syncRun(dev, &cb) == RN487X_CMD_OK)
+  {
+    return true;
+  }
+  return false;
+}
+
+#ifdef RN487X_BEACON
+// ------------------------------------------------------------------
+// Frame of a beacon rotation slot, in advertising data format
+// (length, AD type and data of each AD structure, a zero length
+// ends it), on air for dwellMs in turn with the other slots. Its
+// IB commands are encoded here, once; the rotation only copies
+// them. dwellMs 0 empties the slot. A slot changed while rotating
+// is used from its next turn; an invalid frame leaves it empty.
+// ------------------------------------------------------------------
+bool rn487x_dev_beaconSlot(rn487x_t *dev, uint8_t slot, const uint8_t *frame, uint8_t size, uint16_t dwellMs)
+{
+  DEBUG_PRINTLN("[info] beaconSlot");
+
+  if (slot >= RN487X_BEACON_SLOTS || size > MAX_ADV_DATA_LEN)
+  {
+    return false;
+  }
+  char *text = dev->beaconSlots[slot].text;
+  uint16_t pos = 0;
+  uint8_t count = 0;
+  dev->beaconSlots[slot].count = 0;
+  dev->beaconSlots[slot].dwell = 0;
+  for (uint8_t i = 0; i < size && frame[i] != 0 && dwellMs != 0; i += 1 + frame[i])
+  {
+    rn487x_cmdbuf_t cb;
+    if (i + 1 + frame[i] > size || count >= RN487X_BEACON_ADS)
+    {
+      DEBUG_PRINTLN("[error] Invalid beacon frame");
+      return false;
+    }
+    rn487x_cmdbufInit(&cb, &text[pos], RN487X_BEACON_TEXT_LEN - pos);
+    rn487x_cmdbufAppendLit(&cb, START_IMMEDIATE_BEACON);
+    _adAppend(&cb, frame[i + 1], &frame[i + 2], frame[i] - 1);
+    if (!rn487x_cmdbufEnd(&cb))
+    {
+      return false;
+    }
+    pos += cb.len + 1;
+    count++;
+  }
+  if (count == 0 && dwellMs != 0)
+  {
+    return false;
+  }
+  dev->beaconSlots[slot].count = count;
+  dev->beaconSlots[slot].dwell = dwellMs;
+  return true;
+}
+
+// ------------------------------------------------------------------
+// Rotate the beacon through the slots from slot 0, one slot after
+// the other, from rn487x_dev_process() in command mode. Each turn
+// costs IB,Z and one IB command per AD structure of the slot,
+// pipelined; a single slot is put on air once. The statistics are
+// cleared. Needs the beacon on (rn487x_setBeaconFeatures).
+// ------------------------------------------------------------------
+bool rn487x_dev_startBeaconRotation(rn487x_t *dev)
+{
+  DEBUG_PRINTLN("[info] startBeaconRotation");
+
+  bool any = false;
+  for (uint8_t i = 0; i < RN487X_BEACON_SLOTS; i++)
+  {
+    any = any || dev->beaconSlots[i].count > 0;
+  }
+  if (!any)
+  {
+    return false;
+  }
+  memset(&dev->beaconStats, 0, sizeof(dev->beaconStats));
+  dev->beaconSlot = RN487X_BEACON_SLOTS - 1;
+  dev->beaconOnAir = false;
+  dev->beaconRunning = true;
+  _beaconPump(dev);
+  return true;
+}
+
+// ------------------------------------------------------------------
+// Stop rotating, the slot on air stays on air
+// ------------------------------------------------------------------
+void rn487x_dev_stopBeaconRotation(rn487x_t *dev)
+{
+  dev->beaconRunning = false;
+}
+
+// ------------------------------------------------------------------
+// UART bytes and CPU time spent on the rotation
+// ------------------------------------------------------------------
+void rn487x_dev_beaconStats(rn487x_t *dev, rn487x_beacon_stats_t *stats)
+{
+  *stats = dev->beaconStats;
+}
+#endif
+
+#ifdef RN487X_SCAN
+/****************************** Scan ***********************************/
+
+// ----------------------------------------------------------------------
+// Start scanning, with the default parameters when interval is 0
+// (units of 0.625 ms). The results and the duplicate filter are
+// cleared; reports are read back with rn487x_dev_scanRead().
+// ----------------------------------------------------------------------
+bool rn487x_dev_startScan(rn487x_t *dev, uint16_t interval, uint16_t window)
+{
+  DEBUG_PRINTLN("[info] startScan");
+
+  rn487x_cmdbuf_t cb;
+  _syncBegin(dev, &cb, SCANNING_RESP, DEFAULT_CMD_TIMEOUT);
+  if (interval == 0)
+  {
+    rn487x_cmdbufAppendLit(&cb, START_DEFAULT_SCAN);
+  }
+  else
+  {
+    rn487x_cmdbufAppendLit(&cb, START_CUSTOM_SCAN);
+    rn487x_cmdbufAppendHexU16(&cb, interval);
+    rn487x_cmdbufAppendChar(&cb, ',');
+    rn487x_cmdbufAppendHexU16(&cb, window);
+  }
+  dev->scanHead = 0;
+  dev->scanTail = 0;
+  memset(dev->scanFilter, 0, sizeof(dev->scanFilter));
+  memset(&dev->scanStats, 0, sizeof(dev->scanStats));
+  if (_syncRun(dev, &cb) == RN487X_CMD_OK)
+  {
+    dev->scanning = true;
+    return true;
+  }
+  return false;
+}
+
+// ----------------------------------------------------------------------
+// Stop scanning, the results left in the ring can still be read
+// ----------------------------------------------------------------------
+bool rn487x_dev_stopScan(rn487x_t *dev)
+{
+  DEBUG_PRINTLN("[info] stopScan");
+
+  if (_execute(dev, STOP_SCAN, _CMD_LEN(STOP_SCAN), AOK_RESP, DEFAULT_CMD_TIMEOUT) == RN487X_CMD_OK)
+  {
+    dev->scanning = false;
+    return true;
+  }
+  return false;
+}
+
+// ----------------------------------------------------------------------
+// Pop the oldest scan result, false when there is none
+// ----------------------------------------------------------------------
+bool rn487x_dev_scanRead(rn487x_t *dev, rn487x_scan_report_t *report)
+{
+  if (dev->scanHead == dev->scanTail)
+  {
+    return false;
+  }
+  *report = dev->scanRing[dev->scanTail & SCAN_RING_MASK];
+  dev->scanTail++;
+  return true;
+}
+
+// ----------------------------------------------------------------------
+// Counters of the current scan
+// ----------------------------------------------------------------------
+void rn487x_dev_scanStats(rn487x_t *dev, rn487x_scan_stats_t *stats)
+{
+  *stats = dev->scanStats;
+}
+#endif
+
+/**************************** Services *********************************/
+
+// ----------------------------------------------------------------------
+// Clears all settings of services and characteristics.
+// A power cycle is required afterwards to make the changes effective.
+// ----------------------------------------------------------------------
+bool rn487x_dev_clearAllServices(rn487x_t *dev)
+{
+  DEBUG_PRINTLN("[info] cleanAllServices");
+
+  if (_execute(dev, CLEAR_ALL_SERVICES, _CMD_LEN(CLEAR_ALL_SERVICES), AOK_RESP, DEFAULT_CMD_TIMEOUT) == RN487X_CMD_OK)
+  {
+    // Characteristics defined from now on are numbered from zero again
+    dev->charactIdCnt = 0;
+    _shadowForget(dev, SHADOW_VALID | SHADOW_DIRTY | SHADOW_SENT);
+    dev->definitionHash = FNV_OFFSET;
+    return true;
+  }
+  return false;
+}
+
+// ------------------------------------------------------------------
+// Set Manufacturer Name in Device Info Service
+// ------------------------------------------------------------------
+bool rn487x_dev_deviceService_setManufName(rn487x_t *dev, const char *name)
+{
+  DEBUG_PRINT("[info] deviceService_setManufName: ");
+  DEBUG_PRINTLN(name);
+  uint8_t nameLen = strlen(name);
+  if (nameLen > MAX_SERIALIZED_NAME_LEN)
+  {
+    nameLen = MAX_SERIALIZED_NAME_LEN;
+    DEBUG_PRINTLN("[warn] Too many characters, name truncated");
+  }
+
+  memset(dev->deviceName, 0, nameLen);
+  memcpy(dev->deviceName, name, nameLen);
+  rn487x_cmdbuf_t cb;
+  _syncBegin(dev, &cb, AOK_RESP, DEFAULT_CMD_TIMEOUT);
+  rn487x_cmdbufAppendLit(&cb, SET_MANUF_NAME);
+  rn487x_cmdbufAppend(&cb, name, nameLen);
+  if (_syncRun(dev, &cb) == RN487X_CMD_OK)
+  {
+    return true;
+  }
+  return false;
+}
+
+// ----------------------------------------------------------------------
+// Prepares the command setting the UUID of the public (16-bit) or the
+// private (128-bit) service, to be submitted or pipelined. The command
+// callback is used by the driver.
+// ----------------------------------------------------------------------
+bool rn487x_dev_prepareServiceUUID(rn487x_t *dev, rn487x_cmd_t *cmd, const char *uuid)
+{
+  DEBUG_PRINT("[info] serServiceUUID: ");
+  DEBUG_PRINTLN(uuid);
+
+  uint8_t uuidLen = strlen(uuid);
+
+  if (uuidLen == PRIVATE_SERVICE_LEN)
+  {
+    DEBUG_PRINTLN("[info] 128-bit length (private service)");
+  }
+  else if (uuidLen == PUBLIC_SERVICE_LEN)
+  {
+    DEBUG_PRINTLN("[info] 16-bit length (public service)");
+  }
+  else
+  {
+    DEBUG_PRINTLN("[error] UUID length is not correct");
+    return false;
+  }
+
+  rn487x_cmdbuf_t cb;
+  _cmdBegin(cmd, &cb, AOK_RESP, DEFAULT_CMD_TIMEOUT);
+  rn487x_cmdbufAppendLit(&cb, DEFINE_SERVICE_UUID);
+  rn487x_cmdbufAppend(&cb, uuid, uuidLen);
+  if (!rn487x_cmdbufEnd(&cb))
+  {
+    return false;
+  }
+  cmd->callback = _serviceDefined;
+  cmd->dev = dev;
+  return true;
+}
+
+// ----------------------------------------------------------------------
+// Sets the UUID of the public (16-bit) or the private (128-bit) service.
+// This method must be called before the setCharactUUID() method.
+// ----------------------------------------------------------------------
+bool rn487x_dev_setServiceUUID(rn487x_t *dev, const char *uuid)
+{
+  if (rn487x_dev_prepareServiceUUID(dev, &dev->syncCmd, uuid) && _wait(dev, &dev->syncCmd) == RN487X_CMD_OK)
+  {
+    return true;
+  }
+  return false;
+}
+
+/************************ Characteristics ******************************/
+
+// ----------------------------------------------------------------------
+// Prepares the command setting a characteristic UUID, to be submitted or
+// pipelined. bc gets its index when the module accepts the definition,
+// so the command callback and arg are used by the driver.
+// ----------------------------------------------------------------------
+bool rn487x_dev_prepareCharactUUID(rn487x_t *dev, rn487x_cmd_t *cmd, ble_charact_t *bc, const char *uuid, uint8_t property, uint8_t octetLen)
+{
+  DEBUG_PRINT("[info] setCharactUUID: ");
+  DEBUG_PRINTLN(uuid);
+
+  if (octetLen < 0x01)
+  {
+    octetLen = 0x01;
+    DEBUG_PRINTLN("[warn] Octet Length is out of range (0x01-0x14)");
+  }
+  else if (octetLen > 0x14)
+  {
+    octetLen = 0x14;
+    DEBUG_PRINTLN("[warn] Octet Length is out of range (0x01-0x14)");
+  }
+
+  uint8_t uuidLen = strlen(uuid);
+
+  if (uuidLen == PRIVATE_SERVICE_LEN)
+  {
+    DEBUG_PRINTLN("[info] 128-bit length (private characteristic)");
+  }
+  else if (uuidLen == PUBLIC_SERVICE_LEN)
+  {
+    DEBUG_PRINTLN("[info] 16-bit length (public characteristic)");
+  }
+  else
+  {
+    DEBUG_PRINTLN("[error] UUID length is not correct");
+    return false;
+  }
+
+  rn487x_cmdbuf_t cb;
+  _cmdBegin(cmd, &cb, AOK_RESP, DEFAULT_CMD_TIMEOUT);
+  rn487x_cmdbufAppendLit(&cb, DEFINE_CHARACT_UUID);
+  rn487x_cmdbufAppend(&cb, uuid, uuidLen);
+  rn487x_cmdbufAppendChar(&cb, ',');
+  rn487x_cmdbufAppendHexU8(&cb, property);
+  rn487x_cmdbufAppendChar(&cb, ',');
+  rn487x_cmdbufAppendHexU8(&cb, octetLen);
+  if (!rn487x_cmdbufEnd(&cb))
+  {
+    return false;
+  }
+  bc->length = octetLen;
+  cmd->callback = _charactDefined;
+  cmd->arg = bc;
+  cmd->dev = dev;
+  return true;
+}
+
+// ----------------------------------------------------------------------
+// Sets the characteritics UUID
+// This method must be called after the setServiceUUID() method.
+// ----------------------------------------------------------------------
+bool rn487x_dev_setCharactUUID(rn487x_t *dev, ble_charact_t *bc, const char *uuid, uint8_t property, uint8_t octetLen)
+{
+  if (rn487x_dev_prepareCharactUUID(dev, &dev->syncCmd, bc, uuid, property, octetLen) && _wait(dev, &dev->syncCmd) == RN487X_CMD_OK)
+  {
+    return true;
+  }
+  return false;
+}
+
+// ----------------------------------------------------------------------
+// Prepares the command writing a local characteristic value as server,
+// to be submitted or pipelined. The value bypasses the shadow copy,
+// which forgets the characteristic.
+// ----------------------------------------------------------------------
+bool rn487x_dev_prepareWriteLocalCharact(rn487x_t *dev, rn487x_cmd_t *cmd, ble_charact_t *bc, const uint8_t *value)
+{
+  DEBUG_PRINTLN("[info] writeLocalCharacteristic");
+
+#ifdef RN487X_SHADOW
+  if (_shadowed(bc))
+  {
+    _shadowDrop(dev, bc->index);
+  }
+#endif
+  return _writePrepare(dev, cmd, bc->index, value, bc->length);
+}
+
+#ifdef RN487X_SHADOW
+// ----------------------------------------------------------------------
+// Write a local characteristic value through its shadow entry
+// ----------------------------------------------------------------------
+static bool _shadowWrite(rn487x_t *dev, ble_charact_t *bc, const uint8_t *value)
+{
+  uint16_t i = bc->index;
+  if ((dev->shadow[i].flags & (SHADOW_VALID | SHADOW_DIRTY)) && dev->shadow[i].length == bc->length &&
+      memcmp(dev->shadow[i].value, value, bc->length) == 0)
+  {
+    return true;
+  }
+  memcpy(dev->shadow[i].value, value, bc->length);
+  dev->shadow[i].length = bc->length;
+  dev->shadow[i].flags &= ~SHADOW_VALID;
+  if (dev->shadowWindow > 0)
+  {
+    if (!(dev->shadow[i].flags & SHADOW_DIRTY))
+    {
+      dev->shadow[i].flags |= SHADOW_DIRTY;
+      dev->shadow[i].dirtyAt = millis();
+      dev->shadowDirty++;
+    }
+    return true;
+  }
+
+  _shadowDrop(dev, i);
+  if (_writePrepare(dev, &dev->syncCmd, i, value, bc->length) && _wait(dev, &dev->syncCmd) == RN487X_CMD_OK)
+  {
+    dev->shadow[i].flags = SHADOW_VALID;
+    return true;
+  }
+  return false;
+}
+#endif
+
+// ----------------------------------------------------------------------
+// Write local characteristic value as server. With RN487X_SHADOW, an
+// unchanged value is not sent again; within a write-combining window
+// (rn487x_shadowConfig) the value is only recorded and true means
+// accepted, not acknowledged.
+// ----------------------------------------------------------------------
+bool rn487x_dev_writeLocalCharact(rn487x_t *dev, ble_charact_t *bc, const uint8_t *value)
+{
+#ifdef RN487X_SHADOW
+  if (_shadowed(bc))
+  {
+    return _shadowWrite(dev, bc, value);
+  }
+#endif
+  if (rn487x_dev_prepareWriteLocalCharact(dev, &dev->syncCmd, bc, value) && _wait(dev, &dev->syncCmd) == RN487X_CMD_OK)
+  {
+    return true;
+  }
+  return false;
+}
+
+#ifdef RN487X_BATCH
+
+// ----------------------------------------------------------------------
+// Command slot of the n-th command of a batch, free once the command
+// sent RN487X_PIPELINE_DEPTH commands earlier has completed
+// ----------------------------------------------------------------------
+static rn487x_cmd_t *_batchSlot(rn487x_t *dev, uint8_t n)
+{
+  rn487x_cmd_t *cmd = &dev->batchCmds[n % RN487X_PIPELINE_DEPTH];
+  while (n >= RN487X_PIPELINE_DEPTH && !rn487x_cmdDone(cmd))
+  {
+    rn487x_dev_process(dev);
+  }
+  return cmd;
+}
+
+// ----------------------------------------------------------------------
+// Record the result of a batch write, its value is now the module one
+// ----------------------------------------------------------------------
+static void _batchDone(rn487x_cmd_t *cmd)
 {
-  DEBUG_PRINT("[info] deviceService_setManufName: ");
-  DEBUG_PRINTLN(name);
-  uint8_t cmdLen = strlen(SET_MANUF_NAME);
-  uint8_t nameLen = strlen(name);
-  if (nameLen > MAX_SERIALIZED_NAME_LEN)
+  rn487x_charact_write_t *w = (rn487x_charact_write_t *)cmd->arg;
+  w->status = cmd->status;
+#ifdef RN487X_SHADOW
+  rn487x_t *dev = cmd->dev;
+  if (cmd->status == RN487X_CMD_OK && _shadowed(w->charact))
   {
-    nameLen = MAX_SERIALIZED_NAME_LEN;
-    DEBUG_PRINTLN("[warn] Too many characters, name truncated");
+    memcpy(dev->shadow[w->charact->index].value, w->value, w->charact->length);
+    dev->shadow[w->charact->index].length = w->charact->length;
+    dev->shadow[w->charact->index].flags = SHADOW_VALID;
   }
+#endif
+}
 
-  memset(_device_name, 0, nameLen);
-  memcpy(_device_name, name, nameLen);
-  _clearBuffer();
-  memcpy(_uart_buffer, SET_MANUF_NAME, cmdLen);
-  memcpy(&_uart_buffer[cmdLen], name, nameLen);
-  rn487x_sendCommand(_uart_buffer);
-  if (_expectResponse(AOK_RESP, DEFAULT_CMD_TIMEOUT))
+// ----------------------------------------------------------------------
+// Write several local characteristic values, back to back with up to
+// RN487X_PIPELINE_DEPTH SHW in flight. Values the module already holds
+// are not sent; values pending in a write-combining window are
+// superseded. The result of each write is left in writes[i].status,
+// returns how many completed with RN487X_CMD_OK.
+// ----------------------------------------------------------------------
+uint8_t rn487x_dev_writeLocalCharacts(rn487x_t *dev, rn487x_charact_write_t *writes, uint8_t count)
+{
+  DEBUG_PRINTLN("[info] writeLocalCharacts");
+
+  uint8_t ok = 0;
+  uint8_t sent = 0;
+  for (uint8_t i = 0; i < count; i++)
   {
-    return true;
+    ble_charact_t *bc = writes[i].charact;
+#ifdef RN487X_SHADOW
+    if (_shadowed(bc))
+    {
+      if ((dev->shadow[bc->index].flags & SHADOW_VALID) && dev->shadow[bc->index].length == bc->length &&
+          memcmp(dev->shadow[bc->index].value, writes[i].value, bc->length) == 0)
+      {
+        writes[i].status = RN487X_CMD_OK;
+        continue;
+      }
+      _shadowDrop(dev, bc->index);
+    }
+#endif
+
+    rn487x_cmd_t *cmd = _batchSlot(dev, sent);
+    writes[i].status = RN487X_CMD_QUEUED;
+    if (!_writePrepare(dev, cmd, bc->index, writes[i].value, bc->length))
+    {
+      writes[i].status = RN487X_CMD_ERR;
+      continue;
+    }
+    cmd->flags = RN487X_CMD_FLAG_PIPELINE;
+    cmd->callback = _batchDone;
+    cmd->arg = &writes[i];
+    rn487x_dev_submit(dev, cmd);
+    sent++;
   }
-  return false;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    while (writes[i].status < RN487X_CMD_OK)
+    {
+      rn487x_dev_process(dev);
+    }
+    if (writes[i].status == RN487X_CMD_OK)
+    {
+      ok++;
+    }
+  }
+  return ok;
 }
+#endif
 
 // ----------------------------------------------------------------------
-// Sets the UUID of the public (16-bit) or the private (128-bit) service.
-// This method must be called before the setCharactUUID() method.
+// Read local characteristic value as server
 // ----------------------------------------------------------------------
-bool rn487x_setServiceUUID(const char *uuid)
+int8_t rn487x_dev_readLocalCharact(rn487x_t *dev, ble_charact_t *bc, uint8_t *vbuff)
 {
-  DEBUG_PRINT("[info] serServiceUUID: ");
-  DEBUG_PRINTLN(uuid);
+  DEBUG_PRINTLN("[info] readLocalCharact");
 
-  uint8_t cmdLen = strlen(DEFINE_SERVICE_UUID);
-  uint8_t uuidLen = strlen(uuid);
+#ifdef RN487X_SHADOW
+  // No central wrote it since the shadow value was set
+  if (_shadowed(bc) && (dev->shadow[bc->index].flags & (SHADOW_VALID | SHADOW_DIRTY)) &&
+      dev->shadow[bc->index].length == bc->length)
+  {
+    memcpy(vbuff, dev->shadow[bc->index].value, bc->length);
+    return 1;
+  }
+#endif
 
-  if (uuidLen == PRIVATE_SERVICE_LEN)
+  rn487x_cmdbuf_t cb;
+  _syncBegin(dev, &cb, NULL, DEFAULT_CMD_TIMEOUT);
+  rn487x_cmdbufAppendLit(&cb, READ_LOCAL_CHARACT);
+  rn487x_cmdbufAppendHexU16(&cb, dev->charactHandles[bc->index]);
+  rn487x_status_t status = _syncRun(dev, &cb);
+  uint8_t dataLen = dev->syncCmd.respLen;
+  memset(vbuff, 0, bc->length);
+  if (dev->syncCmd.reply == RN487X_REPLY_NA)
   {
-    DEBUG_PRINTLN("[info] 128-bit length (private service)");
+    DEBUG_PRINTLN(" => No data to show");
+    return 0;
   }
-  else if (uuidLen == PUBLIC_SERVICE_LEN)
+  if (dev->syncCmd.reply == RN487X_REPLY_ERR)
   {
-    DEBUG_PRINTLN("[info] 16-bit length (public service)");
+    DEBUG_PRINTLN(" => Error from the module");
+    return -1;
   }
-  else
+  if (status != RN487X_CMD_OK || dataLen == 0)
   {
-    DEBUG_PRINTLN("[error] UUID length is not correct");
-    return false;
+    DEBUG_PRINTLN("=> Error TIMEOUT");
+    return -2;
+  }
+  if (dataLen != (2 * bc->length))
+  {
+    DEBUG_PRINTLN(" => Error invalid len");
+    return -1;
+  }
+  if (!rn487x_hexDecode(dev->uartBuffer, dataLen, vbuff))
+  {
+    DEBUG_PRINTLN(" => Error invalid hex value");
+    return -1;
+  }
+#ifdef RN487X_SHADOW
+  if (_shadowed(bc))
+  {
+    memcpy(dev->shadow[bc->index].value, vbuff, bc->length);
+    dev->shadow[bc->index].length = bc->length;
+    dev->shadow[bc->index].flags = SHADOW_VALID;
+  }
+#endif
+  return 1;
+}
+
+#ifdef RN487X_SHADOW
+// ----------------------------------------------------------------------
+// Write-combining window of rn487x_writeLocalCharact [ms], 0 sends every
+// changed value right away. The values pending are flushed first.
+// ----------------------------------------------------------------------
+void rn487x_dev_shadowConfig(rn487x_t *dev, uint16_t windowMs)
+{
+  rn487x_dev_shadowFlush(dev);
+  dev->shadowWindow = windowMs;
+}
+
+// ----------------------------------------------------------------------
+// Send every pending value now, in command mode, and wait for the
+// replies. Returns false, the values not written left pending, at the
+// first one that failed or when nothing could be sent outside of
+// command mode.
+// ----------------------------------------------------------------------
+bool rn487x_dev_shadowFlush(rn487x_t *dev)
+{
+  dev->shadowFailed = false;
+  while ((dev->shadowDirty > 0 || dev->shadowBusy) && !dev->shadowFailed)
+  {
+    if (dev->operationMode != CMD_MODE)
+    {
+      return false;
+    }
+    _shadowPump(dev, true);
+    rn487x_dev_process(dev);
   }
+  return !dev->shadowFailed;
+}
+#endif
+
+// ----------------------------------------------------------------------
+// Rebuild the characteristic handles, from the handle cache when it
+// matches the current definitions, from the LS listing otherwise
+// ----------------------------------------------------------------------
+bool rn487x_dev_buildCharacts(rn487x_t *dev)
+{
+  DEBUG_PRINTLN("[info] buildCharacts");
 
-  _clearBuffer();
-  memcpy(_uart_buffer, DEFINE_SERVICE_UUID, cmdLen);
-  memcpy(&_uart_buffer[cmdLen], uuid, uuidLen);
-  rn487x_sendCommand(_uart_buffer);
-  if (_expectResponse(AOK_RESP, DEFAULT_CMD_TIMEOUT))
+  // The handles may change, so may the characteristic behind an index
+  _shadowForget(dev, SHADOW_VALID | SHADOW_DIRTY | SHADOW_SENT);
+  if (_cacheRestore(dev))
   {
+    DEBUG_PRINTLN("[info] Handles restored from cache");
     return true;
   }
-  return false;
+  rn487x_status_t status = _listRun(dev, _listLine);
+  if (dev->listOverflow)
+  {
+    DEBUG_PRINTLN("[error] Number of characteristics overflowed");
+    return false;
+  }
+  if (status == RN487X_CMD_OK)
+  {
+    _cacheSave(dev);
+  }
+  return true;
 }
 
-/************************ Characteristics ******************************/
+// ----------------------------------------------------------------------
+// Persistence hooks of the handle cache. load fills the cache saved by
+// the last store and returns false when there is none; store is called
+// after every complete LS listing. Either may be NULL.
+// ----------------------------------------------------------------------
+void rn487x_dev_setHandleCache(rn487x_t *dev, rn487x_cache_load_t load, rn487x_cache_store_t store, void *arg)
+{
+  dev->cacheLoad = load;
+  dev->cacheStore = store;
+  dev->cacheArg = arg;
+}
 
 // ----------------------------------------------------------------------
-// Sets the characteritics UUID
-// This method must be called after the setServiceUUID() method.
+// Hash of the service and characteristic definitions accepted by the
+// module since the last rn487x_dev_clearAllServices()
 // ----------------------------------------------------------------------
-bool rn487x_setCharactUUID(ble_charact_t *bc, const char *uuid, uint8_t property, uint8_t octetLen)
+uint32_t rn487x_dev_definitionHash(rn487x_t *dev)
 {
-  DEBUG_PRINT("[info] setCharactUUID: ");
-  DEBUG_PRINTLN(uuid);
+  return dev->definitionHash;
+}
 
-  if (octetLen < 0x01)
+/************************** Client role ********************************/
+
+// ----------------------------------------------------------------------
+// Hash of a UUID, upper and lower case hex digits alike
+// ----------------------------------------------------------------------
+static uint32_t _uuidHash(const char *uuid, uint16_t len)
+{
+  uint32_t hash = FNV_OFFSET;
+  for (uint16_t i = 0; i < len; i++)
   {
-    octetLen = 0x01;
-    DEBUG_PRINTLN("[warn] Octet Length is out of range (0x01-0x14)");
+    char c = uuid[i];
+    hash = (hash ^ (uint8_t)((c >= 'a' && c <= 'f') ? c - 'a' + 'A' : c)) * FNV_PRIME;
   }
-  else if (octetLen > 0x14)
+  return hash;
+}
+
+// ----------------------------------------------------------------------
+// Handle of a remote characteristic, 0 when discovery did not find it
+// ----------------------------------------------------------------------
+uint16_t rn487x_dev_remoteHandle(rn487x_t *dev, const char *uuid)
+{
+  uint32_t hash = _uuidHash(uuid, strlen(uuid));
+  for (uint8_t i = 0; i < dev->remoteCnt; i++)
   {
-    octetLen = 0x14;
-    DEBUG_PRINTLN("[warn] Octet Length is out of range (0x01-0x14)");
+    if (dev->remote[i].uuid == hash)
+    {
+      return dev->remote[i].handle;
+    }
   }
+  return 0;
+}
 
-  uint8_t cmdLen = strlen(DEFINE_CHARACT_UUID);
-  uint8_t uuidLen = strlen(uuid);
+// ----------------------------------------------------------------------
+// One line of the LC listing: services are skipped, characteristics
+// are added to the remote table, their CCCD lines are skipped
+// ----------------------------------------------------------------------
+static void _remoteLine(rn487x_cmd_t *cmd, const char *line, uint16_t len)
+{
+  rn487x_t *dev = cmd->dev;
+  uint16_t uuidLen = 0;
+  uint16_t handle = 0;
+  uint8_t prop = 0;
 
-  if (uuidLen == PRIVATE_SERVICE_LEN)
+  while (len > 0 && *line == ' ')
   {
-    DEBUG_PRINTLN("[info] 128-bit length (private characteristic)");
+    line++;
+    len--;
   }
-  else if (uuidLen == PUBLIC_SERVICE_LEN)
+  while (uuidLen < len && line[uuidLen] != ',')
   {
-    DEBUG_PRINTLN("[info] 16-bit length (public characteristic)");
+    uuidLen++;
   }
-  else
+  if (uuidLen + 8 > len || line[uuidLen + 5] != ',' ||
+      !rn487x_hexDecodeU16(&line[uuidLen + 1], &handle) || !rn487x_hexDecodeU8(&line[uuidLen + 6], &prop))
   {
-    DEBUG_PRINTLN("[error] UUID length is not correct");
-    return false;
+    return;
+  }
+  uint32_t hash = _uuidHash(line, uuidLen);
+  if (prop == CCCD_PROPERTY && dev->remoteCnt > 0 && dev->remote[dev->remoteCnt - 1].uuid == hash)
+  {
+    return;
   }
+  if (dev->remoteCnt >= RN487X_REMOTE_MAX_CHARACTS)
+  {
+    dev->remoteOverflow = true;
+    return;
+  }
+  dev->remote[dev->remoteCnt].uuid = hash;
+  dev->remote[dev->remoteCnt].handle = handle;
+  dev->remote[dev->remoteCnt].property = prop;
+  dev->remoteCnt++;
+}
 
-  uint8_t hexBuff[2] = {0};
+// ----------------------------------------------------------------------
+// Discover the services of the connected peer (CI) and keep the handles
+// of its characteristics (LC). Reads and writes reuse them, on later
+// connections to the same peer too, until the next discovery.
+// ----------------------------------------------------------------------
+bool rn487x_dev_discoverRemote(rn487x_t *dev)
+{
+  DEBUG_PRINTLN("[info] discoverRemote");
 
-  _clearBuffer();
-  memcpy(_uart_buffer, DEFINE_CHARACT_UUID, cmdLen);
-  memcpy(&_uart_buffer[cmdLen], uuid, uuidLen);
-  _uart_buffer[cmdLen + uuidLen] = ',';
-  // property
-  _decToHex(property, hexBuff, 2);
-  _uart_buffer[cmdLen + uuidLen + 1] = hexBuff[0];
-  _uart_buffer[cmdLen + uuidLen + 2] = hexBuff[1];
-  _uart_buffer[cmdLen + uuidLen + 3] = ',';
-  // octetLen
-  _decToHex(octetLen, hexBuff, 2);
-  _uart_buffer[cmdLen + uuidLen + 4] = hexBuff[0];
-  _uart_buffer[cmdLen + uuidLen + 5] = hexBuff[1];
+  dev->remoteCnt = 0;
+  dev->remoteOverflow = false;
+  if (_execute(dev, DISCOVER_REMOTE, _CMD_LEN(DISCOVER_REMOTE), AOK_RESP, DISCOVER_CMD_TIMEOUT) != RN487X_CMD_OK)
+  {
+    return false;
+  }
+  rn487x_cmdbuf_t cb;
+  _syncBegin(dev, &cb, PROMPT_END, LIST_CMD_TIMEOUT);
+  dev->syncCmd.onLine = _remoteLine;
+  rn487x_cmdbufAppendLit(&cb, LIST_CLIENT);
+  if (_syncRun(dev, &cb) != RN487X_CMD_OK)
+  {
+    return false;
+  }
+  if (dev->remoteOverflow)
+  {
+    DEBUG_PRINTLN("[error] Number of remote characteristics overflowed");
+    return false;
+  }
+  return true;
+}
 
-  rn487x_sendCommand(_uart_buffer);
-  if (_expectResponse(AOK_RESP, DEFAULT_CMD_TIMEOUT))
+// ----------------------------------------------------------------------
+// Decode a CHR reply, returns the value length or -1
+// ----------------------------------------------------------------------
+static int8_t _remoteValue(const char *hex, uint16_t len, uint8_t *vbuff, uint8_t size)
+{
+  if ((len & 1) || len / 2 > size || !rn487x_hexDecode(hex, len, vbuff))
   {
-    bc->index = _charact_id_cnt;
-    bc->length = octetLen;
-    _charact_id_cnt++;
-    return true;
+    DEBUG_PRINTLN(" => Error invalid remote value");
+    return -1;
   }
-  return false;
+  return len / 2;
 }
 
 // ----------------------------------------------------------------------
-// Write local characteristic value as server
+// Start a CHR or CHW command on a remote characteristic, false when
+// discovery did not find it
 // ----------------------------------------------------------------------
-bool rn487x_writeLocalCharact(ble_charact_t *bc, const uint8_t *value)
+static bool _remoteBegin(rn487x_t *dev, rn487x_cmd_t *cmd, rn487x_cmdbuf_t *cb, const char *op, const char *uuid, const char *expected)
 {
-  DEBUG_PRINTLN("[info] writeLocalCharacteristic");
+  uint16_t handle = rn487x_dev_remoteHandle(dev, uuid);
+  if (handle == 0)
+  {
+    DEBUG_PRINTLN("[error] Unknown remote characteristic");
+    return false;
+  }
+  _cmdBegin(cmd, cb, expected, DEFAULT_CMD_TIMEOUT);
+  rn487x_cmdbufAppend(cb, op, strlen(op));
+  rn487x_cmdbufAppendHexU16(cb, handle);
+  return true;
+}
+
+// ----------------------------------------------------------------------
+// Read a remote characteristic value as client. Returns its length,
+// -1 on error, -2 on timeout.
+// ----------------------------------------------------------------------
+int8_t rn487x_dev_readRemoteCharact(rn487x_t *dev, const char *uuid, uint8_t *vbuff, uint8_t size)
+{
+  DEBUG_PRINTLN("[info] readRemoteCharact");
+
+  rn487x_cmdbuf_t cb;
+  if (!_remoteBegin(dev, &dev->syncCmd, &cb, READ_REMOTE_CHARACT, uuid, NULL))
+  {
+    return -1;
+  }
+  dev->syncCmd.resp = dev->uartBuffer;
+  dev->syncCmd.respSize = UART_BUFF_LEN;
+  rn487x_status_t status = _syncRun(dev, &cb);
+  if (status == RN487X_CMD_TIMEOUT)
+  {
+    DEBUG_PRINTLN("=> Error TIMEOUT");
+    return -2;
+  }
+  if (status != RN487X_CMD_OK)
+  {
+    return -1;
+  }
+  return _remoteValue(dev->uartBuffer, dev->syncCmd.respLen, vbuff, size);
+}
 
-  uint16_t handle = _charact_handles[bc->index];
-  uint8_t cmdLen = strlen(WRITE_LOCAL_CHARACT);
-  uint8_t hexBuff[4] = {0};
-  _decToHex(handle, hexBuff, 4);
+// ----------------------------------------------------------------------
+// Write a remote characteristic value as client
+// ----------------------------------------------------------------------
+bool rn487x_dev_writeRemoteCharact(rn487x_t *dev, const char *uuid, const uint8_t *value, uint8_t len)
+{
+  DEBUG_PRINTLN("[info] writeRemoteCharact");
 
-  _clearBuffer();
-  memcpy(_uart_buffer, WRITE_LOCAL_CHARACT, cmdLen);
-  _uart_buffer[cmdLen] = hexBuff[0];
-  _uart_buffer[cmdLen + 1] = hexBuff[1];
-  _uart_buffer[cmdLen + 2] = hexBuff[2];
-  _uart_buffer[cmdLen + 3] = hexBuff[3];
-  _uart_buffer[cmdLen + 4] = ',';
-  for (uint8_t i = 0, j = 0; i < bc->length; i++, j += 2)
+  rn487x_cmdbuf_t cb;
+  if (!_remoteBegin(dev, &dev->syncCmd, &cb, WRITE_REMOTE_CHARACT, uuid, AOK_RESP))
   {
-    _decToHex(value[i], hexBuff, 2);
-    _uart_buffer[cmdLen + 5 + j] = hexBuff[0];
-    _uart_buffer[cmdLen + 5 + j + 1] = hexBuff[1];
+    return false;
   }
-  rn487x_sendCommand(_uart_buffer);
-  if (_expectResponse(AOK_RESP, DEFAULT_CMD_TIMEOUT))
+  rn487x_cmdbufAppendChar(&cb, ',');
+  rn487x_cmdbufAppendHex(&cb, value, len);
+  if (_syncRun(dev, &cb) == RN487X_CMD_OK)
   {
     return true;
   }
   return false;
 }
 
+#ifdef RN487X_BATCH
 // ----------------------------------------------------------------------
-// Read local characteristic value as server
+// Record the value of a pipelined remote read, from the reply copied
+// over the command text (no longer needed once the command is answered)
 // ----------------------------------------------------------------------
-int8_t rn487x_readLocalCharact(ble_charact_t *bc, uint8_t *vbuff)
+static void _remoteReadDone(rn487x_cmd_t *cmd)
 {
-  DEBUG_PRINTLN("[info] readLocalCharact");
-
-  uint16_t handle = _charact_handles[bc->index];
-  uint8_t cmdLen = strlen(READ_LOCAL_CHARACT);
-  uint8_t hexBuff[4] = {0};
-  _decToHex(handle, hexBuff, 4);
+  rn487x_remote_read_t *r = (rn487x_remote_read_t *)cmd->arg;
+  int8_t len = -1;
+  if (cmd->status == RN487X_CMD_OK)
+  {
+    len = _remoteValue(cmd->text, cmd->respLen, r->value, r->size);
+  }
+  r->length = (len > 0) ? len : 0;
+  r->status = (cmd->status == RN487X_CMD_OK && len < 0) ? RN487X_CMD_ERR : cmd->status;
+}
 
-  _clearBuffer();
-  memcpy(_uart_buffer, READ_LOCAL_CHARACT, cmdLen);
-  _uart_buffer[cmdLen] = hexBuff[0];
-  _uart_buffer[cmdLen + 1] = hexBuff[1];
-  _uart_buffer[cmdLen + 2] = hexBuff[2];
-  _uart_buffer[cmdLen + 3] = hexBuff[3];
-  rn487x_sendCommand(_uart_buffer);
+// ----------------------------------------------------------------------
+// Read several remote characteristics, back to back with up to
+// RN487X_PIPELINE_DEPTH CHR in flight. The result of each read is left
+// in reads[i], returns how many completed with RN487X_CMD_OK.
+// ----------------------------------------------------------------------
+uint8_t rn487x_dev_readRemoteCharacts(rn487x_t *dev, rn487x_remote_read_t *reads, uint8_t count)
+{
+  DEBUG_PRINTLN("[info] readRemoteCharacts");
 
-  uint8_t dataLen = _readUntilCR(DEFAULT_CMD_TIMEOUT);
-  memset(vbuff, 0, bc->length);
-  if (dataLen == 0)
+  uint8_t ok = 0;
+  uint8_t sent = 0;
+  for (uint8_t i = 0; i < count; i++)
   {
-    DEBUG_PRINTLN("=> Error TIMEOUT");
-    return -2;
+    rn487x_cmdbuf_t cb;
+    rn487x_cmd_t *cmd = _batchSlot(dev, sent);
+    reads[i].length = 0;
+    reads[i].status = RN487X_CMD_QUEUED;
+    if (!_remoteBegin(dev, cmd, &cb, READ_REMOTE_CHARACT, reads[i].uuid, NULL) || !rn487x_cmdbufEnd(&cb))
+    {
+      reads[i].status = RN487X_CMD_ERR;
+      continue;
+    }
+    cmd->flags = RN487X_CMD_FLAG_PIPELINE;
+    cmd->callback = _remoteReadDone;
+    cmd->arg = &reads[i];
+    cmd->resp = cmd->text;
+    cmd->respSize = RN487X_CMD_LEN;
+    rn487x_dev_submit(dev, cmd);
+    sent++;
   }
-  if (dataLen == 3)
+  for (uint8_t i = 0; i < count; i++)
   {
-    if (_uart_buffer[0] == 'N' && _uart_buffer[1] == '/' && _uart_buffer[2] == 'A')
+    while (reads[i].status < RN487X_CMD_OK)
     {
-      DEBUG_PRINTLN(" => No data to show");
-      return 0;
+      rn487x_dev_process(dev);
     }
-    else if (_uart_buffer[0] == 'E' && _uart_buffer[1] == 'R' && _uart_buffer[2] == 'R')
+    if (reads[i].status == RN487X_CMD_OK)
     {
-      DEBUG_PRINTLN(" => Error from the module");
-      return -1;
+      ok++;
     }
   }
-  if (dataLen != (2 * bc->length))
+  return ok;
+}
+#endif
+
+/************************** GATT schema ********************************/
+
+// ----------------------------------------------------------------------
+// Prepares the definition command of schema entry i (services first,
+// then their characteristics, in table order) into cmd
+// ----------------------------------------------------------------------
+static bool _schemaPrepare(rn487x_t *dev, rn487x_cmd_t *cmd, const rn487x_service_def_t *service, int16_t i, ble_charact_t *scratch)
+{
+  if (i < 0)
   {
-    DEBUG_PRINTLN(" => Error invalid len");
-    return -1;
+    return rn487x_dev_prepareServiceUUID(dev, cmd, service->uuid);
   }
-  for (uint8_t i = 0, j = 0; i < bc->length; i++, j += 2)
+  const rn487x_charact_def_t *def = &service->characts[i];
+  ble_charact_t *bc = (def->charact != NULL) ? def->charact : scratch;
+  return rn487x_dev_prepareCharactUUID(dev, cmd, bc, def->uuid, def->property, def->length);
+}
+
+// ----------------------------------------------------------------------
+// Take the schema as the module configuration without sending it: the
+// characteristics get their index and the definition hash is the one
+// PZ/PS/PC would have produced. The commands are prepared into the
+// idle syncCmd, never submitted.
+// ----------------------------------------------------------------------
+static bool _schemaAdopt(rn487x_t *dev, const rn487x_service_def_t *services, uint8_t count)
+{
+  rn487x_cmd_t *cmd = &dev->syncCmd;
+  ble_charact_t scratch;
+  dev->charactIdCnt = 0;
+  dev->definitionHash = FNV_OFFSET;
+  for (uint8_t s = 0; s < count; s++)
   {
-    uint8_t d1 = _hexDigitToDec(_uart_buffer[j]) & 0xF;
-    uint8_t d2 = _hexDigitToDec(_uart_buffer[j + 1]) & 0xF;
-    vbuff[i] = (d1 << 4) | d2;
+    for (int16_t i = -1; i < services[s].count; i++)
+    {
+      if (!_schemaPrepare(dev, cmd, &services[s], i, &scratch))
+      {
+        return false;
+      }
+      cmd->status = RN487X_CMD_OK;
+      cmd->callback(cmd);
+    }
   }
-  return 1;
+  return true;
 }
 
-bool rn487x_buildCharacts(void)
+// ----------------------------------------------------------------------
+// Clear the services and send the schema, RN487X_PIPELINE_DEPTH
+// definitions at a time in the batch command slots (RN487X_BATCH),
+// one at a time in syncCmd otherwise
+// ----------------------------------------------------------------------
+static bool _schemaProgram(rn487x_t *dev, const rn487x_service_def_t *services, uint8_t count)
 {
-  uint16_t i = 0;
-  uint16_t j = 0;
-  DEBUG_PRINTLN("[info] buildCharacts");
+#ifdef RN487X_BATCH
+  const uint8_t depth = RN487X_PIPELINE_DEPTH;
+  rn487x_cmd_t *cmds = dev->batchCmds;
+#else
+  const uint8_t depth = 1;
+  rn487x_cmd_t *cmds = &dev->syncCmd;
+#endif
+  ble_charact_t scratch;
+  uint8_t n = 0;
 
-  rn487x_sendCommand(LIST_CHARACTERISTICS);
-  uint32_t start = millis();
-  _clearBuffer();
-  while (millis() - start < LIST_CMD_TIMEOUT)
+  if (!rn487x_dev_clearAllServices(dev))
+  {
+    return false;
+  }
+  for (uint8_t s = 0; s < count; s++)
   {
-    if (BLE_SERIAL_AVAILABLE())
+    for (int16_t i = -1; i < services[s].count; i++)
     {
-      char c = BLE_SERIAL_READ();
-      if (_IS_HEXCOMMA(c) || _IS_ENDWORD(c))
+      if (!_schemaPrepare(dev, &cmds[n], &services[s], i, &scratch))
       {
-        _uart_buffer[i] = c;
-        i++;
+        return false;
       }
-
-      if (c == CR)
+      n++;
+      if (n == depth)
       {
-        if (strstr(_uart_buffer, "END") != NULL)
-        {
-          return true;
-        }
-        if (i >= (PROPERTY_POS + 2))
+        if (rn487x_dev_pipeline(dev, cmds, n) != n)
         {
-          uint8_t prop = _valueStrToNum(&_uart_buffer[PROPERTY_POS], 2);
-          if ((prop & (BLE_PROPERTY_INDICATE | BLE_PROPERTY_NOTIFY)) == 0)
-          {
-            _charact_handles[j] = _valueStrToNum(&_uart_buffer[HANDLE_POS], 4);
-            j++;
-          }
-          if (j > (BLE_MAX_NUMBER_OF_CHARACTERISTICS - 1))
-          {
-            DEBUG_PRINTLN("[error] Number of characteristics overflowed");
-            return false;
-          }
+          return false;
         }
-        i = 0;
-        _clearBuffer();
+        n = 0;
       }
     }
   }
-  DEBUG_PRINTLN("");
-  return true;
-}
\ No newline at end of file
+  return rn487x_dev_pipeline(dev, cmds, n) == n;
+}
+
+// ----------------------------------------------------------------------
+// Make the module GATT configuration match the schema, in command mode.
+// The module is left alone when the handle cache was saved for the same
+// definitions, or when the LS listing matches (LS does not report the
+// octet length, so a change of length alone is not seen there).
+// Otherwise the services are cleared and redefined, and the module is
+// rebooted back into command mode. The characteristic handles are
+// ready on return. Returns 1 if the module was reprogrammed, 0 if it
+// already matched, -1 on error.
+// ----------------------------------------------------------------------
+int8_t rn487x_dev_applySchema(rn487x_t *dev, const rn487x_service_def_t *services, uint8_t count)
+{
+  DEBUG_PRINTLN("[info] applySchema");
+  _shadowForget(dev, SHADOW_VALID | SHADOW_DIRTY | SHADOW_SENT);
+  if (!_schemaAdopt(dev, services, count))
+  {
+    DEBUG_PRINTLN("[error] Invalid schema");
+    return -1;
+  }
+  if (_cacheRestore(dev))
+  {
+    DEBUG_PRINTLN("[info] Schema matches the handle cache");
+    return 0;
+  }
+
+  dev->schema.services = services;
+  dev->schema.count = count;
+  dev->schema.service = 0;
+  dev->schema.charact = 0;
+  dev->schema.last = NULL;
+  dev->schema.match = true;
+  if (_listRun(dev, _schemaLine) != RN487X_CMD_OK)
+  {
+    return -1;
+  }
+  if (dev->schema.match && dev->schema.service == count &&
+      (count == 0 || dev->schema.charact == services[count - 1].count))
+  {
+    DEBUG_PRINTLN("[info] Schema matches the module");
+    if (!dev->listOverflow)
+    {
+      _cacheSave(dev);
+    }
+    return 0;
+  }
+
+  DEBUG_PRINTLN("[info] Schema differs, reprogramming");
+  if (!_schemaProgram(dev, services, count) || !rn487x_dev_reboot(dev) || !rn487x_dev_cmdMode(dev))
+  {
+    return -1;
+  }
+  if (_listRun(dev, _listLine) != RN487X_CMD_OK || dev->listOverflow)
+  {
+    return -1;
+  }
+  _cacheSave(dev);
+  return 1;
+}
@@ -0,0 +1,615 @@
+#include "rn487x.h"
+
+/**
+ ===============================================================================
+            ##### Private variables #####
+ ===============================================================================
+*/
+static rn487x_t _default;
+static bool _default_ready = false;
+
+/**
+ ===============================================================================
+            ##### Private functions #####
+ ===============================================================================
+ */
+
+// ------------------------------------------------------------
+// I/O of the default instance: the BLE_SERIAL_* macros and the
+// RN487X_RESET_PIN / RN487X_WAKE_PIN lines. BLE_SERIAL_SET_BAUDRATE
+// and BLE_SERIAL_SET_FLOW_CONTROL are optional, rn487x_setBaudrate
+// needs both
+// ------------------------------------------------------------
+static int _available(void *arg)
+{
+  (void)arg;
+  return BLE_SERIAL_AVAILABLE();
+}
+
+static int _read(void *arg)
+{
+  (void)arg;
+  return BLE_SERIAL_READ();
+}
+
+static void _write(void *arg, uint8_t c)
+{
+  (void)arg;
+  BLE_SERIAL_WRITE(c);
+}
+
+#ifdef RN487X_TX_DMA
+static void _dmaStart(void *arg, const uint8_t *buf, uint16_t len)
+{
+  (void)arg;
+  BLE_SERIAL_DMA_START(buf, len);
+}
+#endif
+
+#ifdef BLE_SERIAL_SET_BAUDRATE
+static void _setBaudrate(void *arg, uint32_t baudrate)
+{
+  (void)arg;
+  BLE_SERIAL_SET_BAUDRATE(baudrate);
+}
+#endif
+
+#ifdef BLE_SERIAL_SET_FLOW_CONTROL
+static void _setFlowControl(void *arg, bool enable)
+{
+  (void)arg;
+  BLE_SERIAL_SET_FLOW_CONTROL(enable);
+}
+#endif
+
+static void _setReset(void *arg, bool level)
+{
+  (void)arg;
+  if (level)
+  {
+    gpio_set(RN487X_RESET_PIN);
+    return;
+  }
+  gpio_mode(RN487X_RESET_PIN, OUTPUT_PP, NOPULL, SPEED_HIGH);
+  gpio_reset(RN487X_RESET_PIN);
+}
+
+#ifdef RN487X_WAKE_PIN
+static void _setWake(void *arg, bool level)
+{
+  (void)arg;
+  if (level)
+  {
+    gpio_set(RN487X_WAKE_PIN);
+    return;
+  }
+  gpio_mode(RN487X_WAKE_PIN, OUTPUT_PP, NOPULL, SPEED_HIGH);
+  gpio_reset(RN487X_WAKE_PIN);
+}
+#endif
+
+static const rn487x_io_t _default_io = {
+    .available = _available,
+    .read = _read,
+    .write = _write,
+#ifdef RN487X_TX_DMA
+    .dmaStart = _dmaStart,
+#endif
+#ifdef BLE_SERIAL_SET_BAUDRATE
+    .setBaudrate = _setBaudrate,
+#endif
+#ifdef BLE_SERIAL_SET_FLOW_CONTROL
+    .setFlowControl = _setFlowControl,
+#endif
+    .setReset = _setReset,
+#ifdef RN487X_WAKE_PIN
+    .setWake = _setWake,
+#endif
+};
+
+/**
+ ===============================================================================
+            ##### Public functions #####
+ ===============================================================================
+ */
+
+// ------------------------------------------------------------
+// The default instance, set up on first use
+// ------------------------------------------------------------
+rn487x_t *rn487x_defaultDevice(void)
+{
+  if (!_default_ready)
+  {
+    rn487x_dev_setup(&_default, &_default_io);
+    _default_ready = true;
+  }
+  return &_default;
+}
+
+// ------------------------------------------------------------
+// Init and general functions
+// ------------------------------------------------------------
+bool rn487x_init(void)
+{
+  return rn487x_dev_init(rn487x_defaultDevice());
+}
+
+void rn487x_hwReset(void)
+{
+  rn487x_dev_hwReset(rn487x_defaultDevice());
+}
+
+void rn487x_hwWakeUp(void)
+{
+  rn487x_dev_hwWakeUp(rn487x_defaultDevice());
+}
+
+void rn487x_hwSleep(void)
+{
+  rn487x_dev_hwSleep(rn487x_defaultDevice());
+}
+
+void nr487x_hwSleep(void)
+{
+  rn487x_dev_hwSleep(rn487x_defaultDevice());
+}
+
+bool rn487x_setSerializedName(const char *newName)
+{
+  return rn487x_dev_setSerializedName(rn487x_defaultDevice(), newName);
+}
+
+bool rn487x_setDeviceName(const char *dName)
+{
+  return rn487x_dev_setDeviceName(rn487x_defaultDevice(), dName);
+}
+
+bool rn487x_reboot(void)
+{
+  return rn487x_dev_reboot(rn487x_defaultDevice());
+}
+
+int8_t rn487x_getConnectionStatus(void)
+{
+  return rn487x_dev_getConnectionStatus(rn487x_defaultDevice());
+}
+
+bool rn487x_setBaudrate(uint32_t baudrate, bool flowControl)
+{
+  return rn487x_dev_setBaudrate(rn487x_defaultDevice(), baudrate, flowControl);
+}
+
+uint32_t rn487x_getBaudrate(void)
+{
+  return rn487x_dev_getBaudrate(rn487x_defaultDevice());
+}
+
+
+// ------------------------------------------------------------
+// Modes
+// ------------------------------------------------------------
+bool rn487x_dataMode(void)
+{
+  return rn487x_dev_dataMode(rn487x_defaultDevice());
+}
+
+bool rn487x_cmdMode(void)
+{
+  return rn487x_dev_cmdMode(rn487x_defaultDevice());
+}
+
+
+// ------------------------------------------------------------
+// Power
+// ------------------------------------------------------------
+bool rn487x_setLowPower(bool enable)
+{
+  return rn487x_dev_setLowPower(rn487x_defaultDevice(), enable);
+}
+
+bool rn487x_powerConfig(uint16_t idleMs, uint16_t holdMs)
+{
+  return rn487x_dev_powerConfig(rn487x_defaultDevice(), idleMs, holdMs);
+}
+
+rn487x_power_state_t rn487x_powerState(void)
+{
+  return rn487x_dev_powerState(rn487x_defaultDevice());
+}
+
+void rn487x_powerStats(rn487x_power_stats_t *stats)
+{
+  rn487x_dev_powerStats(rn487x_defaultDevice(), stats);
+}
+
+void rn487x_dormant(void)
+{
+  rn487x_dev_dormant(rn487x_defaultDevice());
+}
+
+// ------------------------------------------------------------
+// Timeouts
+// ------------------------------------------------------------
+void rn487x_retryConfig(uint8_t retries, uint16_t timeoutMinMs)
+{
+  rn487x_dev_retryConfig(rn487x_defaultDevice(), retries, timeoutMinMs);
+}
+
+uint16_t rn487x_adaptiveTimeout(rn487x_metric_class_t cls)
+{
+  return rn487x_dev_adaptiveTimeout(rn487x_defaultDevice(), cls);
+}
+
+#ifdef RN487X_METRICS
+// ------------------------------------------------------------
+// Metrics
+// ------------------------------------------------------------
+void rn487x_metrics(rn487x_metrics_t *snapshot)
+{
+  rn487x_dev_metrics(rn487x_defaultDevice(), snapshot);
+}
+
+void rn487x_metricsReset(void)
+{
+  rn487x_dev_metricsReset(rn487x_defaultDevice());
+}
+#endif
+
+#ifdef RN487X_TRACE
+// ------------------------------------------------------------
+// Trace
+// ------------------------------------------------------------
+uint16_t rn487x_traceRead(rn487x_trace_rec_t *recs, uint16_t max)
+{
+  return rn487x_dev_traceRead(rn487x_defaultDevice(), recs, max);
+}
+
+uint32_t rn487x_traceLost(void)
+{
+  return rn487x_dev_traceLost(rn487x_defaultDevice());
+}
+
+void rn487x_traceMark(uint8_t a, uint16_t b, uint32_t c)
+{
+  rn487x_dev_traceMark(rn487x_defaultDevice(), a, b, c);
+}
+#endif
+
+// ------------------------------------------------------------
+// Advertisements
+// ------------------------------------------------------------
+bool rn487x_setAdvPower(uint8_t value)
+{
+  return rn487x_dev_setAdvPower(rn487x_defaultDevice(), value);
+}
+
+bool rn487x_setConnPower(uint8_t value)
+{
+  return rn487x_dev_setConnPower(rn487x_defaultDevice(), value);
+}
+
+bool rn487x_stopAdvertising(void)
+{
+  return rn487x_dev_stopAdvertising(rn487x_defaultDevice());
+}
+
+bool rn487x_clearImmediateAdvertising(void)
+{
+  return rn487x_dev_clearImmediateAdvertising(rn487x_defaultDevice());
+}
+
+bool rn487x_startImmediateAdvertising(uint8_t advType, const uint8_t *advData, size_t size)
+{
+  return rn487x_dev_startImmediateAdvertising(rn487x_defaultDevice(), advType, advData, size);
+}
+
+// ------------------------------------------------------------
+// Beacon
+// ------------------------------------------------------------
+bool rn487x_setBeaconFeatures(const char *mode)
+{
+  return rn487x_dev_setBeaconFeatures(rn487x_defaultDevice(), mode);
+}
+
+bool rn487x_clearImmediateBeacon(void)
+{
+  return rn487x_dev_clearImmediateBeacon(rn487x_defaultDevice());
+}
+
+bool rn487x_startImmediateBeacon(uint8_t adType, const uint8_t *adData, size_t size)
+{
+  return rn487x_dev_startImmediateBeacon(rn487x_defaultDevice(), adType, adData, size);
+}
+
+bool rn487x_clearPermanentBeacon(void)
+{
+  return rn487x_dev_clearPermanentBeacon(rn487x_defaultDevice());
+}
+
+bool rn487x_startPermanentBeacon(uint8_t adType, const uint8_t *adData, size_t size)
+{
+  return rn487x_dev_startPermanentBeacon(rn487x_defaultDevice(), adType, adData, size);
+}
+
+#ifdef RN487X_BEACON
+bool rn487x_beaconSlot(uint8_t slot, const uint8_t *frame, uint8_t size, uint16_t dwellMs)
+{
+  return rn487x_dev_beaconSlot(rn487x_defaultDevice(), slot, frame, size, dwellMs);
+}
+
+bool rn487x_startBeaconRotation(void)
+{
+  return rn487x_dev_startBeaconRotation(rn487x_defaultDevice());
+}
+
+void rn487x_stopBeaconRotation(void)
+{
+  rn487x_dev_stopBeaconRotation(rn487x_defaultDevice());
+}
+
+void rn487x_beaconStats(rn487x_beacon_stats_t *stats)
+{
+  rn487x_dev_beaconStats(rn487x_defaultDevice(), stats);
+}
+#endif
+
+
+#ifdef RN487X_SCAN
+// ------------------------------------------------------------
+// Scan
+// ------------------------------------------------------------
+bool rn487x_startScan(uint16_t interval, uint16_t window)
+{
+  return rn487x_dev_startScan(rn487x_defaultDevice(), interval, window);
+}
+
+bool rn487x_stopScan(void)
+{
+  return rn487x_dev_stopScan(rn487x_defaultDevice());
+}
+
+bool rn487x_scanRead(rn487x_scan_report_t *report)
+{
+  return rn487x_dev_scanRead(rn487x_defaultDevice(), report);
+}
+
+void rn487x_scanStats(rn487x_scan_stats_t *stats)
+{
+  rn487x_dev_scanStats(rn487x_defaultDevice(), stats);
+}
+#endif
+
+
+// ------------------------------------------------------------
+// Send command
+// ------------------------------------------------------------
+void rn487x_sendCommand(const char *cmd)
+{
+  rn487x_dev_sendCommand(rn487x_defaultDevice(), cmd);
+}
+
+
+// ------------------------------------------------------------
+// Transparent UART data
+// ------------------------------------------------------------
+void rn487x_sendData(const char *data, uint16_t dataLen)
+{
+  rn487x_dev_sendData(rn487x_defaultDevice(), data, dataLen);
+}
+
+void rn487x_onData(rn487x_data_cb_t callback, void *arg)
+{
+  rn487x_dev_onData(rn487x_defaultDevice(), callback, arg);
+}
+
+#ifdef RN487X_STREAM
+uint16_t rn487x_streamWrite(const uint8_t *data, uint16_t len)
+{
+  return rn487x_dev_streamWrite(rn487x_defaultDevice(), data, len);
+}
+
+uint16_t rn487x_streamFree(void)
+{
+  return rn487x_dev_streamFree(rn487x_defaultDevice());
+}
+
+uint16_t rn487x_streamPending(void)
+{
+  return rn487x_dev_streamPending(rn487x_defaultDevice());
+}
+
+void rn487x_streamConfig(uint16_t chunkLen, uint32_t rate)
+{
+  rn487x_dev_streamConfig(rn487x_defaultDevice(), chunkLen, rate);
+}
+#endif
+
+
+// ------------------------------------------------------------
+// Command engine (non-blocking)
+// ------------------------------------------------------------
+bool rn487x_submit(rn487x_cmd_t *cmd)
+{
+  return rn487x_dev_submit(rn487x_defaultDevice(), cmd);
+}
+
+bool rn487x_isIdle(void)
+{
+  return rn487x_dev_isIdle(rn487x_defaultDevice());
+}
+
+void rn487x_process(void)
+{
+  rn487x_dev_process(rn487x_defaultDevice());
+}
+
+void rn487x_rxFeed(uint8_t c)
+{
+  rn487x_dev_rxFeed(rn487x_defaultDevice(), c);
+}
+
+void rn487x_txDmaDone(void)
+{
+  rn487x_dev_txDmaDone(rn487x_defaultDevice());
+}
+
+bool rn487x_txIdle(void)
+{
+  return rn487x_dev_txIdle(rn487x_defaultDevice());
+}
+
+uint16_t rn487x_rxOverruns(void)
+{
+  return rn487x_dev_rxOverruns(rn487x_defaultDevice());
+}
+
+rn487x_reply_t rn487x_lastReply(void)
+{
+  return rn487x_dev_lastReply(rn487x_defaultDevice());
+}
+
+
+// ------------------------------------------------------------
+// Events
+// ------------------------------------------------------------
+bool rn487x_onEvent(const char *name, rn487x_event_cb_t callback, void *arg)
+{
+  return rn487x_dev_onEvent(rn487x_defaultDevice(), name, callback, arg);
+}
+
+bool rn487x_isConnected(void)
+{
+  return rn487x_dev_isConnected(rn487x_defaultDevice());
+}
+
+uint8_t rn487x_pipeline(rn487x_cmd_t *cmds, uint8_t count)
+{
+  return rn487x_dev_pipeline(rn487x_defaultDevice(), cmds, count);
+}
+
+
+// ------------------------------------------------------------
+// Services
+// ------------------------------------------------------------
+bool rn487x_deviceService_setManufName(const char *name)
+{
+  return rn487x_dev_deviceService_setManufName(rn487x_defaultDevice(), name);
+}
+
+bool rn487x_setServiceUUID(const char *uuid)
+{
+  return rn487x_dev_setServiceUUID(rn487x_defaultDevice(), uuid);
+}
+
+bool rn487x_prepareServiceUUID(rn487x_cmd_t *cmd, const char *uuid)
+{
+  return rn487x_dev_prepareServiceUUID(rn487x_defaultDevice(), cmd, uuid);
+}
+
+bool rn487x_clearAllServices(void)
+{
+  return rn487x_dev_clearAllServices(rn487x_defaultDevice());
+}
+
+
+// ------------------------------------------------------------
+// Characteristics
+// ------------------------------------------------------------
+bool rn487x_setCharactUUID(ble_charact_t *bc, const char *uuid, uint8_t property, uint8_t octetLen)
+{
+  return rn487x_dev_setCharactUUID(rn487x_defaultDevice(), bc, uuid, property, octetLen);
+}
+
+bool rn487x_prepareCharactUUID(rn487x_cmd_t *cmd, ble_charact_t *bc, const char *uuid, uint8_t property, uint8_t octetLen)
+{
+  return rn487x_dev_prepareCharactUUID(rn487x_defaultDevice(), cmd, bc, uuid, property, octetLen);
+}
+
+bool rn487x_writeLocalCharact(ble_charact_t *bc, const uint8_t *value)
+{
+  return rn487x_dev_writeLocalCharact(rn487x_defaultDevice(), bc, value);
+}
+
+bool rn487x_prepareWriteLocalCharact(rn487x_cmd_t *cmd, ble_charact_t *bc, const uint8_t *value)
+{
+  return rn487x_dev_prepareWriteLocalCharact(rn487x_defaultDevice(), cmd, bc, value);
+}
+
+#ifdef RN487X_BATCH
+uint8_t rn487x_writeLocalCharacts(rn487x_charact_write_t *writes, uint8_t count)
+{
+  return rn487x_dev_writeLocalCharacts(rn487x_defaultDevice(), writes, count);
+}
+#endif
+
+int8_t rn487x_readLocalCharact(ble_charact_t *bc, uint8_t *vbuff)
+{
+  return rn487x_dev_readLocalCharact(rn487x_defaultDevice(), bc, vbuff);
+}
+
+#ifdef RN487X_SHADOW
+void rn487x_shadowConfig(uint16_t windowMs)
+{
+  rn487x_dev_shadowConfig(rn487x_defaultDevice(), windowMs);
+}
+
+bool rn487x_shadowFlush(void)
+{
+  return rn487x_dev_shadowFlush(rn487x_defaultDevice());
+}
+#endif
+
+bool rn487x_buildCharacts(void)
+{
+  return rn487x_dev_buildCharacts(rn487x_defaultDevice());
+}
+
+void rn487x_setHandleCache(rn487x_cache_load_t load, rn487x_cache_store_t store, void *arg)
+{
+  rn487x_dev_setHandleCache(rn487x_defaultDevice(), load, store, arg);
+}
+
+uint32_t rn487x_definitionHash(void)
+{
+  return rn487x_dev_definitionHash(rn487x_defaultDevice());
+}
+
+
+// ------------------------------------------------------------
+// Client role
+// ------------------------------------------------------------
+bool rn487x_discoverRemote(void)
+{
+  return rn487x_dev_discoverRemote(rn487x_defaultDevice());
+}
+
+uint16_t rn487x_remoteHandle(const char *uuid)
+{
+  return rn487x_dev_remoteHandle(rn487x_defaultDevice(), uuid);
+}
+
+int8_t rn487x_readRemoteCharact(const char *uuid, uint8_t *vbuff, uint8_t size)
+{
+  return rn487x_dev_readRemoteCharact(rn487x_defaultDevice(), uuid, vbuff, size);
+}
+
+bool rn487x_writeRemoteCharact(const char *uuid, const uint8_t *value, uint8_t len)
+{
+  return rn487x_dev_writeRemoteCharact(rn487x_defaultDevice(), uuid, value, len);
+}
+
+#ifdef RN487X_BATCH
+uint8_t rn487x_readRemoteCharacts(rn487x_remote_read_t *reads, uint8_t count)
+{
+  return rn487x_dev_readRemoteCharacts(rn487x_defaultDevice(), reads, count);
+}
+#endif
+
+
+// ------------------------------------------------------------
+// GATT schema
+// ------------------------------------------------------------
+int8_t rn487x_applySchema(const rn487x_service_def_t *services, uint8_t count)
+{
+  return rn487x_dev_applySchema(rn487x_defaultDevice(), services, count);
+}
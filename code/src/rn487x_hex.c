@@ -0,0 +1,139 @@
+#include "rn487x_hex.h"
+#include <string.h>
+
+/**
+ ===============================================================================
+            ##### Private macros #####
+ ===============================================================================
+*/
+#define _HEX_CHAR(__n__) ((__n__) < 10 ? '0' + (__n__) : 'A' + (__n__) - 10)
+#define _HEX_VALUE(__c__) (((__c__) >= '0' && (__c__) <= '9')   ? (__c__) - '0'      \
+                           : ((__c__) >= 'A' && (__c__) <= 'F') ? (__c__) - 'A' + 10 \
+                           : ((__c__) >= 'a' && (__c__) <= 'f') ? (__c__) - 'a' + 10 \
+                                                                : 0xFF)
+
+// Table generators: __m__(n) for n in [__n__, __n__ + 4^k)
+#define _X4(__m__, __n__) __m__(__n__), __m__((__n__) + 1), __m__((__n__) + 2), __m__((__n__) + 3)
+#define _X16(__m__, __n__) _X4(__m__, __n__), _X4(__m__, (__n__) + 4), _X4(__m__, (__n__) + 8), _X4(__m__, (__n__) + 12)
+#define _X64(__m__, __n__) _X16(__m__, __n__), _X16(__m__, (__n__) + 16), _X16(__m__, (__n__) + 32), _X16(__m__, (__n__) + 48)
+#define _X256(__m__) _X64(__m__, 0), _X64(__m__, 64), _X64(__m__, 128), _X64(__m__, 192)
+
+// Word-at-a-time paths need little-endian loads and stores (Cortex-M, x86).
+// The words go through memcpy, which the compiler turns into single loads
+// and stores without breaking the aliasing rules or the alignment.
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define HEX_WORD_ACCESS 1
+// Both characters of a byte, the first one in the low half
+#define _HEX_PAIR(__b__) ((uint16_t)_HEX_CHAR((__b__) >> 4) | ((uint16_t)_HEX_CHAR((__b__) & 0xF) << 8))
+#endif
+
+/**
+ ===============================================================================
+            ##### Private variables #####
+ ===============================================================================
+*/
+static const char _hex_digits[16] = {_X16(_HEX_CHAR, 0)};
+static const uint8_t _hex_values[256] = {_X256(_HEX_VALUE)};
+#ifdef HEX_WORD_ACCESS
+static const uint16_t _hex_pairs[256] = {_X256(_HEX_PAIR)};
+#endif
+
+/**
+ ===============================================================================
+            ##### Public functions #####
+ ===============================================================================
+ */
+
+// ------------------------------------------------------------
+// Binary buffer to hex text
+// ------------------------------------------------------------
+void rn487x_hexEncode(const uint8_t *src, size_t len, char *dst)
+{
+  size_t i = 0;
+#ifdef HEX_WORD_ACCESS
+  // 4 bytes in, 8 characters out
+  for (; i + 4 <= len; i += 4)
+  {
+    uint32_t w;
+    uint32_t out[2];
+    memcpy(&w, &src[i], sizeof(w));
+    out[0] = _hex_pairs[w & 0xFF] | ((uint32_t)_hex_pairs[(w >> 8) & 0xFF] << 16);
+    out[1] = _hex_pairs[(w >> 16) & 0xFF] | ((uint32_t)_hex_pairs[w >> 24] << 16);
+    memcpy(&dst[2 * i], out, sizeof(out));
+  }
+#endif
+  for (; i < len; i++)
+  {
+    dst[2 * i] = _hex_digits[src[i] >> 4];
+    dst[2 * i + 1] = _hex_digits[src[i] & 0xF];
+  }
+}
+
+// ------------------------------------------------------------
+// Hex text to binary buffer. Invalid digits map to 0xFF in the
+// table, so a single OR tells whether any of them was seen.
+// ------------------------------------------------------------
+bool rn487x_hexDecode(const char *src, size_t hexLen, uint8_t *dst)
+{
+  uint8_t bad = 0;
+  size_t i = 0;
+  if (hexLen & 1)
+  {
+    return false;
+  }
+#ifdef HEX_WORD_ACCESS
+  // 4 characters in, 2 bytes out
+  for (; i + 4 <= hexLen; i += 4)
+  {
+    uint32_t w;
+    memcpy(&w, &src[i], sizeof(w));
+    uint8_t d0 = _hex_values[w & 0xFF];
+    uint8_t d1 = _hex_values[(w >> 8) & 0xFF];
+    uint8_t d2 = _hex_values[(w >> 16) & 0xFF];
+    uint8_t d3 = _hex_values[w >> 24];
+    bad |= d0 | d1 | d2 | d3;
+    uint16_t out = (uint16_t)((d0 << 4) | d1) | ((uint16_t)((d2 << 4) | d3) << 8);
+    memcpy(&dst[i / 2], &out, sizeof(out));
+  }
+#endif
+  for (; i < hexLen; i += 2)
+  {
+    uint8_t hi = _hex_values[(uint8_t)src[i]];
+    uint8_t lo = _hex_values[(uint8_t)src[i + 1]];
+    bad |= hi | lo;
+    dst[i / 2] = (hi << 4) | lo;
+  }
+  return (bad & 0xF0) == 0;
+}
+
+// ------------------------------------------------------------
+// Fixed width helpers
+// ------------------------------------------------------------
+void rn487x_hexEncodeU8(uint8_t value, char *dst)
+{
+  dst[0] = _hex_digits[value >> 4];
+  dst[1] = _hex_digits[value & 0xF];
+}
+
+void rn487x_hexEncodeU16(uint16_t value, char *dst)
+{
+  rn487x_hexEncodeU8(value >> 8, dst);
+  rn487x_hexEncodeU8(value & 0xFF, &dst[2]);
+}
+
+bool rn487x_hexDecodeU8(const char *src, uint8_t *value)
+{
+  uint8_t hi = _hex_values[(uint8_t)src[0]];
+  uint8_t lo = _hex_values[(uint8_t)src[1]];
+  *value = (hi << 4) | lo;
+  return ((hi | lo) & 0xF0) == 0;
+}
+
+bool rn487x_hexDecodeU16(const char *src, uint16_t *value)
+{
+  uint8_t hi, lo;
+  bool ok = rn487x_hexDecodeU8(src, &hi);
+  ok = rn487x_hexDecodeU8(&src[2], &lo) && ok;
+  *value = ((uint16_t)hi << 8) | lo;
+  return ok;
+}
@@ -0,0 +1,278 @@
+#include "rn487x_task.h"
+
+/** 
+ ===============================================================================
+            ##### Private macros #####
+ ===============================================================================
+*/
+#ifdef RN487X_DEBUG
+#define DEBUG_PRINTLN uart2_println
+#else
+#define DEBUG_PRINTLN(__X__)
+#endif
+
+/**
+ ===============================================================================
+            ##### Private functions #####
+ ===============================================================================
+ */
+
+// ------------------------------------------------------------
+// SHW built from the characteristic handles of the instance
+// ------------------------------------------------------------
+static bool _prepareWrite(rn487x_t *dev, rn487x_cmd_t *cmd, void *arg)
+{
+  rn487x_charact_write_t *write = arg;
+  return rn487x_dev_prepareWriteLocalCharact(dev, cmd, write->charact, write->value);
+}
+
+// ------------------------------------------------------------
+// Report a finished request to its lane and its caller
+// ------------------------------------------------------------
+static void _reqFinish(rn487x_task_t *task, rn487x_req_t *req)
+{
+  rn487x_lane_stats_t *st = &task->lanes[req->lane].stats;
+  uint32_t us = micros() - req->queuedAt;
+  if (req->callback != NULL)
+  {
+    req->callback(req);
+  }
+  task->os.lock(task->os.arg);
+  st->completed++;
+  st->failed += (req->cmd.status == RN487X_CMD_OK) ? 0 : 1;
+  st->latencyTotalUs += us;
+  st->latencyMaxUs = (us > st->latencyMaxUs) ? us : st->latencyMaxUs;
+  req->done = true;
+  task->os.unlock(task->os.arg);
+  task->os.notify(task->os.arg, req);
+}
+
+// ------------------------------------------------------------
+// Command completion, from rn487x_dev_process() on the driver
+// task. The request starts with its command.
+// ------------------------------------------------------------
+static void _reqDone(rn487x_cmd_t *cmd)
+{
+  rn487x_req_t *req = (rn487x_req_t *)cmd;
+  rn487x_task_t *task = req->task;
+  task->inflight--;
+  task->inflightPlain -= req->pipeline ? 0 : 1;
+  cmd->callback = req->cmdCallback;
+  if (cmd->callback != NULL)
+  {
+    cmd->callback(cmd);
+  }
+  _reqFinish(task, req);
+}
+
+// ------------------------------------------------------------
+// Take the next request the engine can accept right now, the
+// highest lane first unless a lane was overtaken
+// RN487X_TASK_BURST times in a row. Time stamps the requests
+// posted since the last call.
+// ------------------------------------------------------------
+static rn487x_req_t *_reqNext(rn487x_task_t *task)
+{
+  rn487x_req_t *req = NULL;
+  uint8_t first = 0;
+  uint32_t now = micros();
+  task->os.lock(task->os.arg);
+  for (uint8_t l = 0; l < RN487X_LANES; l++)
+  {
+    for (rn487x_req_t *r = task->lanes[l].fresh; r != NULL; r = r->next)
+    {
+      r->queuedAt = now;
+    }
+    task->lanes[l].fresh = NULL;
+  }
+  for (uint8_t l = RN487X_LANES; l-- > 0;)
+  {
+    first = (task->lanes[l].head != NULL && task->lanes[l].passed >= RN487X_TASK_BURST) ? l : first;
+  }
+  // The overtaken lane goes first, then the others in their order
+  for (uint8_t i = 0; i < RN487X_LANES && req == NULL; i++)
+  {
+    uint8_t l = (i == 0) ? first : (i <= first) ? i - 1 : i;
+    rn487x_req_t *head = task->lanes[l].head;
+    if (head == NULL)
+    {
+      continue;
+    }
+    if (task->inflight > 0 &&
+        (!head->pipeline || task->inflightPlain > 0 || task->inflight >= RN487X_PIPELINE_DEPTH))
+    {
+      break; // a lower lane must not overtake the head of a higher one
+    }
+    req = head;
+    task->lanes[l].head = head->next;
+    if (task->lanes[l].head == NULL)
+    {
+      task->lanes[l].tail = NULL;
+    }
+    task->lanes[l].passed = 0;
+    for (uint8_t k = 0; k < RN487X_LANES; k++)
+    {
+      if (k != l && task->lanes[k].head != NULL)
+      {
+        rn487x_lane_stats_t *st = &task->lanes[k].stats;
+        task->lanes[k].passed++;
+        st->passedMax = (task->lanes[k].passed > st->passedMax) ? task->lanes[k].passed : st->passedMax;
+      }
+    }
+  }
+  task->os.unlock(task->os.arg);
+  return req;
+}
+
+// ------------------------------------------------------------
+// Hand the requests over to the engine while it accepts them
+// ------------------------------------------------------------
+static void _dispatch(rn487x_task_t *task)
+{
+  rn487x_req_t *req;
+  while ((req = _reqNext(task)) != NULL)
+  {
+    if (req->prepare != NULL && !req->prepare(task->dev, &req->cmd, req->prepareArg))
+    {
+      DEBUG_PRINTLN("[error] Request not prepared");
+      req->cmd.status = RN487X_CMD_ERR;
+      _reqFinish(task, req);
+      continue;
+    }
+    req->cmd.flags |= req->pipeline;
+    req->cmdCallback = req->cmd.callback;
+    req->cmd.callback = _reqDone;
+    task->inflight++;
+    task->inflightPlain += req->pipeline ? 0 : 1;
+    if (!rn487x_dev_submit(task->dev, &req->cmd))
+    {
+      req->cmd.callback = req->cmdCallback;
+      req->cmd.status = RN487X_CMD_ERR;
+      task->inflight--;
+      task->inflightPlain -= req->pipeline ? 0 : 1;
+      _reqFinish(task, req);
+    }
+  }
+}
+
+/**
+ ===============================================================================
+            ##### Public functions #####
+ ===============================================================================
+ */
+
+// ------------------------------------------------------------
+// Bind the task to an instance and an RTOS port
+// ------------------------------------------------------------
+void rn487x_task_setup(rn487x_task_t *task, rn487x_t *dev, const rn487x_os_t *os)
+{
+  memset(task, 0, sizeof(*task));
+  task->dev = dev;
+  task->os = *os;
+}
+
+// ------------------------------------------------------------
+// Driver task round: submit what the engine accepts, run the
+// engine, then submit again after the completions. The driver
+// task polls the UART while commands are in flight (0 ms).
+// ------------------------------------------------------------
+uint32_t rn487x_task_poll(rn487x_task_t *task)
+{
+  _dispatch(task);
+  rn487x_dev_process(task->dev);
+  _dispatch(task);
+  return (task->inflight > 0) ? 0 : RN487X_TASK_IDLE_MS;
+}
+
+// ------------------------------------------------------------
+// Driver task body
+// ------------------------------------------------------------
+void rn487x_task_run(rn487x_task_t *task)
+{
+  for (;;)
+  {
+    task->os.sleep(task->os.arg, rn487x_task_poll(task));
+  }
+}
+
+// ------------------------------------------------------------
+// Request a command built by the caller. The optional cmd
+// fields (onLine for a listing, resp) may be set afterwards;
+// cmd.callback runs on the driver task before req->callback.
+// ------------------------------------------------------------
+bool rn487x_reqCommand(rn487x_req_t *req, const char *text, const char *expected, uint16_t timeout)
+{
+  req->prepare = NULL;
+  req->prepareArg = NULL;
+  return rn487x_cmdPrepare(&req->cmd, text, expected, timeout);
+}
+
+// ------------------------------------------------------------
+// Request an SHW. The handle is looked up on the driver task;
+// write must stay valid until the request is done.
+// ------------------------------------------------------------
+void rn487x_reqWriteLocalCharact(rn487x_req_t *req, rn487x_charact_write_t *write)
+{
+  memset(&req->cmd, 0, sizeof(req->cmd));
+  req->cmd.flags = RN487X_CMD_FLAG_PIPELINE;
+  req->prepare = _prepareWrite;
+  req->prepareArg = write;
+}
+
+// ------------------------------------------------------------
+// Queue a request at the end of its lane and wake the driver
+// task. Completion sets req->done, then notifies req->waiter.
+// ------------------------------------------------------------
+bool rn487x_task_post(rn487x_task_t *task, rn487x_req_t *req, rn487x_lane_t lane)
+{
+  if (req == NULL || lane >= RN487X_LANES || (req->prepare == NULL && req->cmd.text[0] == 0))
+  {
+    return false;
+  }
+  req->task = task;
+  req->lane = lane;
+  req->pipeline = req->cmd.flags & RN487X_CMD_FLAG_PIPELINE;
+  req->done = false;
+  req->next = NULL;
+  task->os.lock(task->os.arg);
+  if (task->lanes[lane].tail != NULL)
+  {
+    task->lanes[lane].tail->next = req;
+  }
+  else
+  {
+    task->lanes[lane].head = req;
+  }
+  task->lanes[lane].tail = req;
+  if (task->lanes[lane].fresh == NULL)
+  {
+    task->lanes[lane].fresh = req;
+  }
+  task->os.unlock(task->os.arg);
+  task->os.wake(task->os.arg);
+  return true;
+}
+
+// ------------------------------------------------------------
+// Post a request and wait for it, the calling task blocks
+// ------------------------------------------------------------
+rn487x_status_t rn487x_task_call(rn487x_task_t *task, rn487x_req_t *req, rn487x_lane_t lane)
+{
+  if (!rn487x_task_post(task, req, lane))
+  {
+    return RN487X_CMD_ERR;
+  }
+  task->os.wait(task->os.arg, req);
+  return req->cmd.status;
+}
+
+// ------------------------------------------------------------
+// Requests completed on a lane and their latency, from the
+// driver poll that first saw them to their completion
+// ------------------------------------------------------------
+void rn487x_task_stats(rn487x_task_t *task, rn487x_lane_t lane, rn487x_lane_stats_t *stats)
+{
+  task->os.lock(task->os.arg);
+  *stats = task->lanes[lane].stats;
+  task->os.unlock(task->os.arg);
+}
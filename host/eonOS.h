@@ -0,0 +1,62 @@
+#ifndef __EONOS_HOST
+#define __EONOS_HOST
+
+/**
+ ===============================================================================
+    Host stand-in for eonOS. It only covers what the rn487x driver uses:
+    clock (millis/delay), GPIO, uart1 and the debug uart2. Every call is routed to
+    the simulator in rn487x_sim.c, which owns a virtual microsecond clock.
+ ===============================================================================
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ ===============================================================================
+            ##### GPIO #####
+ ===============================================================================
+ */
+#define PA8 0x08
+#define PB14 0x1E
+
+#define OUTPUT_PP 1
+#define NOPULL 0
+#define SPEED_HIGH 3
+
+void gpio_mode(uint8_t pin, uint8_t mode, uint8_t pull, uint8_t speed);
+void gpio_set(uint8_t pin);
+void gpio_reset(uint8_t pin);
+
+/**
+ ===============================================================================
+            ##### Time #####
+ ===============================================================================
+ */
+uint32_t millis(void);
+uint32_t micros(void);
+void delay(uint32_t ms);
+
+/**
+ ===============================================================================
+            ##### UART #####
+ ===============================================================================
+ */
+// uart1 is wired to the simulated RN487x module
+void uart1_print(const char *str);
+void uart1_write(uint8_t c);
+int uart1_available(void);
+int uart1_read(void);
+// Line settings, both ends must agree
+void uart1_set_baudrate(uint32_t baudrate);
+void uart1_set_flow_control(bool enable);
+// Transmits len bytes from buf in the background, one character time each;
+// buf must stay untouched until the completion interrupt
+void uart1_dma_start(const uint8_t *buf, uint16_t len);
+
+// uart2 is the debug console (stderr)
+void uart2_print(const char *str);
+void uart2_println(const char *str);
+
+#endif
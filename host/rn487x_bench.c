@@ -0,0 +1,1216 @@
+// Host latency benchmark for the rn487x driver.
+// Every figure is simulated time (see rn487x_sim.h), so results are exact
+// and repeatable: a regression shows up as a changed number, not as noise.
+// Each scenario also checks its outcome; a failed check is printed and
+// makes the exit status nonzero.
+
+#include "rn487x.h"
+#include "rn487x_const.h"
+#include "rn487x_hex.h"
+#include "rn487x_sim.h"
+#include <stdio.h>
+
+#define SERVICE_UUID "AD11CF40063F11E5BE3E0002A5D5C51B"
+#define CHARACT_UUID_FMT "BF3FBD80063F11E59E690002A5D5C5%02X"
+#define PEER_SERVICE_UUID "5C11CF40063F11E5BE3E0002A5D5C51B"
+#define PEER_UUID_FMT "5C3FBD80063F11E59E690002A5D5C5%02X"
+#define PEER_VALUE_LEN 4
+#define SCAN_DEVICES 20
+#define SCAN_REPORTS 400
+#define SCAN_RATE 100 // [reports/s] on the air
+#define BENCH_CHARACTS 10
+#define BENCH_ROUNDS 20
+#define BENCH_STREAM_LEN 32768
+#define BENCH_SENSOR_WRITES 1000 // one per ms
+#define BENCH_RADIOS 3          // on simulated modules 1 to 3
+#define POWER_RUN_MS 10000
+#define POWER_PERIOD_MS 100 // two sensors sampled POWER_SPACING_MS apart
+#define POWER_SPACING_MS 30
+#define POWER_TICK_US 100   // main loop period
+#define FAULT_WRITES 500
+#define FAULT_LOST 20    // [1/1000] replies lost
+#define FAULT_SLOW 20    // [1/1000] replies FAULT_SLOW_US late
+#define FAULT_SLOW_US 20000
+#define LATE_READS 200
+#define LATE_READ_SLOW 50   // [1/1000] replies LATE_READ_US late
+#define LATE_READ_US 100000 // past the adaptive timeout, within the fixed one
+#define SHADOW_RACE_WINDOW 20 // [ms] write-combining window of the in-flight writes
+#define BEACON_RUN_MS 3000
+#define BEACON_DWELL_MS 100
+#define BEACON_TICK_US 1000 // main loop period
+
+typedef struct
+{
+  const char *name;
+  uint32_t calls;
+  uint32_t failures;
+  uint64_t totalUs;
+  uint64_t maxUs;
+  uint32_t txBytes;
+  uint32_t rxBytes;
+} bench_stat_t;
+
+typedef struct
+{
+  uint64_t us;
+  rn487x_sim_stats_t sim;
+} bench_mark_t;
+
+static bench_mark_t _mark;
+static uint32_t _checks;
+static uint32_t _checksFailed;
+
+// Scenario outcome, printed when it fails
+static void _check(bool ok, const char *what)
+{
+  _checks++;
+  if (!ok)
+  {
+    _checksFailed++;
+    printf("FAIL: %s\n", what);
+  }
+}
+
+// Declarative schema, same shape as the service provisioned by hand
+#define SCHEMA_UUID(__n__) "0B3FBD80063F11E59E690002A5D5C5" __n__
+#define SCHEMA_RW (BLE_PROPERTY_READ | BLE_PROPERTY_WRITE)
+static ble_charact_t _schema_characts[BENCH_CHARACTS];
+static const rn487x_charact_def_t _schema_characts_def[BENCH_CHARACTS] = {
+    {SCHEMA_UUID("00"), SCHEMA_RW, BENCH_CHARACTS, &_schema_characts[0]},
+    {SCHEMA_UUID("01"), SCHEMA_RW, BENCH_CHARACTS, &_schema_characts[1]},
+    {SCHEMA_UUID("02"), SCHEMA_RW, BENCH_CHARACTS, &_schema_characts[2]},
+    {SCHEMA_UUID("03"), SCHEMA_RW, BENCH_CHARACTS, &_schema_characts[3]},
+    {SCHEMA_UUID("04"), SCHEMA_RW, BENCH_CHARACTS, &_schema_characts[4]},
+    {SCHEMA_UUID("05"), SCHEMA_RW, BENCH_CHARACTS, &_schema_characts[5]},
+    {SCHEMA_UUID("06"), SCHEMA_RW, BENCH_CHARACTS, &_schema_characts[6]},
+    {SCHEMA_UUID("07"), SCHEMA_RW, BENCH_CHARACTS, &_schema_characts[7]},
+    {SCHEMA_UUID("08"), SCHEMA_RW, BENCH_CHARACTS, &_schema_characts[8]},
+    {SCHEMA_UUID("09"), BLE_PROPERTY_READ | BLE_PROPERTY_NOTIFY, BENCH_CHARACTS, NULL},
+};
+static const rn487x_service_def_t _schema[] = {
+    {SERVICE_UUID, _schema_characts_def, BENCH_CHARACTS},
+};
+
+// Handle cache "flash"
+static rn487x_handle_cache_t _nvm;
+static bool _nvm_valid = false;
+
+static bool _nvmLoad(rn487x_handle_cache_t *cache, void *arg)
+{
+  (void)arg;
+  *cache = _nvm;
+  return _nvm_valid;
+}
+
+static bool _nvmStore(const rn487x_handle_cache_t *cache, void *arg)
+{
+  (void)arg;
+  _nvm = *cache;
+  _nvm_valid = true;
+  return true;
+}
+
+static bench_mark_t _now(void)
+{
+  bench_mark_t m;
+  rn487x_sim_getStats(&m.sim);
+  m.us = rn487x_sim_micros();
+  return m;
+}
+
+static void _begin(void)
+{
+  _mark = _now();
+}
+
+static void _endFrom(bench_stat_t *st, bool ok, const bench_mark_t *from)
+{
+  bench_mark_t to = _now();
+  uint64_t us = to.us - from->us;
+  st->calls++;
+  st->failures += ok ? 0 : 1;
+  st->totalUs += us;
+  st->maxUs = us > st->maxUs ? us : st->maxUs;
+  st->txBytes += to.sim.txBytes - from->sim.txBytes;
+  st->rxBytes += to.sim.rxBytes - from->sim.rxBytes;
+}
+
+static void _end(bench_stat_t *st, bool ok)
+{
+  _endFrom(st, ok, &_mark);
+}
+
+static void _report(const bench_stat_t *st)
+{
+  uint32_t n = st->calls ? st->calls : 1;
+  printf("%-28s %6u %6u %12.3f %12.3f %8u %8u\n", st->name, st->calls, st->failures,
+         (double)st->totalUs / n / 1000.0, (double)st->maxUs / 1000.0,
+         st->txBytes / n, st->rxBytes / n);
+  _check(st->calls > 0 && st->failures == 0, st->name);
+}
+
+// Reference: the fixed waits rn487x_init used to pay before the boot was
+// event driven (reset delay, R,1 sent in data mode until its timeout,
+// $$$ guard time, reboot delay)
+static bool _fixedDelayInit(void)
+{
+  gpio_reset(RN487X_RESET_PIN);
+  delay(5);
+  gpio_set(RN487X_RESET_PIN);
+  delay(500);
+  rn487x_hwWakeUp();
+  delay(RESET_CMD_TIMEOUT);
+  delay(DELAY_BEFORE_CMD);
+  if (!rn487x_cmdMode())
+  {
+    return false;
+  }
+  rn487x_cmd_t cmd;
+  rn487x_cmdPrepare(&cmd, REBOOT, REBOOTING_RESP, RESET_CMD_TIMEOUT);
+  rn487x_submit(&cmd);
+  while (!rn487x_cmdDone(&cmd))
+  {
+    rn487x_process();
+  }
+  delay(RESET_CMD_TIMEOUT);
+  return cmd.status == RN487X_CMD_OK;
+}
+
+typedef struct
+{
+  uint32_t bytes; // received by the peer
+  uint32_t lost;  // dropped by the module
+  double rate;    // [B/s] received by the peer
+} stream_stat_t;
+
+// Pushes BENCH_STREAM_LEN bytes to a connected peer, with the paced stream
+// or with rn487x_sendData
+static stream_stat_t _streamRun(bool paced)
+{
+  stream_stat_t st;
+  static uint8_t data[BENCH_STREAM_LEN];
+  bench_mark_t from = _now();
+  bench_mark_t to;
+  uint32_t sent = 0;
+
+  while (sent < BENCH_STREAM_LEN || rn487x_streamPending() > 0)
+  {
+    if (!paced)
+    {
+      rn487x_sendData((const char *)&data[sent], 1024);
+      sent += 1024;
+      continue;
+    }
+    sent += rn487x_streamWrite(&data[sent], BENCH_STREAM_LEN - sent);
+    rn487x_process();
+  }
+  while (!rn487x_txIdle())
+  {
+    rn487x_process();
+  }
+  to = _now();
+  st.bytes = to.sim.streamBytes - from.sim.streamBytes;
+  st.lost = to.sim.streamOverruns - from.sim.streamOverruns;
+  st.rate = (double)st.bytes * 1e6 / (double)(to.us - from.us);
+  return st;
+}
+
+static void _streamBench(const char *name, bool paced)
+{
+  stream_stat_t st = _streamRun(paced);
+  printf("%-28s %12u %12.0f %12u\n", name, st.bytes, st.rate, st.lost);
+  // Unpaced, the module buffer overflows: every byte is delivered or counted lost
+  _check(st.bytes + st.lost == BENCH_STREAM_LEN && (!paced || st.lost == 0), name);
+}
+
+// A sensor writing its characteristic every ms, a new value every
+// 'period' writes, with the given write-combining window
+static void _shadowBench(const char *name, uint16_t window, uint16_t period, ble_charact_t *bc)
+{
+  bench_stat_t st = {.name = name};
+  uint8_t value[BENCH_CHARACTS] = {0};
+  uint64_t start = rn487x_sim_micros();
+  bench_mark_t from;
+
+  rn487x_shadowConfig(window);
+  from = _now();
+  for (uint16_t k = 0; k < BENCH_SENSOR_WRITES; k++)
+  {
+    value[0] = k / period;
+    value[1] = (k / period) >> 8;
+    _begin();
+    _end(&st, rn487x_writeLocalCharact(bc, value));
+    while (rn487x_sim_micros() < start + 1000ULL * (k + 1))
+    {
+      rn487x_process();
+    }
+  }
+  st.failures += rn487x_shadowFlush() ? 0 : 1;
+  bench_mark_t to = _now();
+  printf("%-28s %8u %8u %8u %12.3f %12.3f\n", st.name, st.calls, to.sim.commands - from.sim.commands,
+         to.sim.txBytes - from.sim.txBytes, (double)st.totalUs / 1000.0, (double)st.maxUs / 1000.0);
+  _check(st.failures == 0 && rn487x_readLocalCharact(bc, value) == 1 &&
+             value[0] == (uint8_t)((BENCH_SENSOR_WRITES - 1) / period),
+         st.name);
+  rn487x_shadowConfig(0);
+}
+
+// Client role against the scripted peer: discovery, then every remote
+// characteristic read one by one and pipelined, and written
+static void _clientBench(void)
+{
+  bench_stat_t discover = {.name = "rn487x_discoverRemote"};
+  bench_stat_t readOne = {.name = "read all (one by one)"};
+  bench_stat_t readMany = {.name = "read all (pipelined)"};
+  bench_stat_t write = {.name = "rn487x_writeRemoteCharact"};
+  static char uuids[BENCH_CHARACTS][PRIVATE_SERVICE_LEN + 1];
+  uint8_t values[BENCH_CHARACTS][PEER_VALUE_LEN];
+  uint16_t handles[BENCH_CHARACTS];
+  rn487x_remote_read_t reads[BENCH_CHARACTS];
+
+  rn487x_sim_peerReset();
+  rn487x_sim_peerAddService(PEER_SERVICE_UUID);
+  for (uint8_t i = 0; i < BENCH_CHARACTS; i++)
+  {
+    snprintf(uuids[i], sizeof(uuids[i]), PEER_UUID_FMT, i);
+    for (uint8_t k = 0; k < PEER_VALUE_LEN; k++)
+    {
+      values[i][k] = 16 * i + k;
+    }
+    handles[i] = rn487x_sim_peerAddCharact(uuids[i], BLE_PROPERTY_READ | BLE_PROPERTY_WRITE, values[i],
+                                           PEER_VALUE_LEN);
+    reads[i].uuid = uuids[i];
+    reads[i].value = values[i];
+    reads[i].size = PEER_VALUE_LEN;
+  }
+
+  _begin();
+  _end(&discover, rn487x_discoverRemote() && rn487x_remoteHandle(uuids[BENCH_CHARACTS - 1]) == handles[BENCH_CHARACTS - 1]);
+  for (uint8_t r = 0; r < BENCH_ROUNDS; r++)
+  {
+    bool ok = true;
+    _begin();
+    for (uint8_t i = 0; i < BENCH_CHARACTS; i++)
+    {
+      ok = ok && rn487x_readRemoteCharact(uuids[i], values[i], PEER_VALUE_LEN) == PEER_VALUE_LEN &&
+           values[i][0] == 16 * i;
+    }
+    _end(&readOne, ok);
+    memset(values, 0, sizeof(values));
+    _begin();
+    _end(&readMany, rn487x_readRemoteCharacts(reads, BENCH_CHARACTS) == BENCH_CHARACTS &&
+                        values[BENCH_CHARACTS - 1][0] == 16 * (BENCH_CHARACTS - 1));
+  }
+  for (uint8_t i = 0; i < BENCH_CHARACTS; i++)
+  {
+    uint8_t back[PEER_VALUE_LEN];
+    uint8_t len = 0;
+    values[i][0] = 0xC0 | i;
+    _begin();
+    _end(&write, rn487x_writeRemoteCharact(uuids[i], values[i], PEER_VALUE_LEN) &&
+                     rn487x_sim_peerValue(handles[i], back, &len) && back[0] == (0xC0 | i));
+  }
+  _report(&discover);
+  _report(&readOne);
+  _report(&readMany);
+  _report(&write);
+}
+
+// SCAN_DEVICES beacons advertising in turn, each one changing its
+// payload every 4 rounds; the driver keeps the new ones only
+static void _scanBench(void)
+{
+  rn487x_scan_stats_t st;
+  rn487x_scan_report_t report;
+  uint8_t address[6] = {0x00, 0x1E, 0xC0, 0x00, 0x00, 0x00};
+  uint8_t data[] = {0x02, 0x01, 0x06, 0x05, 0xFF, 0xCD, 0x00, 0x00, 0x00};
+  uint32_t results = 0;
+  uint32_t latest = 0;
+  uint64_t start;
+  bool ok;
+
+  ok = rn487x_startScan(0, 0);
+  start = rn487x_sim_micros();
+  for (uint16_t k = 0; k < SCAN_REPORTS; k++)
+  {
+    address[5] = k % SCAN_DEVICES;
+    data[7] = address[5];
+    data[8] = k / SCAN_DEVICES / 4;
+    rn487x_sim_advertise(address, 0, -40 - (k % 30), data, sizeof(data));
+    while (rn487x_sim_micros() < start + 1000000ULL * (k + 1) / SCAN_RATE)
+    {
+      rn487x_process();
+    }
+    // Read slower than reports come in, the ring keeps the latest
+    if (k % 8 == 0)
+    {
+      results += rn487x_scanRead(&report) ? 1 : 0;
+    }
+  }
+  ok = rn487x_stopScan() && ok;
+  while (rn487x_scanRead(&report))
+  {
+    results++;
+    latest = report.data[8];
+  }
+  rn487x_scanStats(&st);
+  ok = ok && latest == (SCAN_REPORTS - 1) / SCAN_DEVICES / 4;
+  printf("%-28s %8u %8u %8u %8u %8u %8s\n", "rn487x_startScan", st.reports, st.duplicates, st.overwritten,
+         st.invalid, results, ok ? "ok" : "FAIL");
+  // Each advertiser changes its payload every 4 of its reports
+  _check(ok && st.reports == SCAN_REPORTS && st.invalid == 0 &&
+             st.duplicates == SCAN_REPORTS - SCAN_REPORTS / 4,
+         "rn487x_startScan");
+}
+
+// Asset tag frames: iBeacon, Eddystone-UID and Eddystone-TLM, each one
+// behind the flags
+static const uint8_t _beacon_frames[][31] = {
+    {0x02, 0x01, 0x06, 0x1A, 0xFF, 0x4C, 0x00, 0x02, 0x15, 0xAD, 0x11, 0xCF, 0x40, 0x06, 0x3F, 0x11,
+     0xE5, 0xBE, 0x3E, 0x00, 0x02, 0xA5, 0xD5, 0xC5, 0x1B, 0x00, 0x01, 0x00, 0x02, 0xC5},
+    {0x02, 0x01, 0x06, 0x03, 0x03, 0xAA, 0xFE, 0x17, 0x16, 0xAA, 0xFE, 0x00, 0xE7, 0xAD, 0x11,
+     0xCF, 0x40, 0x06, 0x3F, 0x11, 0xE5, 0xBE, 0x3E, 0x00, 0x1E, 0xC0, 0x12, 0x34, 0x56, 0x00, 0x00},
+    {0x02, 0x01, 0x06, 0x03, 0x03, 0xAA, 0xFE, 0x11, 0x16, 0xAA, 0xFE, 0x20, 0x00, 0x0B, 0xB8,
+     0x17, 0x00, 0x00, 0x00, 0x04, 0xD2, 0x00, 0x00, 0x30, 0x39},
+};
+static const uint8_t _beacon_sizes[] = {30, 31, 25};
+#define BEACON_FRAMES (sizeof(_beacon_sizes) / sizeof(_beacon_sizes[0]))
+
+// Frame on air in the module, the one put on air by rotation k
+static bool _beaconOnAir(uint32_t k)
+{
+  uint8_t air[31];
+  uint8_t len = rn487x_sim_beacon(air);
+  const uint8_t *frame = _beacon_frames[k % BEACON_FRAMES];
+  return len == _beacon_sizes[k % BEACON_FRAMES] && memcmp(air, frame, len) == 0;
+}
+
+// Rotation by the application, each frame encoded again and put on air
+// with blocking calls
+static void _beaconBlocking(void)
+{
+  uint32_t failures = 0;
+  uint32_t rotations = 0;
+  uint64_t blockedUs = 0;
+  uint64_t maxUs = 0;
+  rn487x_sim_stats_t from, to;
+  uint64_t start = rn487x_sim_micros();
+
+  rn487x_sim_getStats(&from);
+  for (uint64_t t = 0; t < BEACON_RUN_MS * 1000ULL; t += BEACON_DWELL_MS * 1000ULL, rotations++)
+  {
+    const uint8_t *frame = _beacon_frames[rotations % BEACON_FRAMES];
+    uint64_t t0 = rn487x_sim_micros();
+    bool ok = rn487x_clearImmediateBeacon();
+    for (uint8_t i = 0; i < _beacon_sizes[rotations % BEACON_FRAMES]; i += 1 + frame[i])
+    {
+      ok = rn487x_startImmediateBeacon(frame[i + 1], &frame[i + 2], frame[i] - 1) && ok;
+    }
+    uint64_t us = rn487x_sim_micros() - t0;
+    blockedUs += us;
+    maxUs = (us > maxUs) ? us : maxUs;
+    failures += (ok && _beaconOnAir(rotations)) ? 0 : 1;
+    if (rn487x_sim_micros() < start + t + BEACON_DWELL_MS * 1000ULL)
+    {
+      rn487x_sim_advance(start + t + BEACON_DWELL_MS * 1000ULL - rn487x_sim_micros());
+    }
+  }
+  rn487x_sim_getStats(&to);
+  printf("%-28s %8u %6u %8u %10.3f %10.3f\n", "re-encoded, blocking", rotations, failures,
+         (to.txBytes - from.txBytes) / rotations, (double)blockedUs / rotations / 1000.0, (double)maxUs / 1000.0);
+  _check(failures == 0, "beacon re-encoded, blocking");
+}
+
+// Rotation by the driver from the main loop, frames encoded once
+static void _beaconScheduled(void)
+{
+  rn487x_beacon_stats_t st;
+  uint32_t checked = 0;
+  uint32_t failures = 0;
+  uint64_t start = rn487x_sim_micros();
+  bool ok = true;
+
+  for (uint8_t k = 0; k < BEACON_FRAMES; k++)
+  {
+    ok = rn487x_beaconSlot(k, _beacon_frames[k], _beacon_sizes[k], BEACON_DWELL_MS) && ok;
+  }
+  ok = rn487x_startBeaconRotation() && ok;
+  for (uint64_t t = 0; t < BEACON_RUN_MS * 1000ULL; t += BEACON_TICK_US)
+  {
+    rn487x_process();
+    rn487x_beaconStats(&st);
+    if (st.rotations > checked)
+    {
+      failures += _beaconOnAir(checked) ? 0 : 1;
+      checked = st.rotations;
+    }
+    if (rn487x_sim_micros() < start + t + BEACON_TICK_US)
+    {
+      rn487x_sim_advance(start + t + BEACON_TICK_US - rn487x_sim_micros());
+    }
+  }
+  rn487x_stopBeaconRotation();
+  while (!rn487x_isIdle())
+  {
+    rn487x_process();
+  }
+  rn487x_beaconStats(&st);
+  for (uint8_t k = 0; k < BEACON_FRAMES; k++)
+  {
+    rn487x_beaconSlot(k, NULL, 0, 0);
+  }
+  uint32_t n = st.rotations ? st.rotations : 1;
+  printf("%-28s %8u %6u %8u %10.3f %10.3f\n", "encoded once, scheduled", st.rotations,
+         st.failures + failures + (ok ? 0 : 1), st.txBytes / n, (double)st.cpuUs / n / 1000.0,
+         (double)st.cpuMaxUs / 1000.0);
+  _check(ok && st.failures == 0 && failures == 0 && st.rotations == BEACON_RUN_MS / BEACON_DWELL_MS,
+         "beacon encoded once, scheduled");
+}
+
+// Switches the link, then measures an SHW round trip and the stream.
+// Without linkOk, the switch is expected to fall back to the old rate.
+static void _baudBench(uint32_t baudrate, bool flowControl, bool linkOk, ble_charact_t *bc)
+{
+  bench_stat_t sw = {0};
+  bench_stat_t shw = {0};
+  stream_stat_t st;
+  uint8_t value[BENCH_CHARACTS] = {0};
+  char name[32];
+
+  rn487x_cmdMode();
+  _begin();
+  _end(&sw, rn487x_setBaudrate(baudrate, flowControl));
+  for (uint8_t r = 0; r < BENCH_ROUNDS; r++)
+  {
+    value[0] = r;
+    _begin();
+    _end(&shw, rn487x_writeLocalCharact(bc, value));
+  }
+  // The reboot dropped the central
+  rn487x_sim_connect();
+  while (!rn487x_isConnected())
+  {
+    rn487x_process();
+  }
+  rn487x_streamConfig(RN487X_STREAM_CHUNK, flowControl ? 0 : RN487X_STREAM_RATE);
+  rn487x_dataMode();
+  st = _streamRun(true);
+  snprintf(name, sizeof(name), "%u%s", baudrate, flowControl ? " + RTS/CTS" : "");
+  printf("%-28s %8s %12.3f %12.3f %12.0f %10u\n", name, sw.failures ? "fallback" : "ok",
+         (double)sw.totalUs / 1000.0, (double)shw.totalUs / shw.calls / 1000.0, st.rate, st.lost);
+  _check((sw.failures == 0) == linkOk && shw.failures == 0 && st.lost == 0 && st.bytes == BENCH_STREAM_LEN,
+         name);
+  _check(sw.totalUs <= (uint64_t)BAUD_SWITCH_MAX_MS * 1000, "rate switch within BAUD_SWITCH_MAX_MS");
+}
+
+// Blocking SHW on a noisy UART, the same faults for every policy
+static void _faultBench(const char *name, uint8_t retries, ble_charact_t *bc)
+{
+  rn487x_sim_faults_t faults = {FAULT_LOST, FAULT_SLOW, FAULT_SLOW_US, 0x2545F491};
+  rn487x_sim_stats_t simStats;
+  uint8_t value[BENCH_CHARACTS] = {0};
+  uint32_t failures = 0;
+  uint64_t worstUs = 0;
+  uint64_t start = rn487x_sim_micros();
+
+  rn487x_retryConfig(retries, RN487X_TIMEOUT_MIN_MS);
+  rn487x_sim_setFaults(&faults);
+  rn487x_sim_resetStats();
+  for (uint16_t k = 0; k < FAULT_WRITES; k++)
+  {
+    uint64_t t0 = rn487x_sim_micros();
+    value[0] = k;
+    value[1] = k >> 8;
+    failures += rn487x_writeLocalCharact(bc, value) ? 0 : 1;
+    uint64_t us = rn487x_sim_micros() - t0;
+    worstUs = (us > worstUs) ? us : worstUs;
+    rn487x_sim_advance(1000);
+  }
+  rn487x_sim_getStats(&simStats);
+  faults.lostPermille = 0;
+  faults.slowPermille = 0;
+  rn487x_sim_setFaults(&faults);
+  rn487x_retryConfig(RN487X_RETRIES, RN487X_TIMEOUT_MIN_MS);
+
+  printf("%-28s %6u %6u %6u %8u %10.1f %10.3f %10u\n", name, FAULT_WRITES, failures,
+         simStats.commands - FAULT_WRITES, simStats.lostReplies, (double)worstUs / 1000.0,
+         (double)(rn487x_sim_micros() - start) / 1e6, rn487x_adaptiveTimeout(RN487X_METRIC_SHW));
+  // Without resends, exactly the writes whose reply was lost fail
+  _check(failures == (retries ? 0 : simStats.lostReplies), name);
+}
+
+// Runs a command to completion
+static rn487x_status_t _runCmd(rn487x_cmd_t *cmd)
+{
+  if (!rn487x_submit(cmd))
+  {
+    return RN487X_CMD_ERR;
+  }
+  while (!rn487x_cmdDone(cmd))
+  {
+    rn487x_process();
+  }
+  return cmd->status;
+}
+
+// Value replies late past the adaptive timeout, resends on: every SHR
+// must return the value just written, and no reply may land on the next
+// command. SHR goes through the engine, rn487x_readLocalCharact would
+// answer from the shadow.
+static void _lateReadBench(ble_charact_t *bc)
+{
+  rn487x_sim_faults_t faults = {0, LATE_READ_SLOW, LATE_READ_US, 0x2545F491};
+  rn487x_cmd_t write;
+  rn487x_cmd_t read;
+  char shr[RN487X_CMD_LEN];
+  char resp[2 * BENCH_CHARACTS + 1];
+  char hex[2 * BENCH_CHARACTS + 1];
+  uint8_t value[BENCH_CHARACTS] = {0};
+  uint32_t failures = 0;
+
+  rn487x_prepareWriteLocalCharact(&write, bc, value);
+  snprintf(shr, sizeof(shr), "SHR,%.4s", &write.text[4]); // handle of the SHW
+  rn487x_sim_setFaults(&faults);
+  for (uint16_t k = 0; k < LATE_READS; k++)
+  {
+    value[0] = k;
+    value[1] = k >> 8;
+    rn487x_hexEncode(value, bc->length, hex);
+    hex[2 * bc->length] = 0;
+    rn487x_prepareWriteLocalCharact(&write, bc, value);
+    rn487x_cmdPrepare(&read, shr, NULL, DEFAULT_CMD_TIMEOUT);
+    read.resp = resp;
+    read.respSize = sizeof(resp);
+    if (_runCmd(&write) != RN487X_CMD_OK || _runCmd(&read) != RN487X_CMD_OK || strcmp(resp, hex) != 0)
+    {
+      failures++;
+    }
+  }
+  faults.slowPermille = 0;
+  rn487x_sim_setFaults(&faults);
+  printf("%-28s %6u %6u\n", "late SHR, resends on", LATE_READS, failures);
+  _check(failures == 0, "late value replies");
+}
+
+// A value written while the combined SHW is in flight, by the
+// application or by a central, is the one the module ends up with: the
+// completion of the combined SHW must not mark its value as held
+static void _shadowRaceBench(ble_charact_t *bc)
+{
+  rn487x_sim_stats_t stats;
+  rn487x_cmd_t direct;
+  uint8_t value[BENCH_CHARACTS] = {0};
+  uint8_t readBack[BENCH_CHARACTS];
+  uint32_t failures = 0;
+
+  rn487x_shadowConfig(SHADOW_RACE_WINDOW);
+  for (uint8_t remote = 0; remote < 2; remote++)
+  {
+    value[0] = 0x11;
+    rn487x_writeLocalCharact(bc, value);
+    rn487x_sim_getStats(&stats);
+    uint32_t commands = stats.commands;
+    while (stats.commands == commands)
+    {
+      rn487x_sim_advance(100);
+      rn487x_process();
+      rn487x_sim_getStats(&stats);
+    }
+    value[0] = 0x22;
+    if (remote)
+    {
+      rn487x_sim_remoteWrite(_nvm.handles[bc->index], value, bc->length);
+    }
+    else
+    {
+      rn487x_prepareWriteLocalCharact(&direct, bc, value);
+      failures += (_runCmd(&direct) == RN487X_CMD_OK) ? 0 : 1;
+    }
+    failures += rn487x_shadowFlush() ? 0 : 1;
+    rn487x_sim_advance(5000);
+    rn487x_process();
+    if (rn487x_readLocalCharact(bc, readBack) != 1 || readBack[0] != 0x22)
+    {
+      failures++;
+    }
+    value[0] = 0x33;
+    if (!rn487x_writeLocalCharact(bc, value) || !rn487x_shadowFlush() ||
+        rn487x_readLocalCharact(bc, readBack) != 1 || readBack[0] != 0x33)
+    {
+      failures++;
+    }
+  }
+  rn487x_shadowConfig(0);
+  printf("%-28s %8u %8u\n", "written behind the SHW", 2, failures);
+  _check(failures == 0, "shadow value written in flight");
+}
+
+// Sensor node on a low power module: two SHW per period, submitted
+// without waiting, while the main loop ticks
+static void _powerBench(const char *name, uint16_t idleMs, uint16_t holdMs, ble_charact_t *bc)
+{
+  rn487x_cmd_t cmds[2];
+  uint8_t value[BENCH_CHARACTS] = {0};
+  rn487x_power_stats_t from, to;
+  rn487x_sim_stats_t simFrom, simTo;
+  uint32_t failures = 0;
+  uint64_t start;
+
+  cmds[0].status = RN487X_CMD_OK;
+  cmds[1].status = RN487X_CMD_OK;
+  rn487x_powerConfig(idleMs, holdMs);
+  rn487x_powerStats(&from);
+  rn487x_sim_getStats(&simFrom);
+  start = rn487x_sim_micros();
+  for (uint32_t t = 0; t < POWER_RUN_MS * 1000; t += POWER_TICK_US)
+  {
+    uint32_t phase = t % (POWER_PERIOD_MS * 1000);
+    for (uint8_t k = 0; k < 2; k++)
+    {
+      if (phase != k * POWER_SPACING_MS * 1000)
+      {
+        continue;
+      }
+      if (!rn487x_cmdDone(&cmds[k]) || cmds[k].status != RN487X_CMD_OK)
+      {
+        failures++;
+        continue;
+      }
+      value[0] = t / (POWER_PERIOD_MS * 1000);
+      rn487x_prepareWriteLocalCharact(&cmds[k], &bc[k], value);
+      rn487x_submit(&cmds[k]);
+    }
+    rn487x_process();
+    // The loop sleeps until its next tick
+    if (rn487x_sim_micros() < start + t + POWER_TICK_US)
+    {
+      rn487x_sim_advance(start + t + POWER_TICK_US - rn487x_sim_micros());
+    }
+  }
+  while (!rn487x_cmdDone(&cmds[0]) || !rn487x_cmdDone(&cmds[1]))
+  {
+    rn487x_process();
+  }
+  rn487x_powerStats(&to);
+  rn487x_sim_getStats(&simTo);
+  rn487x_powerConfig(0, 0);
+  rn487x_hwWakeUp();
+
+  uint32_t wakeups = to.wakeups - from.wakeups;
+  printf("%-28s %8u %8.1f %10u %10u %10u %10u %6u\n", name, wakeups,
+         (double)(to.commands - from.commands) / (wakeups ? wakeups : 1),
+         to.ms[RN487X_POWER_AWAKE] - from.ms[RN487X_POWER_AWAKE],
+         to.ms[RN487X_POWER_WAKING] - from.ms[RN487X_POWER_WAKING],
+         to.ms[RN487X_POWER_SLEEP] - from.ms[RN487X_POWER_SLEEP],
+         (uint32_t)((simTo.sleepUs - simFrom.sleepUs) / 1000), failures + simTo.sleepLost - simFrom.sleepLost);
+  _check(failures == 0 && simTo.sleepLost == simFrom.sleepLost && (idleMs == 0) == (wakeups == 0), name);
+}
+
+#ifdef RN487X_METRICS
+// Command metrics of the default instance over the whole run
+static void _metricsPrint(void)
+{
+  static const char *const names[RN487X_METRIC_CLASSES] = {"PS", "PC", "SHW", "SHR", "LS", "$$$", "R,1", "other"};
+  rn487x_metrics_t snap;
+  rn487x_metrics(&snap);
+  printf("\n%-28s %6s %6s %6s %6s %8s %8s  %s\n", "metrics", "calls", "t/o", "err", "resent", "avg [ms]", "max [ms]",
+         "histogram 0-1 2-3 4-7 .. ms");
+  for (uint8_t c = 0; c < RN487X_METRIC_CLASSES; c++)
+  {
+    rn487x_metric_t *m = &snap.classes[c];
+    uint32_t replies = m->calls - m->timeouts;
+    printf("%-28s %6u %6u %6u %6u %8.2f %8u ", names[c], m->calls, m->timeouts, m->errors, m->retries,
+           (double)m->totalMs / (replies ? replies : 1), m->maxMs);
+    for (uint8_t b = 0; b < RN487X_METRIC_BUCKETS; b++)
+    {
+      printf(" %5u", m->histogram[b]);
+    }
+    printf("\n");
+  }
+  printf("%-28s %zu\n", "metrics RAM [B]", sizeof(rn487x_metrics_t));
+}
+#endif
+
+#ifdef RN487X_TRACE
+// Last trace records of the default instance, in the dump format of
+// rn487x_trace.h, for host/rn487x_tracedump.c
+static void _traceDump(const char *path)
+{
+  rn487x_trace_rec_t recs[RN487X_TRACE_LEN];
+  uint16_t n = rn487x_traceRead(recs, RN487X_TRACE_LEN);
+  FILE *out = fopen(path, "wb");
+  if (out == NULL)
+  {
+    perror(path);
+    return;
+  }
+  for (uint16_t i = 0; i < n; i++)
+  {
+    uint8_t raw[RN487X_TRACE_REC_SIZE] = {
+        recs[i].us, recs[i].us >> 8, recs[i].us >> 16, recs[i].us >> 24, recs[i].id, recs[i].a,
+        recs[i].b, recs[i].b >> 8, recs[i].c, recs[i].c >> 8, recs[i].c >> 16, recs[i].c >> 24};
+    fwrite(raw, 1, sizeof(raw), out);
+  }
+  fclose(out);
+  printf("\n%-28s %8u records, %u overwritten, dumped to %s\n", "trace", n, rn487x_traceLost(), path);
+}
+#endif
+
+// Interrupt handlers of the simulated UARTs, arg is the driver instance
+#ifdef RN487X_RX_ISR
+static void _rxIsr(uint8_t c, void *arg)
+{
+  rn487x_dev_rxFeed(arg, c);
+}
+#endif
+
+#ifdef RN487X_TX_DMA
+static void _txDmaIsr(void *arg)
+{
+  rn487x_dev_txDmaDone(arg);
+}
+#endif
+
+// Radios on simulated modules 1 to BENCH_RADIOS, the io arg is the module
+static int _radioAvailable(void *arg)
+{
+  rn487x_sim_select((uintptr_t)arg);
+  return uart1_available();
+}
+
+static int _radioRead(void *arg)
+{
+  rn487x_sim_select((uintptr_t)arg);
+  return uart1_read();
+}
+
+static void _radioWrite(void *arg, uint8_t c)
+{
+  rn487x_sim_select((uintptr_t)arg);
+  uart1_write(c);
+}
+
+static void _radioDmaStart(void *arg, const uint8_t *buf, uint16_t len)
+{
+  rn487x_sim_select((uintptr_t)arg);
+  uart1_dma_start(buf, len);
+}
+
+static void _radioSetBaudrate(void *arg, uint32_t baudrate)
+{
+  rn487x_sim_select((uintptr_t)arg);
+  uart1_set_baudrate(baudrate);
+}
+
+static void _radioSetFlowControl(void *arg, bool enable)
+{
+  rn487x_sim_select((uintptr_t)arg);
+  uart1_set_flow_control(enable);
+}
+
+static void _radioSetReset(void *arg, bool level)
+{
+  rn487x_sim_select((uintptr_t)arg);
+  if (level)
+  {
+    gpio_set(RN487X_RESET_PIN);
+  }
+  else
+  {
+    gpio_reset(RN487X_RESET_PIN);
+  }
+}
+
+// One schema per radio, each with its own characteristic handles
+static ble_charact_t _radio_characts[BENCH_RADIOS][2];
+static const rn487x_charact_def_t _radio_characts_def[BENCH_RADIOS][2] = {
+    {{SCHEMA_UUID("00"), SCHEMA_RW, 4, &_radio_characts[0][0]}, {SCHEMA_UUID("01"), SCHEMA_RW, 4, &_radio_characts[0][1]}},
+    {{SCHEMA_UUID("00"), SCHEMA_RW, 4, &_radio_characts[1][0]}, {SCHEMA_UUID("01"), SCHEMA_RW, 4, &_radio_characts[1][1]}},
+    {{SCHEMA_UUID("00"), SCHEMA_RW, 4, &_radio_characts[2][0]}, {SCHEMA_UUID("01"), SCHEMA_RW, 4, &_radio_characts[2][1]}},
+};
+
+// Several modules driven from one loop: SHW rounds radio after radio
+// with the blocking call, then submitted to every radio and processed
+// together while the modules answer in parallel
+static void _radioBench(void)
+{
+  static rn487x_t radios[BENCH_RADIOS];
+  rn487x_cmd_t cmds[BENCH_RADIOS];
+  uint8_t value[4] = {0};
+  uint8_t sel = rn487x_sim_selected();
+  uint64_t start, serialUs, concurrentUs;
+  uint32_t failures = 0;
+  uint32_t concurrentFailures = 0;
+
+  for (uintptr_t k = 0; k < BENCH_RADIOS; k++)
+  {
+    rn487x_io_t io = {
+        .available = _radioAvailable,
+        .read = _radioRead,
+        .write = _radioWrite,
+        .dmaStart = _radioDmaStart,
+        .setBaudrate = _radioSetBaudrate,
+        .setFlowControl = _radioSetFlowControl,
+        .setReset = _radioSetReset,
+        .arg = (void *)(k + 1),
+    };
+    rn487x_dev_setup(&radios[k], &io);
+    rn487x_sim_select(k + 1);
+#ifdef RN487X_RX_ISR
+    rn487x_sim_attachRxIsr(_rxIsr, &radios[k]);
+#endif
+#ifdef RN487X_TX_DMA
+    rn487x_sim_attachTxDmaIsr(_txDmaIsr, &radios[k]);
+#endif
+    if (!rn487x_dev_init(&radios[k]) || !rn487x_dev_cmdMode(&radios[k]) ||
+        rn487x_dev_applySchema(&radios[k], &(rn487x_service_def_t){SERVICE_UUID, _radio_characts_def[k], 2}, 1) < 0 ||
+        !rn487x_dev_cmdMode(&radios[k]))
+    {
+      failures++;
+    }
+  }
+
+  start = rn487x_sim_micros();
+  for (uint8_t r = 0; r < BENCH_ROUNDS; r++)
+  {
+    value[0] = r;
+    for (uint8_t k = 0; k < BENCH_RADIOS; k++)
+    {
+      failures += rn487x_dev_writeLocalCharact(&radios[k], &_radio_characts[k][r & 1], value) ? 0 : 1;
+    }
+  }
+  serialUs = rn487x_sim_micros() - start;
+
+  start = rn487x_sim_micros();
+  for (uint8_t r = 0; r < BENCH_ROUNDS; r++)
+  {
+    bool busy = true;
+    value[0] = 0x80 | r;
+    for (uint8_t k = 0; k < BENCH_RADIOS; k++)
+    {
+      rn487x_dev_prepareWriteLocalCharact(&radios[k], &cmds[k], &_radio_characts[k][r & 1], value);
+      rn487x_dev_submit(&radios[k], &cmds[k]);
+    }
+    while (busy)
+    {
+      busy = false;
+      for (uint8_t k = 0; k < BENCH_RADIOS; k++)
+      {
+        rn487x_dev_process(&radios[k]);
+        busy = busy || !rn487x_cmdDone(&cmds[k]);
+      }
+    }
+    for (uint8_t k = 0; k < BENCH_RADIOS; k++)
+    {
+      concurrentFailures += (cmds[k].status == RN487X_CMD_OK) ? 0 : 1;
+    }
+  }
+  concurrentUs = rn487x_sim_micros() - start;
+  rn487x_sim_select(sel);
+
+  printf("%-28s %12.3f %6u\n", "one radio at a time", (double)serialUs / BENCH_ROUNDS / 1000.0, failures);
+  printf("%-28s %12.3f %6u\n", "all radios together", (double)concurrentUs / BENCH_ROUNDS / 1000.0,
+         concurrentFailures);
+  _check(failures == 0 && concurrentFailures == 0, "radios");
+}
+
+int main(int argc, char **argv)
+{
+  rn487x_sim_config_t cfg;
+  bench_stat_t initFixed = {.name = "cold init (fixed delays)"};
+  bench_stat_t init = {.name = "rn487x_init"};
+  bench_stat_t cmdMode = {.name = "rn487x_cmdMode"};
+  bench_stat_t setService = {.name = "rn487x_setServiceUUID"};
+  bench_stat_t setCharact = {.name = "rn487x_setCharactUUID"};
+  bench_stat_t build = {.name = "rn487x_buildCharacts"};
+  bench_stat_t buildMiss = {.name = "buildCharacts (cache miss)"};
+  bench_stat_t buildHit = {.name = "buildCharacts (cache hit)"};
+  bench_stat_t write = {.name = "rn487x_writeLocalCharact"};
+  bench_stat_t read = {.name = "rn487x_readLocalCharact"};
+  bench_stat_t schemaProgram = {.name = "applySchema (reprogram)"};
+  bench_stat_t schemaList = {.name = "applySchema (LS match)"};
+  bench_stat_t schemaCache = {.name = "applySchema (cache match)"};
+  bench_stat_t submit = {.name = "rn487x_submit (SHW, CPU)"};
+  bench_stat_t cycle = {.name = "update all (one by one)"};
+  bench_stat_t cycleBatch = {.name = "update all (batch)"};
+  bench_stat_t cycleSame = {.name = "update all (batch, same)"};
+  rn487x_charact_write_t batch[BENCH_CHARACTS];
+  uint8_t values[BENCH_CHARACTS][BENCH_CHARACTS] = {{0}};
+  bench_stat_t provision = {.name = "provision (blocking)"};
+  bench_stat_t provisionPipe = {.name = "provision (rn487x_pipeline)"};
+  rn487x_cmd_t pipe[1 + BENCH_CHARACTS];
+  bench_mark_t from;
+  bool ok;
+  ble_charact_t characts[BENCH_CHARACTS];
+  uint8_t value[BENCH_CHARACTS] = {0};
+  uint8_t readBack[BENCH_CHARACTS] = {0};
+  char uuid[PRIVATE_SERVICE_LEN + 1];
+
+  rn487x_sim_defaultConfig(&cfg);
+  rn487x_sim_init(&cfg);
+#ifdef RN487X_RX_ISR
+  rn487x_sim_attachRxIsr(_rxIsr, rn487x_defaultDevice());
+#endif
+#ifdef RN487X_TX_DMA
+  rn487x_sim_attachTxDmaIsr(_txDmaIsr, rn487x_defaultDevice());
+#endif
+
+  _begin();
+  _end(&initFixed, _fixedDelayInit());
+  _begin();
+  _end(&init, rn487x_init());
+
+  // Provision one private service, one command at a time
+  _begin();
+  _end(&cmdMode, rn487x_cmdMode());
+  rn487x_clearAllServices();
+  from = _now();
+  _begin();
+  _end(&setService, ok = rn487x_setServiceUUID(SERVICE_UUID));
+  for (uint8_t i = 0; i < BENCH_CHARACTS; i++)
+  {
+    bool res;
+    snprintf(uuid, sizeof(uuid), CHARACT_UUID_FMT, i);
+    _begin();
+    _end(&setCharact, res = rn487x_setCharactUUID(&characts[i], uuid,
+                                                  BLE_PROPERTY_READ | BLE_PROPERTY_WRITE,
+                                                  sizeof(value)));
+    ok = ok && res;
+  }
+  _endFrom(&provision, ok, &from);
+
+  // Same service, pipelined
+  rn487x_clearAllServices();
+  _begin();
+  ok = rn487x_prepareServiceUUID(&pipe[0], SERVICE_UUID);
+  for (uint8_t i = 0; i < BENCH_CHARACTS; i++)
+  {
+    snprintf(uuid, sizeof(uuid), CHARACT_UUID_FMT, i);
+    ok = ok && rn487x_prepareCharactUUID(&pipe[1 + i], &characts[i], uuid,
+                                         BLE_PROPERTY_READ | BLE_PROPERTY_WRITE,
+                                         sizeof(value));
+  }
+  _end(&provisionPipe, ok && rn487x_pipeline(pipe, 1 + BENCH_CHARACTS) == 1 + BENCH_CHARACTS);
+
+  // A command the engine refuses fails, the others of the pipeline run
+  rn487x_cmdPrepare(&pipe[0], "", NULL, DEFAULT_CMD_TIMEOUT);
+  rn487x_cmdPrepare(&pipe[1], "V", "RN487", DEFAULT_CMD_TIMEOUT);
+  _check(rn487x_pipeline(pipe, 2) == 1 && pipe[0].status == RN487X_CMD_ERR && pipe[1].status == RN487X_CMD_OK,
+         "rn487x_pipeline (refused command)");
+  rn487x_reboot();
+
+  _begin();
+  _end(&cmdMode, rn487x_cmdMode());
+  _begin();
+  _end(&build, rn487x_buildCharacts());
+
+  // Same listing with the handle cache: the first boot saves it, the
+  // next ones skip LS while the definitions hash matches
+  rn487x_setHandleCache(_nvmLoad, _nvmStore, NULL);
+  _begin();
+  _end(&buildMiss, rn487x_buildCharacts() && _nvm_valid);
+  _begin();
+  _end(&buildHit, rn487x_buildCharacts());
+
+  for (uint8_t r = 0; r < BENCH_ROUNDS; r++)
+  {
+    for (uint8_t i = 0; i < BENCH_CHARACTS; i++)
+    {
+      value[0] = r;
+      value[1] = i;
+      _begin();
+      _end(&write, rn487x_writeLocalCharact(&characts[i], value));
+      _begin();
+      _end(&read, rn487x_readLocalCharact(&characts[i], readBack) == 1 &&
+                      readBack[0] == r && readBack[1] == i);
+    }
+  }
+
+  // Sensor cycle updating every characteristic, one call each, then
+  // as a batch, then as a batch of the values already written
+  for (uint8_t i = 0; i < BENCH_CHARACTS; i++)
+  {
+    batch[i].charact = &characts[i];
+    batch[i].value = values[i];
+  }
+  for (uint8_t r = 0; r < 2 * BENCH_ROUNDS; r++)
+  {
+    bool batched = (r >= BENCH_ROUNDS);
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < BENCH_CHARACTS; i++)
+    {
+      values[i][0] = 0x80 | r;
+      values[i][1] = i;
+    }
+    _begin();
+    for (uint8_t i = 0; i < BENCH_CHARACTS && !batched; i++)
+    {
+      n += rn487x_writeLocalCharact(&characts[i], values[i]) ? 1 : 0;
+    }
+    n = batched ? rn487x_writeLocalCharacts(batch, BENCH_CHARACTS) : n;
+    _end(batched ? &cycleBatch : &cycle, n == BENCH_CHARACTS);
+  }
+  for (uint8_t r = 0; r < BENCH_ROUNDS; r++)
+  {
+    _begin();
+    _end(&cycleSame, rn487x_writeLocalCharacts(batch, BENCH_CHARACTS) == BENCH_CHARACTS);
+  }
+  for (uint8_t i = 0; i < BENCH_CHARACTS; i++)
+  {
+    if (rn487x_readLocalCharact(&characts[i], readBack) != 1 || readBack[1] != i ||
+        batch[i].status != RN487X_CMD_OK)
+    {
+      cycleBatch.failures++;
+    }
+  }
+
+  // A central writing a value makes the shadow copy stale
+  value[0] = 0xA5;
+  rn487x_sim_remoteWrite(_nvm.handles[characts[0].index], value, sizeof(value));
+  rn487x_sim_advance(5000);
+  rn487x_process();
+  if (rn487x_readLocalCharact(&characts[0], readBack) != 1 || readBack[0] != 0xA5)
+  {
+    read.failures++;
+  }
+
+  // CPU time to hand an SHW over to the driver
+  for (uint8_t i = 0; i < BENCH_CHARACTS; i++)
+  {
+    rn487x_cmd_t cmd;
+    rn487x_prepareWriteLocalCharact(&cmd, &characts[i], value);
+    _begin();
+    rn487x_submit(&cmd);
+    _end(&submit, true);
+    while (!rn487x_cmdDone(&cmd))
+    {
+      rn487x_process();
+    }
+    submit.failures += (cmd.status == RN487X_CMD_OK) ? 0 : 1;
+  }
+
+  // Declarative schema: differs from the module once, then matches
+  rn487x_setHandleCache(NULL, NULL, NULL);
+  _nvm_valid = false;
+  _begin();
+  _end(&schemaProgram, rn487x_applySchema(_schema, 1) == 1);
+  _begin();
+  _end(&schemaList, rn487x_applySchema(_schema, 1) == 0);
+  rn487x_setHandleCache(_nvmLoad, _nvmStore, NULL);
+  rn487x_applySchema(_schema, 1);
+  _begin();
+  _end(&schemaCache, rn487x_applySchema(_schema, 1) == 0);
+  value[0] = 0x5A;
+  if (!rn487x_writeLocalCharact(&_schema_characts[6], value) ||
+      rn487x_readLocalCharact(&_schema_characts[6], readBack) != 1 || readBack[0] != 0x5A)
+  {
+    schemaCache.failures++;
+  }
+
+  printf("%-28s %6s %6s %12s %12s %8s %8s\n", "api", "calls", "fails", "avg [ms]",
+         "max [ms]", "tx [B]", "rx [B]");
+  _report(&initFixed);
+  _report(&init);
+  _report(&cmdMode);
+  _report(&setService);
+  _report(&setCharact);
+  _report(&provision);
+  _report(&provisionPipe);
+  _report(&build);
+  _report(&buildMiss);
+  _report(&buildHit);
+  _report(&schemaProgram);
+  _report(&schemaList);
+  _report(&schemaCache);
+  _report(&write);
+  _report(&read);
+  _report(&submit);
+  _report(&cycle);
+  _report(&cycleBatch);
+  _report(&cycleSame);
+  // Cache hits and unchanged values cost no UART traffic
+  _check(buildHit.txBytes == 0 && schemaCache.txBytes == 0 && cycleSame.txBytes == 0, "cache hits");
+
+  // Shadow copy of the local values
+  printf("\n%-28s %8s %8s %8s %12s %12s\n", "sensor, 1 write/ms", "writes", "SHW", "tx [B]",
+         "blocked [ms]", "max [ms]");
+  _shadowBench("new value every write", 0, 1, &characts[0]);
+  _shadowBench("new value every 10 ms", 0, 10, &characts[0]);
+  _shadowBench("every write, 20 ms window", 20, 1, &characts[0]);
+  _shadowBench("every write, 100 ms window", 100, 1, &characts[0]);
+  _shadowRaceBench(&characts[0]);
+
+  // Asset tag beacon, three frames in turn
+  printf("\n%-28s %8s %6s %8s %10s %10s\n", "beacon, 3 frames, 100 ms", "rotations", "fails", "tx [B]",
+         "cpu [ms]", "max [ms]");
+  _beaconBlocking();
+  _beaconScheduled();
+
+  // Connected, the module reaches the services of the peer as client
+  rn487x_sim_connect();
+  while (!rn487x_isConnected())
+  {
+    rn487x_process();
+  }
+  printf("\n%-28s %6s %6s %12s %12s %8s %8s\n", "client", "calls", "fails", "avg [ms]",
+         "max [ms]", "tx [B]", "rx [B]");
+  _clientBench();
+
+  // Scan reports from nearby beacons
+  printf("\n%-28s %8s %8s %8s %8s %8s %8s\n", "scan", "reports", "dup", "lost", "invalid", "read", "latest");
+  _scanBench();
+
+  // Transparent UART data to the connected peer
+  rn487x_dataMode();
+  printf("\n%-28s %12s %12s %12s\n", "stream", "peer [B]", "peer [B/s]", "lost [B]");
+  _streamBench("rn487x_sendData", false);
+  rn487x_sim_advance(100000);
+  _streamBench("rn487x_streamWrite", true);
+
+  // Link rates: SHW round trip and paced stream (unpaced with RTS/CTS)
+  printf("\n%-28s %8s %12s %12s %12s %10s\n", "baud", "link", "switch [ms]", "SHW [ms]",
+         "peer [B/s]", "lost [B]");
+  _baudBench(115200, false, true, &characts[0]);
+  _baudBench(230400, false, true, &characts[0]);
+  _baudBench(460800, false, true, &characts[0]);
+  _baudBench(921600, false, false, &characts[0]);
+  _baudBench(921600, true, true, &characts[0]);
+  rn487x_cmdMode();
+  rn487x_setBaudrate(RN487X_DEFAULT_BAUDRATE, false);
+  rn487x_streamConfig(RN487X_STREAM_CHUNK, RN487X_STREAM_RATE);
+
+  // Low power mode, from the next boot; the sleep takes the central down
+  rn487x_sim_disconnect();
+  rn487x_setLowPower(true);
+  rn487x_reboot();
+  rn487x_cmdMode();
+  printf("\n%-28s %8s %8s %10s %10s %10s %10s %6s\n", "power, 2 SHW/100 ms", "wakeups", "cmd/wake",
+         "awake [ms]", "waking", "asleep", "module", "fails");
+  _powerBench("always awake", 0, 0, characts);
+  _powerBench("sleep after 10 ms idle", 10, 0, characts);
+  _powerBench("10 ms idle, 50 ms hold", 10, 50, characts);
+
+  // Lost and late replies: fixed timeout against adaptive timeout and resends
+  printf("\n%-28s %6s %6s %6s %8s %10s %10s %10s\n", "faults, 2% lost 2% late", "writes", "fails", "resent",
+         "lost", "worst [ms]", "total [s]", "SHW t/o");
+  _faultBench("fixed timeout, no resend", 0, &characts[0]);
+  _faultBench("adaptive timeout, resends", RN487X_RETRIES, &characts[0]);
+  _lateReadBench(&characts[0]);
+
+  // Three more modules with their own instances, one SHW each per round
+  printf("\n%-28s %12s %6s\n", "radios", "round [ms]", "fails");
+  _radioBench();
+#ifdef RN487X_METRICS
+  _metricsPrint();
+#endif
+#ifdef RN487X_TRACE
+  if (argc > 1)
+  {
+    _traceDump(argv[1]);
+  }
+#endif
+  (void)argc;
+  (void)argv;
+  printf("\n%-28s %u of %u failed\n", "checks", _checksFailed, _checks);
+  return _checksFailed ? 1 : 0;
+}
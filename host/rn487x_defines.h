@@ -0,0 +1,18 @@
+#ifndef __RN487X_DEFINES
+#define __RN487X_DEFINES
+
+// Host build configuration, same macros as the "configMacros" in eonpkg.json
+// except for RN487X_DEBUG, which is left to the command line (-DRN487X_DEBUG).
+
+#define RN487X_RESET_PIN PA8
+#define RN487X_WAKE_PIN PB14
+#define BLE_SERIAL_PRINT uart1_print
+#define BLE_SERIAL_AVAILABLE uart1_available
+#define BLE_SERIAL_READ uart1_read
+#define BLE_SERIAL_WRITE uart1_write
+#define BLE_SERIAL_DMA_START uart1_dma_start // used with RN487X_TX_DMA only
+#define BLE_SERIAL_SET_BAUDRATE uart1_set_baudrate // optional, for rn487x_setBaudrate
+#define BLE_SERIAL_SET_FLOW_CONTROL uart1_set_flow_control // optional, for rn487x_setBaudrate
+#define BLE_MAX_NUMBER_OF_CHARACTERISTICS 16
+
+#endif
@@ -0,0 +1,176 @@
+// Host microbenchmark of the hex codec (rn487x_hex.c) against the per-byte
+// helpers it replaced in rn487x.c, kept here as reference copies.
+// Figures are host cycles (TSC on x86, nanoseconds elsewhere) per payload byte.
+
+#include "rn487x_hex.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TICKS() __rdtsc()
+#define TICK_UNIT "cycles"
+#else
+static uint64_t _ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#define TICKS() _ns()
+#define TICK_UNIT "ns"
+#endif
+
+#define ROUNDS 200000
+#define BUFF_MAX 256
+
+/**
+ ===============================================================================
+            ##### Reference copies of the replaced helpers #####
+ ===============================================================================
+*/
+static void _decToHex(uint16_t dec, uint8_t *hexBuff, uint8_t hexBuffLen)
+{
+  uint16_t quotient = dec;
+  uint16_t remainder = 0;
+  uint8_t i = 0;
+  uint8_t j = hexBuffLen - 1;
+  memset(hexBuff, 0, hexBuffLen);
+  while (quotient != 0)
+  {
+    remainder = quotient % 16;
+    if (remainder < 10)
+      hexBuff[j--] = 48 + remainder;
+    else
+      hexBuff[j--] = 55 + remainder;
+    quotient = quotient / 16;
+    i++;
+  }
+  for (j = 0; j < (hexBuffLen - i); j++)
+  {
+    hexBuff[j] = '0';
+  }
+}
+
+static uint8_t _hexDigitToDec(char hexDigit)
+{
+  if ((hexDigit >= '0') && (hexDigit <= '9'))
+  {
+    return (hexDigit - '0');
+  }
+  if ((hexDigit >= 'A') && (hexDigit <= 'F'))
+  {
+    return (hexDigit - 'A' + 10);
+  }
+  return 0;
+}
+
+// Same loops as rn487x_writeLocalCharact / rn487x_readLocalCharact used to run
+static void _legacyEncode(const uint8_t *src, size_t len, char *dst)
+{
+  uint8_t hexBuff[2] = {0};
+  for (size_t i = 0, j = 0; i < len; i++, j += 2)
+  {
+    _decToHex(src[i], hexBuff, 2);
+    dst[j] = hexBuff[0];
+    dst[j + 1] = hexBuff[1];
+  }
+}
+
+static bool _legacyDecode(const char *src, size_t hexLen, uint8_t *dst)
+{
+  for (size_t i = 0, j = 0; j < hexLen; i++, j += 2)
+  {
+    uint8_t d1 = _hexDigitToDec(src[j]) & 0xF;
+    uint8_t d2 = _hexDigitToDec(src[j + 1]) & 0xF;
+    dst[i] = (d1 << 4) | d2;
+  }
+  return true;
+}
+
+/**
+ ===============================================================================
+            ##### Benchmark #####
+ ===============================================================================
+*/
+typedef void (*encode_fn)(const uint8_t *, size_t, char *);
+typedef bool (*decode_fn)(const char *, size_t, uint8_t *);
+
+static _Alignas(4) uint8_t _bin[BUFF_MAX + 4];
+static _Alignas(4) char _hex[2 * BUFF_MAX + 4];
+static _Alignas(4) uint8_t _out[BUFF_MAX + 4];
+static volatile uint8_t _sink;
+
+static double _encode(encode_fn fn, size_t len, size_t offset)
+{
+  uint64_t t0 = TICKS();
+  for (uint32_t r = 0; r < ROUNDS; r++)
+  {
+    _bin[offset] = (uint8_t)r;
+    fn(&_bin[offset], len, &_hex[offset]);
+    _sink = _hex[offset];
+  }
+  return (double)(TICKS() - t0) / ROUNDS / len;
+}
+
+static double _decode(decode_fn fn, size_t len, size_t offset)
+{
+  uint64_t t0 = TICKS();
+  for (uint32_t r = 0; r < ROUNDS; r++)
+  {
+    _hex[offset] = "0123456789ABCDEF"[r & 0xF];
+    fn(&_hex[offset], 2 * len, &_out[offset]);
+    _sink = _out[offset];
+  }
+  return (double)(TICKS() - t0) / ROUNDS / len;
+}
+
+int main(void)
+{
+  static const size_t sizes[] = {4, 20, 128};
+
+  for (size_t i = 0; i < sizeof(_bin); i++)
+  {
+    _bin[i] = (uint8_t)(i * 37);
+  }
+  // Both codecs must agree before they are compared
+  _legacyEncode(_bin, BUFF_MAX, _hex);
+  {
+    char check[2 * BUFF_MAX];
+    rn487x_hexEncode(_bin, BUFF_MAX, check);
+    if (memcmp(check, _hex, sizeof(check)) != 0 || !rn487x_hexDecode(_hex, 2 * BUFF_MAX, _out) ||
+        memcmp(_out, _bin, BUFF_MAX) != 0)
+    {
+      printf("codec mismatch\n");
+      return 1;
+    }
+  }
+  // The word paths take any alignment of the source and the destination
+  for (size_t off = 1; off < 4; off++)
+  {
+    uint8_t bin[BUFF_MAX + 4];
+    char check[2 * BUFF_MAX + 4];
+    uint8_t out[BUFF_MAX + 4];
+    memcpy(&bin[off], _bin, BUFF_MAX);
+    rn487x_hexEncode(&bin[off], BUFF_MAX, &check[4 - off]);
+    if (memcmp(&check[4 - off], _hex, 2 * BUFF_MAX) != 0 || !rn487x_hexDecode(&check[4 - off], 2 * BUFF_MAX, &out[off]) ||
+        memcmp(&out[off], _bin, BUFF_MAX) != 0)
+    {
+      printf("codec mismatch at offset %zu\n", off);
+      return 1;
+    }
+  }
+
+  printf("%-8s %14s %14s %14s %14s %14s %14s\n", TICK_UNIT "/B", "enc legacy", "enc aligned",
+         "enc unaligned", "dec legacy", "dec aligned", "dec unaligned");
+  for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++)
+  {
+    size_t len = sizes[k];
+    printf("%-8zu %14.2f %14.2f %14.2f %14.2f %14.2f %14.2f\n", len,
+           _encode(_legacyEncode, len, 0), _encode(rn487x_hexEncode, len, 0),
+           _encode(rn487x_hexEncode, len, 1), _decode(_legacyDecode, len, 0),
+           _decode(rn487x_hexDecode, len, 0), _decode(rn487x_hexDecode, len, 1));
+  }
+  return 0;
+}
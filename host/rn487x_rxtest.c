@@ -0,0 +1,178 @@
+// Host test of the RX line framer on corner case input: long lines,
+// events cut into replies, lines starting with a known reply and peer
+// data in data mode. Built with
+// RN487X_DEBUG, so every framed line also goes through the debug print,
+// and with AddressSanitizer, so an out of bounds access aborts the test.
+// The debug output goes to stderr.
+
+#include "eonOS.h"
+#include "rn487x.h"
+#include "rn487x_const.h"
+#include "rn487x_sim.h"
+#include <stdio.h>
+#include <string.h>
+
+static uint32_t _checks;
+static uint32_t _checksFailed;
+static uint32_t _events;
+static uint8_t _data[256];
+static uint16_t _dataLen;
+
+static void _check(bool ok, const char *what)
+{
+  _checks++;
+  if (!ok)
+  {
+    _checksFailed++;
+    printf("FAIL: %s\n", what);
+  }
+}
+
+// Feeds len filler bytes and CRLF as unsolicited module output
+static void _feedLine(uint16_t len)
+{
+  for (uint16_t i = 0; i < len; i++)
+  {
+    rn487x_rxFeed('x');
+  }
+  rn487x_rxFeed('\r');
+  rn487x_rxFeed('\n');
+  rn487x_process();
+}
+
+static void _onEvent(const rn487x_event_t *evt, void *arg)
+{
+  (void)evt;
+  (void)arg;
+  _events++;
+}
+
+static void _onData(const uint8_t *data, uint16_t len, void *arg)
+{
+  (void)arg;
+  if (_dataLen + len <= sizeof(_data))
+  {
+    memcpy(&_data[_dataLen], data, len);
+    _dataLen += len;
+  }
+}
+
+// Runs the engine for ms of simulated time
+static void _run(uint32_t ms)
+{
+  uint32_t start = millis();
+  while (millis() - start < ms)
+  {
+    rn487x_process();
+  }
+}
+
+/**
+ ===============================================================================
+            ##### Tests #####
+ ===============================================================================
+*/
+// Lines as long as the framer splits them and longer ones must be
+// framed without overrunning a line buffer, the engine in step after.
+static void _longLines(void)
+{
+  static const uint16_t lens[] = {RN487X_LINE_LEN - 1, RN487X_LINE_LEN, RN487X_LINE_LEN + 1,
+                                  2 * RN487X_LINE_LEN};
+  char what[64];
+  for (uint8_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++)
+  {
+    _feedLine(lens[i]);
+    snprintf(what, sizeof(what), "command after a %u byte line", lens[i]);
+    _check(rn487x_setDeviceName("rxtest"), what);
+  }
+}
+
+// An event cut into a reply is pulled out and the reply framed
+// around it, both for a reply decided early and one that is not.
+static void _eventInReply(void)
+{
+  rn487x_onEvent(BLE_EVENT_CONN_PARAM, _onEvent, NULL);
+  _events = 0;
+  rn487x_sim_eventInReply("CONN_PARAM,0006,0000,01F4", 2);
+  _check(rn487x_setDeviceName("rxtest") && rn487x_lastReply() == RN487X_REPLY_AOK,
+         "AOK cut by an event");
+  rn487x_sim_eventInReply("CONN_PARAM,0006,0000,01F4", 2);
+  _check(rn487x_getConnectionStatus() == 0 && rn487x_lastReply() == RN487X_REPLY_NONE,
+         "none cut by an event");
+  _check(_events == 2, "events cut into replies");
+}
+
+// A line that only starts with a known reply is not that reply: it
+// completes a command expecting any line with the whole line.
+static void _replyPrefix(void)
+{
+  static const char *const lines[] = {"AOKAY", "none found", "Errand"};
+  rn487x_cmd_t cmd;
+  char resp[32];
+  char what[64];
+  for (uint8_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++)
+  {
+    rn487x_cmdPrepare(&cmd, DISPLAY_FW_VERSION, NULL, DEFAULT_CMD_TIMEOUT);
+    cmd.resp = resp;
+    cmd.respSize = sizeof(resp);
+    rn487x_submit(&cmd);
+    // Ahead of the module reply, which then comes unsolicited
+    for (const char *p = lines[i]; *p; p++)
+    {
+      rn487x_rxFeed(*p);
+    }
+    rn487x_rxFeed('\r');
+    rn487x_rxFeed('\n');
+    while (!rn487x_cmdDone(&cmd))
+    {
+      rn487x_process();
+    }
+    snprintf(what, sizeof(what), "line \"%s\" taken whole", lines[i]);
+    _check(cmd.status == RN487X_CMD_OK && cmd.reply == RN487X_REPLY_UNKNOWN && strcmp(resp, lines[i]) == 0,
+           what);
+    _run(20);
+  }
+  _check(rn487x_setDeviceName("rxtest"), "command after the prefixed lines");
+}
+
+// In data mode the peer's bytes reach the data handler unframed,
+// '%' included, until %DISCONNECT%; command mode works again after.
+static void _dataMode(void)
+{
+  static const char payload[] = "50% off, %CONNECT,0,001EC0123456% and %WV,0072,01% are data\r\nAOK";
+  rn487x_onData(_onData, NULL);
+  _dataLen = 0;
+  _events = 0;
+  rn487x_sim_connect();
+  _run(10);
+  _check(rn487x_isConnected() && rn487x_dataMode(), "data mode while connected");
+  _check(rn487x_sim_peerSend((const uint8_t *)payload, sizeof(payload) - 1), "peer data sent");
+  _run(20);
+  _check(_dataLen == sizeof(payload) - 1 && memcmp(_data, payload, _dataLen) == 0, "peer data delivered as is");
+  _check(rn487x_isConnected() && _events == 0, "no events in peer data");
+  rn487x_sim_disconnect();
+  _run(10);
+  _check(!rn487x_isConnected(), "%DISCONNECT% in data mode");
+  _check(rn487x_cmdMode() && rn487x_setDeviceName("rxtest"), "command mode after data mode");
+  rn487x_onData(NULL, NULL);
+}
+
+int main(void)
+{
+  rn487x_sim_config_t cfg;
+
+  rn487x_sim_defaultConfig(&cfg);
+  rn487x_sim_init(&cfg);
+  if (!rn487x_cmdMode())
+  {
+    printf("command mode failed\n");
+    return 1;
+  }
+  _longLines();
+  _eventInReply();
+  _replyPrefix();
+  _dataMode();
+
+  printf("rxtest  %u of %u checks failed\n", _checksFailed, _checks);
+  return _checksFailed ? 1 : 0;
+}
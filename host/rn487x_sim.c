@@ -0,0 +1,1357 @@
+#include "rn487x_sim.h"
+#include "eonOS.h"
+#include "rn487x_defines.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ ===============================================================================
+            ##### Private macros #####
+ ===============================================================================
+*/
+#define RX_QUEUE_LEN 8192
+#define LINE_LEN 600
+#define UUID_STR_LEN 33
+#define CRLF "\r\n"
+#define CRLF_PROMPT CRLF "CMD> "
+
+#define PROP_NOTIFY_MASK 0x30
+#define FEATURE_FLOW_CONTROL 0x8000
+#define GARBLED 0xFF
+#define CCCD_PROPERTY 0x10
+
+typedef enum
+{
+  MODULE_OFF = 0,
+  MODULE_BOOTING,
+  MODULE_DATA,
+  MODULE_CMD
+} _module_state_t;
+
+typedef struct
+{
+  uint64_t at;
+  uint8_t c;
+  bool flow;     // module line settings when the byte was sent
+  uint32_t baud;
+} _rx_byte_t;
+
+typedef struct
+{
+  char uuid[UUID_STR_LEN];
+  uint8_t service;
+  uint8_t property;
+  uint8_t length;
+} _sim_charact_t;
+
+typedef struct
+{
+  uint16_t handle;
+  uint8_t valueLen;
+  uint8_t value[RN487X_SIM_MAX_VALUE_LEN];
+} _sim_attr_t;
+
+// One simulated module and the host UART it is wired to
+typedef struct
+{
+  rn487x_sim_stats_t stats;
+  uint64_t byteNs;    // host character time
+  uint64_t modByteNs; // module character time
+  bool hostFlow;
+  bool modFlow;
+  uint32_t hostBaud;
+  uint32_t modBaud;
+
+  // Bytes on their way from the module to the host
+  _rx_byte_t rxQueue[RX_QUEUE_LEN];
+  uint16_t rxHead;
+  uint16_t rxTail;
+  uint64_t rxLastAt;
+  void (*rxIsr)(uint8_t c, void *arg);
+  void *rxIsrArg;
+
+  // Background transmit from the host (uart1_dma_start)
+  const uint8_t *dmaBuf;
+  uint16_t dmaLen;
+  uint16_t dmaPos;
+  uint64_t dmaNextNs;
+  bool dmaBusy;
+  bool dmaRunning; // _dmaStep() guard
+  void (*dmaIsr)(void *arg);
+  void *dmaIsrArg;
+
+  // Module state
+  _module_state_t state;
+  uint64_t bootDoneNs;
+  char line[LINE_LEN];
+  uint16_t lineLen;
+  uint8_t dollarCnt;
+  bool connected;
+  bool scanning;
+
+  // Beacon payload on air (IB), in advertising data format
+  uint8_t beacon[31];
+  uint8_t beaconLen;
+
+  // Settings stored in the module flash, applied at boot (SB, SR, SO)
+  uint8_t baudId;
+  uint16_t features;
+  bool lowPowerCfg;
+
+  // Low power: asleep while the mode is on and the wake line is high
+  bool lowPower;
+  bool wakeHigh;
+  uint64_t wakeReadyNs; // UART usable again after a wake-up
+  uint64_t sleepSinceNs;
+
+  // Fault injection, decided for each command line
+  rn487x_sim_faults_t faults;
+  uint32_t faultRng;
+  bool replyLost;
+  uint64_t replyDelayNs;
+
+  // Event cut into the next reply (rn487x_sim_eventInReply)
+  char splitEvent[64];
+  uint8_t splitAfter;
+
+  // Transparent UART buffer, drained toward the peer at airRate
+  uint32_t streamFill;
+  uint64_t streamDrainedNs;
+
+  // GATT definitions stored in the module flash (PS/PC/PZ)
+  char services[RN487X_SIM_MAX_SERVICES][UUID_STR_LEN];
+  uint8_t serviceCnt;
+  _sim_charact_t characts[RN487X_SIM_MAX_CHARACTS];
+  uint8_t charactCnt;
+
+  // Scripted peer seen by the client role
+  char peerServices[RN487X_SIM_MAX_SERVICES][UUID_STR_LEN];
+  uint8_t peerServiceCnt;
+  _sim_charact_t peerCharacts[RN487X_SIM_MAX_CHARACTS];
+  _sim_attr_t peerAttrs[RN487X_SIM_MAX_CHARACTS];
+  uint8_t peerCharactCnt;
+  uint64_t connNs;    // first connection event
+  uint64_t attFreeNs; // end of the last ATT transaction
+
+  // GATT table loaded at boot
+  char activeServices[RN487X_SIM_MAX_SERVICES][UUID_STR_LEN];
+  uint8_t activeServiceCnt;
+  _sim_charact_t activeCharacts[RN487X_SIM_MAX_CHARACTS];
+  _sim_attr_t activeAttrs[RN487X_SIM_MAX_CHARACTS];
+  uint8_t activeCharactCnt;
+} _sim_module_t;
+
+/**
+ ===============================================================================
+            ##### Private variables #####
+ ===============================================================================
+*/
+static rn487x_sim_config_t _cfg;
+static uint64_t _now_ns = 0;
+static _sim_module_t _modules[RN487X_SIM_MODULES];
+static _sim_module_t *_m = &_modules[0]; // selected module
+
+static const uint32_t _baud_rates[] = {921600, 460800, 230400, 115200, 57600, 38400,
+                                       28800, 19200, 14400, 9600, 4800, 2400};
+
+// True when module bytes sent with these settings reach the host intact.
+// Past maxBaudNoFlow without RTS/CTS, the host overruns on module bursts.
+static bool _lineOk(uint32_t modBaud, bool modFlow)
+{
+  return _m->hostBaud == modBaud && _m->hostFlow == modFlow &&
+         (modBaud <= _cfg.maxBaudNoFlow || modFlow);
+}
+
+// True when host bytes reach the module intact
+static bool _linkOk(void)
+{
+  return _m->hostBaud == _m->modBaud && _m->hostFlow == _m->modFlow;
+}
+
+static uint8_t _baudId(uint32_t baudrate)
+{
+  for (uint8_t i = 0; i < sizeof(_baud_rates) / sizeof(_baud_rates[0]); i++)
+  {
+    if (_baud_rates[i] == baudrate)
+    {
+      return i;
+    }
+  }
+  return 0xFF;
+}
+
+/**
+ ===============================================================================
+            ##### Reply scheduling #####
+ ===============================================================================
+*/
+static void _rxClear(void)
+{
+  _m->rxHead = 0;
+  _m->rxTail = 0;
+  _m->rxLastAt = 0;
+}
+
+static void _rxPush(uint8_t c, uint64_t at)
+{
+  uint16_t next = (_m->rxHead + 1) % RX_QUEUE_LEN;
+  if (next == _m->rxTail)
+  {
+    fprintf(stderr, "[sim] rx queue overflow\n");
+    exit(1);
+  }
+  _m->rxQueue[_m->rxHead].at = at;
+  _m->rxQueue[_m->rxHead].c = c;
+  _m->rxQueue[_m->rxHead].baud = _m->modBaud;
+  _m->rxQueue[_m->rxHead].flow = _m->modFlow;
+  _m->rxHead = next;
+  _m->rxLastAt = at;
+}
+
+// Pops the next byte as the host sees it
+static uint8_t _rxTake(void)
+{
+  _rx_byte_t *b = &_m->rxQueue[_m->rxTail];
+  _m->rxTail = (_m->rxTail + 1) % RX_QUEUE_LEN;
+  return _lineOk(b->baud, b->flow) ? b->c : GARBLED;
+}
+
+// Queues a reply: first byte not before 'at', one character time per byte
+static void _scheduleAt(const char *str, uint64_t at)
+{
+  uint64_t t = at;
+  if (_m->replyLost)
+  {
+    return;
+  }
+  if (_m->rxHead != _m->rxTail && t < _m->rxLastAt + _m->modByteNs)
+  {
+    t = _m->rxLastAt + _m->modByteNs;
+  }
+  for (uint16_t i = 0; str[i]; i++)
+  {
+    if (_m->splitEvent[0] != 0 && i == _m->splitAfter)
+    {
+      for (const char *e = _m->splitEvent; *e; e++)
+      {
+        _rxPush((uint8_t)*e, t);
+        t += _m->modByteNs;
+      }
+      _m->splitEvent[0] = 0;
+    }
+    _rxPush((uint8_t)str[i], t);
+    t += _m->modByteNs;
+  }
+}
+
+static void _reply(const char *str)
+{
+  _scheduleAt(str, _now_ns + (uint64_t)_cfg.replyLatencyUs * 1000 + _m->replyDelayNs);
+}
+
+// xorshift32, reproducible from the seed
+static uint16_t _faultDraw(void)
+{
+  _m->faultRng ^= _m->faultRng << 13;
+  _m->faultRng ^= _m->faultRng >> 17;
+  _m->faultRng ^= _m->faultRng << 5;
+  return _m->faultRng % 1000;
+}
+
+// Decides the faults of the command line about to be processed
+static void _faultArm(void)
+{
+  if (_m->faults.lostPermille > 0 && _faultDraw() < _m->faults.lostPermille)
+  {
+    _m->replyLost = true;
+    _m->stats.lostReplies++;
+  }
+  else if (_m->faults.slowPermille > 0 && _faultDraw() < _m->faults.slowPermille)
+  {
+    _m->replyDelayNs = (uint64_t)_m->faults.slowUs * 1000;
+    _m->stats.slowReplies++;
+  }
+}
+
+static void _replyWithPrompt(const char *str)
+{
+  _reply(str);
+  _reply(CRLF_PROMPT);
+}
+
+static uint64_t _replyEnd(void)
+{
+  return (_m->rxHead != _m->rxTail) ? _m->rxLastAt + _m->modByteNs : _now_ns;
+}
+
+/**
+ ===============================================================================
+            ##### Module emulation #####
+ ===============================================================================
+*/
+static bool _asleep(void)
+{
+  return _m->lowPower && _m->wakeHigh && _m->state != MODULE_OFF;
+}
+
+// Closes (false) or opens (true) a span of sleep around a change of the
+// low power mode, the wake line or the power state
+static void _sleepUpdate(bool open)
+{
+  if (!_asleep())
+  {
+    return;
+  }
+  if (open)
+  {
+    _m->sleepSinceNs = _now_ns;
+  }
+  else
+  {
+    _m->stats.sleepUs += (_now_ns - _m->sleepSinceNs) / 1000;
+  }
+}
+
+static void _startBoot(uint64_t at)
+{
+  // The line settings in flash take effect
+  _m->modBaud = _baud_rates[_m->baudId];
+  _m->modByteNs = 10ULL * 1000000000ULL / _m->modBaud;
+  _m->modFlow = (_m->features & FEATURE_FLOW_CONTROL) != 0;
+  _m->state = MODULE_BOOTING;
+  _m->bootDoneNs = at + (uint64_t)_cfg.bootTimeUs * 1000;
+  _m->lineLen = 0;
+  _m->dollarCnt = 0;
+  _m->stats.reboots++;
+  _m->connected = false;
+  _m->scanning = false;
+  _m->beaconLen = 0; // IB is not stored
+  _sleepUpdate(false);
+  _m->lowPower = _m->lowPowerCfg;
+  _sleepUpdate(true);
+  _scheduleAt("%REBOOT%", _m->bootDoneNs);
+}
+
+static void _loadGatt(void)
+{
+  uint16_t handle = RN487X_SIM_FIRST_HANDLE;
+  memcpy(_m->activeServices, _m->services, sizeof(_m->services));
+  _m->activeServiceCnt = _m->serviceCnt;
+  memcpy(_m->activeCharacts, _m->characts, sizeof(_m->characts));
+  _m->activeCharactCnt = _m->charactCnt;
+  memset(_m->activeAttrs, 0, sizeof(_m->activeAttrs));
+  for (uint8_t i = 0; i < _m->activeCharactCnt; i++)
+  {
+    _m->activeAttrs[i].handle = handle;
+    handle += (_m->activeCharacts[i].property & PROP_NOTIFY_MASK) ? 3 : 2;
+  }
+}
+
+// Bytes the link carried to the peer since the last call
+static void _streamDrain(void)
+{
+  if (_m->streamFill == 0 || _cfg.airRate == 0)
+  {
+    _m->streamDrainedNs = _now_ns;
+    return;
+  }
+  uint64_t n = (_now_ns - _m->streamDrainedNs) * _cfg.airRate / 1000000000ULL;
+  if (n >= _m->streamFill)
+  {
+    _m->streamFill = 0;
+    _m->streamDrainedNs = _now_ns;
+    return;
+  }
+  _m->streamFill -= n;
+  _m->streamDrainedNs += n * 1000000000ULL / _cfg.airRate;
+}
+
+static void _moduleRx(uint8_t c);
+
+// With RTS/CTS, the module holds the host while its transparent UART
+// buffer is full: time at which it can take the next byte
+static uint64_t _ctsReadyAt(void)
+{
+  if (!_m->modFlow || !_linkOk() || _m->state != MODULE_DATA || !_m->connected ||
+      _m->streamFill < _cfg.streamBufLen || _cfg.airRate == 0)
+  {
+    return _now_ns;
+  }
+  return _m->streamDrainedNs + 1000000000ULL / _cfg.airRate;
+}
+
+// Moves the DMA bytes that are due onto the wire
+static void _dmaStep(void)
+{
+  _sim_module_t *m = _m;
+  if (m->dmaRunning)
+  {
+    return;
+  }
+  m->dmaRunning = true;
+  while (_m->dmaBusy && _m->dmaNextNs <= _now_ns)
+  {
+    uint64_t ready = _ctsReadyAt();
+    if (ready > _now_ns)
+    {
+      _m->dmaNextNs = ready + _m->byteNs;
+      break;
+    }
+    uint8_t c = _m->dmaBuf[_m->dmaPos++];
+    _m->dmaNextNs += _m->byteNs;
+    _m->stats.txBytes++;
+    _moduleRx(_linkOk() ? c : GARBLED);
+    if (_m->dmaPos == _m->dmaLen)
+    {
+      _m->dmaBusy = false;
+      if (_m->dmaIsr != NULL)
+      {
+        _m->dmaIsr(_m->dmaIsrArg);
+        _m = m; // the driver may have selected another module
+      }
+    }
+  }
+  m->dmaRunning = false;
+}
+
+static void _streamRx(uint8_t c)
+{
+  (void)c;
+  _streamDrain();
+  if (_m->streamFill >= _cfg.streamBufLen)
+  {
+    _m->stats.streamOverruns++;
+    return;
+  }
+  _m->streamFill++;
+  _m->stats.streamBytes++;
+}
+
+// Applies the time-driven state changes (boot completion, interrupts)
+// of every module, the selection is left unchanged
+static void _sync(void)
+{
+  _sim_module_t *sel = _m;
+  for (uint8_t i = 0; i < RN487X_SIM_MODULES; i++)
+  {
+    _m = &_modules[i];
+    if (_m->state == MODULE_BOOTING && _now_ns >= _m->bootDoneNs)
+    {
+      _m->state = MODULE_DATA;
+      _loadGatt();
+    }
+    _dmaStep();
+    while (_m->rxIsr != NULL && _m->rxTail != _m->rxHead && _m->rxQueue[_m->rxTail].at <= _now_ns)
+    {
+      uint8_t c = _rxTake();
+      _m->stats.rxBytes++;
+      _m->rxIsr(c, _m->rxIsrArg);
+    }
+  }
+  _m = sel;
+}
+
+// True when a driver is fed by interrupts and may spin on the clock
+static bool _interruptDriven(void)
+{
+  for (uint8_t i = 0; i < RN487X_SIM_MODULES; i++)
+  {
+    if (_modules[i].rxIsr != NULL || _modules[i].dmaBusy)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool _isHex(const char *str, uint16_t len)
+{
+  for (uint16_t i = 0; i < len; i++)
+  {
+    char c = str[i];
+    if (!((c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f')))
+      return false;
+  }
+  return true;
+}
+
+static uint16_t _hexToNum(const char *str, uint8_t len)
+{
+  char tmp[5] = {0};
+  memcpy(tmp, str, len);
+  return (uint16_t)strtoul(tmp, NULL, 16);
+}
+
+static _sim_attr_t *_findAttr(uint16_t handle, uint8_t *index)
+{
+  for (uint8_t i = 0; i < _m->activeCharactCnt; i++)
+  {
+    if (_m->activeAttrs[i].handle == handle)
+    {
+      *index = i;
+      return &_m->activeAttrs[i];
+    }
+  }
+  return NULL;
+}
+
+static _sim_attr_t *_findPeerAttr(uint16_t handle)
+{
+  for (uint8_t i = 0; i < _m->peerCharactCnt; i++)
+  {
+    if (_m->peerAttrs[i].handle == handle)
+    {
+      return &_m->peerAttrs[i];
+    }
+  }
+  return NULL;
+}
+
+static bool _startsWith(const char *str, const char *prefix)
+{
+  return strncmp(str, prefix, strlen(prefix)) == 0;
+}
+
+static void _cmdDefineService(const char *arg)
+{
+  uint16_t len = strlen(arg);
+  if ((len != 4 && len != 32) || !_isHex(arg, len) || _m->serviceCnt >= RN487X_SIM_MAX_SERVICES)
+  {
+    _replyWithPrompt("Err");
+    return;
+  }
+  strcpy(_m->services[_m->serviceCnt++], arg);
+  _replyWithPrompt("AOK");
+}
+
+static void _cmdDefineCharact(const char *arg)
+{
+  const char *c1 = strchr(arg, ',');
+  const char *c2 = c1 ? strchr(c1 + 1, ',') : NULL;
+  uint16_t uuidLen = c1 ? (uint16_t)(c1 - arg) : 0;
+  if (_m->serviceCnt == 0 || _m->charactCnt >= RN487X_SIM_MAX_CHARACTS || c2 == NULL ||
+      (uuidLen != 4 && uuidLen != 32) || !_isHex(arg, uuidLen) ||
+      strlen(c1 + 1) < 5 || strlen(c2 + 1) != 2)
+  {
+    _replyWithPrompt("Err");
+    return;
+  }
+  _sim_charact_t *ch = &_m->characts[_m->charactCnt++];
+  memcpy(ch->uuid, arg, uuidLen);
+  ch->uuid[uuidLen] = 0;
+  ch->service = _m->serviceCnt - 1;
+  ch->property = _hexToNum(c1 + 1, 2);
+  ch->length = _hexToNum(c2 + 1, 2);
+  _replyWithPrompt("AOK");
+}
+
+static void _cmdWriteLocal(const char *arg)
+{
+  uint8_t idx;
+  uint16_t hexLen = strlen(arg) - 5;
+  _sim_attr_t *attr = NULL;
+  if (strlen(arg) > 5 && arg[4] == ',' && _isHex(arg, 4))
+  {
+    attr = _findAttr(_hexToNum(arg, 4), &idx);
+  }
+  if (attr == NULL || (hexLen & 1) || !_isHex(&arg[5], hexLen) ||
+      hexLen / 2 > _m->activeCharacts[idx].length)
+  {
+    _replyWithPrompt("Err");
+    return;
+  }
+  attr->valueLen = hexLen / 2;
+  for (uint16_t i = 0; i < attr->valueLen; i++)
+  {
+    attr->value[i] = _hexToNum(&arg[5 + 2 * i], 2);
+  }
+  _replyWithPrompt("AOK");
+}
+
+static void _cmdReadLocal(const char *arg)
+{
+  uint8_t idx;
+  _sim_attr_t *attr = NULL;
+  char hex[2 * RN487X_SIM_MAX_VALUE_LEN + 1] = {0};
+  if (strlen(arg) == 4 && _isHex(arg, 4))
+  {
+    attr = _findAttr(_hexToNum(arg, 4), &idx);
+  }
+  if (attr == NULL)
+  {
+    _replyWithPrompt("Err");
+    return;
+  }
+  if (attr->valueLen == 0)
+  {
+    _replyWithPrompt("N/A");
+    return;
+  }
+  for (uint8_t i = 0; i < attr->valueLen; i++)
+  {
+    sprintf(&hex[2 * i], "%02X", attr->value[i]);
+  }
+  _replyWithPrompt(hex);
+}
+
+static void _cmdList(void)
+{
+  char line[64];
+  for (uint8_t s = 0; s < _m->activeServiceCnt; s++)
+  {
+    sprintf(line, "%s" CRLF, _m->activeServices[s]);
+    _reply(line);
+    for (uint8_t i = 0; i < _m->activeCharactCnt; i++)
+    {
+      if (_m->activeCharacts[i].service != s)
+        continue;
+      sprintf(line, "  %s,%04X,%02X" CRLF, _m->activeCharacts[i].uuid,
+              _m->activeAttrs[i].handle, _m->activeCharacts[i].property);
+      _reply(line);
+      if (_m->activeCharacts[i].property & PROP_NOTIFY_MASK)
+      {
+        sprintf(line, "  %s,%04X,%02X" CRLF, _m->activeCharacts[i].uuid,
+                _m->activeAttrs[i].handle + 1, CCCD_PROPERTY);
+        _reply(line);
+      }
+    }
+  }
+  _replyWithPrompt("END");
+}
+
+// ATT transaction with the peer, requested now: it starts at the next
+// connection event once the previous one is over, returns its end
+static uint64_t _attTransaction(uint8_t events)
+{
+  uint64_t interval = (uint64_t)_cfg.connIntervalUs * 1000;
+  uint64_t start = (_now_ns > _m->attFreeNs) ? _now_ns : _m->attFreeNs;
+  start = _m->connNs + (start - _m->connNs + interval - 1) / interval * interval;
+  _m->attFreeNs = start + events * interval;
+  return _m->attFreeNs;
+}
+
+static void _replyAfterAtt(const char *str, uint8_t events)
+{
+  uint64_t at = _attTransaction(events) + (uint64_t)_cfg.replyLatencyUs * 1000;
+  _scheduleAt(str, at);
+  _scheduleAt(CRLF_PROMPT, at);
+}
+
+static void _cmdDiscover(void)
+{
+  if (!_m->connected)
+  {
+    _replyWithPrompt("Err");
+    return;
+  }
+  // One request per service and per characteristic, roughly
+  _replyAfterAtt("AOK", 1 + _m->peerServiceCnt + _m->peerCharactCnt);
+}
+
+static void _cmdListClient(void)
+{
+  char line[64];
+  for (uint8_t s = 0; s < _m->peerServiceCnt; s++)
+  {
+    sprintf(line, "%s" CRLF, _m->peerServices[s]);
+    _reply(line);
+    for (uint8_t i = 0; i < _m->peerCharactCnt; i++)
+    {
+      if (_m->peerCharacts[i].service != s)
+        continue;
+      sprintf(line, "  %s,%04X,%02X" CRLF, _m->peerCharacts[i].uuid, _m->peerAttrs[i].handle,
+              _m->peerCharacts[i].property);
+      _reply(line);
+      if (_m->peerCharacts[i].property & PROP_NOTIFY_MASK)
+      {
+        sprintf(line, "  %s,%04X,%02X" CRLF, _m->peerCharacts[i].uuid, _m->peerAttrs[i].handle + 1,
+                CCCD_PROPERTY);
+        _reply(line);
+      }
+    }
+  }
+  _replyWithPrompt("END");
+}
+
+static void _cmdReadRemote(const char *arg)
+{
+  _sim_attr_t *attr = NULL;
+  char hex[2 * RN487X_SIM_MAX_VALUE_LEN + 1] = {0};
+  if (strlen(arg) == 4 && _isHex(arg, 4))
+  {
+    attr = _findPeerAttr(_hexToNum(arg, 4));
+  }
+  if (!_m->connected || attr == NULL)
+  {
+    _replyWithPrompt("Err");
+    return;
+  }
+  for (uint8_t i = 0; i < attr->valueLen; i++)
+  {
+    sprintf(&hex[2 * i], "%02X", attr->value[i]);
+  }
+  _replyAfterAtt(hex, 1);
+}
+
+static void _cmdWriteRemote(const char *arg)
+{
+  _sim_attr_t *attr = NULL;
+  uint16_t hexLen = strlen(arg) - 5;
+  if (strlen(arg) > 5 && arg[4] == ',' && _isHex(arg, 4))
+  {
+    attr = _findPeerAttr(_hexToNum(arg, 4));
+  }
+  if (!_m->connected || attr == NULL || (hexLen & 1) || !_isHex(&arg[5], hexLen) ||
+      hexLen / 2 > RN487X_SIM_MAX_VALUE_LEN)
+  {
+    _replyWithPrompt("Err");
+    return;
+  }
+  attr->valueLen = hexLen / 2;
+  for (uint16_t i = 0; i < attr->valueLen; i++)
+  {
+    attr->value[i] = _hexToNum(&arg[5 + 2 * i], 2);
+  }
+  _replyAfterAtt("AOK", 1);
+}
+
+static void _cmdBeacon(const char *arg)
+{
+  uint16_t hexLen = strlen(arg) > 3 ? strlen(arg) - 3 : 0;
+  if (strcmp(arg, "Z") == 0)
+  {
+    _m->beaconLen = 0;
+    _replyWithPrompt("AOK");
+    return;
+  }
+  if (strlen(arg) < 3 || arg[2] != ',' || !_isHex(arg, 2) || (hexLen & 1) || !_isHex(&arg[3], hexLen) ||
+      _m->beaconLen + 2 + hexLen / 2 > (int)sizeof(_m->beacon))
+  {
+    _replyWithPrompt("Err");
+    return;
+  }
+  _m->beacon[_m->beaconLen++] = 1 + hexLen / 2;
+  _m->beacon[_m->beaconLen++] = _hexToNum(arg, 2);
+  for (uint16_t i = 0; i < hexLen; i += 2)
+  {
+    _m->beacon[_m->beaconLen++] = _hexToNum(&arg[3 + i], 2);
+  }
+  _replyWithPrompt("AOK");
+}
+
+static void _processLine(void)
+{
+  // Set and action commands the emulator accepts without modelling them
+  static const char *const acceptOnly[] = {
+      "S-,", "SN,", "SDN,", "SGA,", "SGC,", "SS,", "SC,",
+      "IA,", "NA,", "NB,", "A", "Y", "JA,", "JB", "JC",
+      NULL};
+  const char *line = _m->line;
+
+  _m->stats.commands++;
+  if (strcmp(line, "---") == 0)
+  {
+    _reply("END" CRLF);
+    _m->state = MODULE_DATA;
+    return;
+  }
+  if (strcmp(line, "R,1") == 0)
+  {
+    _reply("Rebooting" CRLF);
+    _startBoot(_replyEnd());
+    return;
+  }
+  if (strcmp(line, "PZ") == 0)
+  {
+    _m->serviceCnt = 0;
+    _m->charactCnt = 0;
+    _replyWithPrompt("AOK");
+    return;
+  }
+  if (_startsWith(line, "PS,"))
+  {
+    _cmdDefineService(&line[3]);
+    return;
+  }
+  if (_startsWith(line, "PC,"))
+  {
+    _cmdDefineCharact(&line[3]);
+    return;
+  }
+  if (_startsWith(line, "SB,") && strlen(line) == 5 && _isHex(&line[3], 2) &&
+      _hexToNum(&line[3], 2) < sizeof(_baud_rates) / sizeof(_baud_rates[0]))
+  {
+    _m->baudId = _hexToNum(&line[3], 2);
+    _replyWithPrompt("AOK");
+    return;
+  }
+  if (_startsWith(line, "SR,") && strlen(line) == 7 && _isHex(&line[3], 4))
+  {
+    _m->features = _hexToNum(&line[3], 4);
+    _replyWithPrompt("AOK");
+    return;
+  }
+  if (strcmp(line, "SO,0") == 0 || strcmp(line, "SO,1") == 0)
+  {
+    _m->lowPowerCfg = (line[3] == '1');
+    _replyWithPrompt("AOK");
+    return;
+  }
+  if (strcmp(line, "O,0") == 0)
+  {
+    // Dormant, silent until the next reset
+    _sleepUpdate(false);
+    _m->state = MODULE_OFF;
+    return;
+  }
+  if (strcmp(line, "GR") == 0)
+  {
+    char hex[5];
+    sprintf(hex, "%04X", _m->features);
+    _replyWithPrompt(hex);
+    return;
+  }
+  if (_startsWith(line, "SHW,"))
+  {
+    _cmdWriteLocal(&line[4]);
+    return;
+  }
+  if (_startsWith(line, "SHR,"))
+  {
+    _cmdReadLocal(&line[4]);
+    return;
+  }
+  if (strcmp(line, "LS") == 0)
+  {
+    _cmdList();
+    return;
+  }
+  if (strcmp(line, "F") == 0 || (_startsWith(line, "F,") && strlen(line) == 11))
+  {
+    _m->scanning = true;
+    _replyWithPrompt("Scanning");
+    return;
+  }
+  if (_startsWith(line, "IB,"))
+  {
+    _cmdBeacon(&line[3]);
+    return;
+  }
+  if (strcmp(line, "X") == 0)
+  {
+    _m->scanning = false;
+    _replyWithPrompt("AOK");
+    return;
+  }
+  if (strcmp(line, "CI") == 0)
+  {
+    _cmdDiscover();
+    return;
+  }
+  if (strcmp(line, "LC") == 0)
+  {
+    _cmdListClient();
+    return;
+  }
+  if (_startsWith(line, "CHR,"))
+  {
+    _cmdReadRemote(&line[4]);
+    return;
+  }
+  if (_startsWith(line, "CHW,"))
+  {
+    _cmdWriteRemote(&line[4]);
+    return;
+  }
+  if (strcmp(line, "GK") == 0)
+  {
+    _replyWithPrompt(_m->connected ? "001EC0123456,0,1" : "none");
+    return;
+  }
+  if (strcmp(line, "V") == 0)
+  {
+    _replyWithPrompt("RN4871 V1.40 7/9/2019 (c)Microchip Technology Inc");
+    return;
+  }
+  for (uint8_t i = 0; acceptOnly[i] != NULL; i++)
+  {
+    const char *p = acceptOnly[i];
+    uint16_t len = strlen(p);
+    if (p[len - 1] == ',' ? _startsWith(line, p) : strcmp(line, p) == 0)
+    {
+      _replyWithPrompt("AOK");
+      return;
+    }
+  }
+  _replyWithPrompt("Err");
+}
+
+static void _moduleRx(uint8_t c)
+{
+  _sync();
+  if (_asleep() || _now_ns < _m->wakeReadyNs)
+  {
+    // The UART is off until the wake-up completes
+    _m->stats.sleepLost++;
+    return;
+  }
+  switch (_m->state)
+  {
+  case MODULE_DATA:
+    // Transparent UART data goes to the peer, if any
+    if (_m->connected)
+    {
+      _streamRx(c);
+    }
+    _m->dollarCnt = (c == '$') ? _m->dollarCnt + 1 : 0;
+    if (_m->dollarCnt == 3)
+    {
+      _m->dollarCnt = 0;
+      _m->lineLen = 0;
+      _m->state = MODULE_CMD;
+      _reply("CMD> ");
+    }
+    break;
+  case MODULE_CMD:
+    if (c == '\r')
+    {
+      _m->line[_m->lineLen] = 0;
+      _faultArm();
+      _processLine();
+      _m->replyLost = false;
+      _m->replyDelayNs = 0;
+      _m->lineLen = 0;
+    }
+    else if (c != '\n' && _m->lineLen < LINE_LEN - 1)
+    {
+      _m->line[_m->lineLen++] = c;
+      if (_m->lineLen == 3 && memcmp(_m->line, "$$$", 3) == 0)
+      {
+        _m->lineLen = 0;
+        _reply("CMD> ");
+      }
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+// Powers a module up with the configured line settings and empty flash
+static void _moduleInit(void)
+{
+  memset(_m, 0, sizeof(*_m));
+  _m->byteNs = 10ULL * 1000000000ULL / _cfg.baudrate; // 8N1
+  _m->modByteNs = _m->byteNs;
+  _m->hostBaud = _cfg.baudrate;
+  _m->modBaud = _cfg.baudrate;
+  _m->hostFlow = false;
+  _m->modFlow = false;
+  _m->baudId = _baudId(_cfg.baudrate);
+  if (_m->baudId == 0xFF)
+  {
+    fprintf(stderr, "[sim] unsupported baud rate %u\n", _cfg.baudrate);
+    exit(1);
+  }
+  _m->features = 0;
+  _rxClear();
+  memset(&_m->stats, 0, sizeof(_m->stats));
+  _m->serviceCnt = 0;
+  _m->charactCnt = 0;
+  _m->activeServiceCnt = 0;
+  _m->activeCharactCnt = 0;
+  _m->lineLen = 0;
+  _m->dollarCnt = 0;
+  _m->connected = false;
+  _m->scanning = false;
+  _m->beaconLen = 0;
+  _m->streamFill = 0;
+  rn487x_sim_peerReset();
+  // Powered and idle in data mode, as after a long-gone power-up
+  _m->state = MODULE_DATA;
+}
+
+/**
+ ===============================================================================
+            ##### Simulator API #####
+ ===============================================================================
+*/
+void rn487x_sim_defaultConfig(rn487x_sim_config_t *cfg)
+{
+  cfg->baudrate = 115200;
+  cfg->replyLatencyUs = 300;
+  cfg->bootTimeUs = 150000;
+  cfg->pollCostNs = 1000;
+  cfg->airRate = 10000;
+  cfg->streamBufLen = 256;
+  cfg->maxBaudNoFlow = 460800;
+  cfg->connIntervalUs = 15000;
+  cfg->wakeTimeUs = 3000;
+}
+
+void rn487x_sim_init(const rn487x_sim_config_t *cfg)
+{
+  _cfg = *cfg;
+  _now_ns = 0;
+  for (uint8_t i = 0; i < RN487X_SIM_MODULES; i++)
+  {
+    _m = &_modules[i];
+    _moduleInit();
+  }
+  _m = &_modules[0];
+}
+
+void rn487x_sim_select(uint8_t module)
+{
+  if (module >= RN487X_SIM_MODULES)
+  {
+    fprintf(stderr, "[sim] no module %u\n", module);
+    exit(1);
+  }
+  _m = &_modules[module];
+}
+
+uint8_t rn487x_sim_selected(void)
+{
+  return (uint8_t)(_m - _modules);
+}
+
+
+uint64_t rn487x_sim_micros(void)
+{
+  return _now_ns / 1000;
+}
+
+void rn487x_sim_advance(uint64_t us)
+{
+  _now_ns += us * 1000;
+  _sync();
+}
+
+void rn487x_sim_attachRxIsr(void (*isr)(uint8_t c, void *arg), void *arg)
+{
+  _m->rxIsr = isr;
+  _m->rxIsrArg = arg;
+}
+
+void rn487x_sim_attachTxDmaIsr(void (*isr)(void *arg), void *arg)
+{
+  _m->dmaIsr = isr;
+  _m->dmaIsrArg = arg;
+}
+
+void rn487x_sim_connect(void)
+{
+  _m->connected = true;
+  _m->streamFill = 0;
+  _m->connNs = _now_ns;
+  _m->attFreeNs = _now_ns;
+  _reply("%CONNECT,0,001EC0123456%");
+}
+
+void rn487x_sim_disconnect(void)
+{
+  _m->connected = false;
+  _reply("%DISCONNECT%");
+}
+
+bool rn487x_sim_remoteWrite(uint16_t handle, const uint8_t *value, uint8_t len)
+{
+  uint8_t idx;
+  char evt[16 + 2 * RN487X_SIM_MAX_VALUE_LEN];
+  _sim_attr_t *attr = _findAttr(handle, &idx);
+  if (attr == NULL || len > _m->activeCharacts[idx].length)
+  {
+    return false;
+  }
+  memcpy(attr->value, value, len);
+  attr->valueLen = len;
+  int n = sprintf(evt, "%%WV,%04X,", handle);
+  for (uint8_t i = 0; i < len; i++)
+  {
+    n += sprintf(&evt[n], "%02X", value[i]);
+  }
+  strcpy(&evt[n], "%");
+  _reply(evt);
+  return true;
+}
+
+bool rn487x_sim_advertise(const uint8_t address[6], uint8_t type, int8_t rssi, const uint8_t *data, uint8_t len)
+{
+  char evt[32 + 2 * 31];
+  if (!_m->scanning || len > 31)
+  {
+    return false;
+  }
+  int n = sprintf(evt, "%%%02X%02X%02X%02X%02X%02X,%u,%d,Brcst:", address[0], address[1], address[2],
+                  address[3], address[4], address[5], type, rssi);
+  for (uint8_t i = 0; i < len; i++)
+  {
+    n += sprintf(&evt[n], "%02X", data[i]);
+  }
+  strcpy(&evt[n], "%");
+  _reply(evt);
+  return true;
+}
+
+void rn487x_sim_eventInReply(const char *event, uint8_t after)
+{
+  snprintf(_m->splitEvent, sizeof(_m->splitEvent), "%%%s%%", event);
+  _m->splitAfter = after;
+}
+
+bool rn487x_sim_peerSend(const uint8_t *data, uint16_t len)
+{
+  if (!_m->connected || _m->state != MODULE_DATA)
+  {
+    return false;
+  }
+  uint64_t t = _now_ns;
+  if (_m->rxHead != _m->rxTail && t < _m->rxLastAt + _m->modByteNs)
+  {
+    t = _m->rxLastAt + _m->modByteNs;
+  }
+  for (uint16_t i = 0; i < len; i++)
+  {
+    _rxPush(data[i], t);
+    t += _m->modByteNs;
+  }
+  return true;
+}
+
+uint8_t rn487x_sim_beacon(uint8_t *data)
+{
+  memcpy(data, _m->beacon, _m->beaconLen);
+  return _m->beaconLen;
+}
+
+void rn487x_sim_peerReset(void)
+{
+  _m->peerServiceCnt = 0;
+  _m->peerCharactCnt = 0;
+}
+
+bool rn487x_sim_peerAddService(const char *uuid)
+{
+  if (_m->peerServiceCnt >= RN487X_SIM_MAX_SERVICES || strlen(uuid) >= UUID_STR_LEN)
+  {
+    return false;
+  }
+  strcpy(_m->peerServices[_m->peerServiceCnt++], uuid);
+  return true;
+}
+
+uint16_t rn487x_sim_peerAddCharact(const char *uuid, uint8_t property, const uint8_t *value, uint8_t len)
+{
+  uint16_t handle = RN487X_SIM_PEER_FIRST_HANDLE;
+  if (_m->peerServiceCnt == 0 || _m->peerCharactCnt >= RN487X_SIM_MAX_CHARACTS ||
+      strlen(uuid) >= UUID_STR_LEN || len > RN487X_SIM_MAX_VALUE_LEN)
+  {
+    return 0;
+  }
+  if (_m->peerCharactCnt > 0)
+  {
+    _sim_charact_t *last = &_m->peerCharacts[_m->peerCharactCnt - 1];
+    handle = _m->peerAttrs[_m->peerCharactCnt - 1].handle + ((last->property & PROP_NOTIFY_MASK) ? 3 : 2);
+  }
+  _sim_charact_t *ch = &_m->peerCharacts[_m->peerCharactCnt];
+  _sim_attr_t *attr = &_m->peerAttrs[_m->peerCharactCnt];
+  strcpy(ch->uuid, uuid);
+  ch->service = _m->peerServiceCnt - 1;
+  ch->property = property;
+  ch->length = len;
+  attr->handle = handle;
+  attr->valueLen = len;
+  memcpy(attr->value, value, len);
+  _m->peerCharactCnt++;
+  return handle;
+}
+
+bool rn487x_sim_peerValue(uint16_t handle, uint8_t *value, uint8_t *len)
+{
+  _sim_attr_t *attr = _findPeerAttr(handle);
+  if (attr == NULL)
+  {
+    return false;
+  }
+  memcpy(value, attr->value, attr->valueLen);
+  *len = attr->valueLen;
+  return true;
+}
+
+void rn487x_sim_setFaults(const rn487x_sim_faults_t *faults)
+{
+  _m->faults = *faults;
+  _m->faultRng = faults->seed ? faults->seed : 1;
+}
+
+void rn487x_sim_getStats(rn487x_sim_stats_t *stats)
+{
+  *stats = _m->stats;
+  if (_asleep())
+  {
+    stats->sleepUs += (_now_ns - _m->sleepSinceNs) / 1000;
+  }
+}
+
+void rn487x_sim_resetStats(void)
+{
+  memset(&_m->stats, 0, sizeof(_m->stats));
+  _m->sleepSinceNs = _now_ns;
+}
+
+/**
+ ===============================================================================
+            ##### eonOS stand-in #####
+ ===============================================================================
+*/
+void gpio_mode(uint8_t pin, uint8_t mode, uint8_t pull, uint8_t speed)
+{
+  (void)pin;
+  (void)mode;
+  (void)pull;
+  (void)speed;
+}
+
+void gpio_reset(uint8_t pin)
+{
+  if (pin == RN487X_RESET_PIN)
+  {
+    // Held in reset: the module is silent and anything in flight is lost
+    _sleepUpdate(false);
+    _m->state = MODULE_OFF;
+    _rxClear();
+  }
+  if (pin == RN487X_WAKE_PIN && _m->wakeHigh)
+  {
+    if (_asleep())
+    {
+      _m->wakeReadyNs = _now_ns + (uint64_t)_cfg.wakeTimeUs * 1000;
+    }
+    _sleepUpdate(false);
+    _m->wakeHigh = false;
+  }
+}
+
+void gpio_set(uint8_t pin)
+{
+  if (pin == RN487X_RESET_PIN && _m->state == MODULE_OFF)
+  {
+    _startBoot(_now_ns);
+  }
+  if (pin == RN487X_WAKE_PIN && !_m->wakeHigh)
+  {
+    _m->wakeHigh = true;
+    _sleepUpdate(true);
+  }
+}
+
+uint32_t millis(void)
+{
+  if (_interruptDriven())
+  {
+    // Interrupt-fed drivers spin on the clock instead of uart1_available()
+    _now_ns += _cfg.pollCostNs;
+    _sync();
+  }
+  return (uint32_t)(_now_ns / 1000000);
+}
+
+uint32_t micros(void)
+{
+  return (uint32_t)(_now_ns / 1000);
+}
+
+void delay(uint32_t ms)
+{
+  rn487x_sim_advance((uint64_t)ms * 1000);
+}
+
+void uart1_write(uint8_t c)
+{
+  // Blocking transmit: the CPU is busy for a whole character time,
+  // plus the time CTS holds it back
+  uint64_t ready = _ctsReadyAt();
+  if (ready > _now_ns)
+  {
+    _now_ns = ready;
+  }
+  _now_ns += _m->byteNs;
+  _m->stats.txBytes++;
+  _moduleRx(_linkOk() ? c : GARBLED);
+}
+
+void uart1_set_baudrate(uint32_t baudrate)
+{
+  _m->hostBaud = baudrate;
+  _m->byteNs = 10ULL * 1000000000ULL / baudrate;
+}
+
+void uart1_set_flow_control(bool enable)
+{
+  _m->hostFlow = enable;
+}
+
+void uart1_dma_start(const uint8_t *buf, uint16_t len)
+{
+  if (_m->dmaBusy)
+  {
+    fprintf(stderr, "[sim] uart1_dma_start while a transfer is running\n");
+    exit(1);
+  }
+  if (len == 0)
+  {
+    return;
+  }
+  _m->dmaBuf = buf;
+  _m->dmaLen = len;
+  _m->dmaPos = 0;
+  _m->dmaNextNs = _now_ns + _m->byteNs;
+  _m->dmaBusy = true;
+}
+
+void uart1_print(const char *str)
+{
+  while (*str)
+  {
+    uart1_write((uint8_t)*str++);
+  }
+}
+
+int uart1_available(void)
+{
+  int n = 0;
+  _sync();
+  for (uint16_t i = _m->rxTail; i != _m->rxHead && _m->rxQueue[i].at <= _now_ns; i = (i + 1) % RX_QUEUE_LEN)
+  {
+    n++;
+  }
+  if (n == 0)
+  {
+    _now_ns += _cfg.pollCostNs;
+  }
+  return n;
+}
+
+int uart1_read(void)
+{
+  if (_m->rxTail == _m->rxHead || _m->rxQueue[_m->rxTail].at > _now_ns)
+  {
+    return -1;
+  }
+  uint8_t c = _rxTake();
+  _m->stats.rxBytes++;
+  return c;
+}
+
+void uart2_print(const char *str)
+{
+  fputs(str, stderr);
+}
+
+void uart2_println(const char *str)
+{
+  fputs(str, stderr);
+  fputc('\n', stderr);
+}
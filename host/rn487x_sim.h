@@ -0,0 +1,144 @@
+#ifndef __RN487X_SIM
+#define __RN487X_SIM
+
+/**
+ ===============================================================================
+    RN4870/71 host simulator.
+
+    A virtual microsecond clock drives a simulated uart1 and a scripted
+    command-mode emulator. Bytes written by the driver cost one character
+    time at the host baud rate; the emulator answers after a configurable
+    processing latency, one character time per reply byte at the module
+    baud rate. While the two ends disagree on the rate or on RTS/CTS,
+    every byte arrives garbled; faster than maxBaudNoFlow without
+    RTS/CTS, the module bytes do. With RTS/CTS, the module holds the host
+    back while its transparent UART buffer is full.
+    A scripted peer answers the client role commands (CI, LC, CHR, CHW)
+    while connected; each ATT request starts at a connection event and
+    is answered one connection interval later.
+    With low power on (SO,1, from the next boot) the module sleeps while
+    the wake line (RN487X_WAKE_PIN) is high and drops host bytes until
+    wakeTimeUs after the line goes low again. O,0 makes it dormant
+    until a reset.
+    Fault injection (rn487x_sim_setFaults) models a noisy UART: the reply
+    of a command line may be lost, the command being executed all the
+    same, or come late.
+    Busy-wait loops on uart1_available() advance the clock by a small
+    polling cost, so timeouts expire in simulated time, not wall time.
+    Several modules on separate UARTs share the clock: uart1, the reset
+    line and every rn487x_sim_* call below act on the selected module
+    (module 0 after rn487x_sim_init), and the statistics are per module.
+ ===============================================================================
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define RN487X_SIM_MAX_SERVICES 4
+#define RN487X_SIM_MAX_CHARACTS 24
+#define RN487X_SIM_MAX_VALUE_LEN 20
+#define RN487X_SIM_FIRST_HANDLE 0x0072
+#define RN487X_SIM_PEER_FIRST_HANDLE 0x0010
+#define RN487X_SIM_MODULES 4
+
+typedef struct
+{
+  uint32_t baudrate;       // initial line rate of both ends (module default)
+  uint32_t replyLatencyUs; // time from the command CR to the first reply byte
+  uint32_t bootTimeUs;     // time from reset release or R,1 to %REBOOT%
+  uint32_t pollCostNs;     // simulated CPU cost of an idle uart1_available() poll
+  uint32_t airRate;        // [B/s] transparent UART data the link carries to the peer
+  uint16_t streamBufLen;   // module buffer for transparent UART data waiting for the link
+  uint32_t maxBaudNoFlow;  // fastest rate that is reliable without RTS/CTS
+  uint32_t connIntervalUs; // connection interval with the peer
+  uint32_t wakeTimeUs;     // from the wake line going low to a usable UART (low power)
+} rn487x_sim_config_t;
+
+typedef struct
+{
+  uint32_t txBytes;  // bytes written by the host
+  uint32_t rxBytes;  // bytes read by the host
+  uint32_t commands; // command lines parsed by the emulator
+  uint32_t reboots;  // resets and R,1 reboots
+  uint32_t streamBytes;    // transparent UART bytes accepted for the peer
+  uint32_t streamOverruns; // transparent UART bytes lost on a full module buffer
+  uint32_t sleepLost;      // host bytes lost on a sleeping or waking module
+  uint64_t sleepUs;        // time asleep in low power mode (SO,1, wake line high)
+  uint32_t lostReplies;    // command replies dropped by fault injection
+  uint32_t slowReplies;    // command replies delayed by fault injection
+} rn487x_sim_stats_t;
+
+// Faults per 1000 command lines, drawn from a generator seeded with seed
+typedef struct
+{
+  uint16_t lostPermille; // reply and prompt never sent
+  uint16_t slowPermille; // reply sent slowUs late
+  uint32_t slowUs;
+  uint32_t seed;
+} rn487x_sim_faults_t;
+
+// Fills cfg with values close to a real RN4871 at 115200 baud
+void rn487x_sim_defaultConfig(rn487x_sim_config_t *cfg);
+
+// Resets the clock, the UARTs and the modules (flash content included)
+void rn487x_sim_init(const rn487x_sim_config_t *cfg);
+
+// Selects the module uart1 and the reset line are wired to
+void rn487x_sim_select(uint8_t module);
+uint8_t rn487x_sim_selected(void);
+
+// Simulated time since rn487x_sim_init
+uint64_t rn487x_sim_micros(void);
+
+// Advances the simulated clock
+void rn487x_sim_advance(uint64_t us);
+
+// Delivers every received byte to isr as soon as it is due, like a UART
+// RX interrupt, instead of leaving it for uart1_read()
+void rn487x_sim_attachRxIsr(void (*isr)(uint8_t c, void *arg), void *arg);
+
+// Calls isr when the transfer started by uart1_dma_start() is complete,
+// like a DMA transfer-complete interrupt. The bytes are read from the
+// caller buffer at their wire time, so a buffer reused too early shows
+// up as corrupted commands; starting a transfer while one is running
+// aborts the simulation.
+void rn487x_sim_attachTxDmaIsr(void (*isr)(void *arg), void *arg);
+
+// Remote peer: connection events and writes to local characteristics
+void rn487x_sim_connect(void);
+void rn487x_sim_disconnect(void);
+bool rn487x_sim_remoteWrite(uint16_t handle, const uint8_t *value, uint8_t len);
+
+// Advertisement of a nearby device, reported while the module scans
+// (F until X), in the broadcast format %<address>,<type>,<RSSI>,Brcst:<data>%.
+// Returns false when the module is not scanning.
+bool rn487x_sim_advertise(const uint8_t address[6], uint8_t type, int8_t rssi, const uint8_t *data, uint8_t len);
+
+// Cuts the event "%<event>%" into the next reply of at least after + 1
+// bytes, after its first 'after' bytes, as the module does when an event
+// comes up while it is answering.
+void rn487x_sim_eventInReply(const char *event, uint8_t after);
+
+// Data written by the peer to the transparent UART service, forwarded to
+// the host as is. Returns false unless connected in data mode.
+bool rn487x_sim_peerSend(const uint8_t *data, uint16_t len);
+
+// Beacon payload on air, as set by IB,Z and IB,<AD type>,<data> (kept
+// whatever the SC setting), in advertising data format. Returns its length.
+uint8_t rn487x_sim_beacon(uint8_t *data);
+
+// Scripted peer for the client role. Services and characteristics are
+// listed in the order they are added; rn487x_sim_peerAddCharact returns
+// the handle of the new characteristic, 0 when the table is full.
+void rn487x_sim_peerReset(void);
+bool rn487x_sim_peerAddService(const char *uuid);
+uint16_t rn487x_sim_peerAddCharact(const char *uuid, uint8_t property, const uint8_t *value, uint8_t len);
+bool rn487x_sim_peerValue(uint16_t handle, uint8_t *value, uint8_t *len);
+
+// Faults of the selected module, none after rn487x_sim_init
+void rn487x_sim_setFaults(const rn487x_sim_faults_t *faults);
+
+void rn487x_sim_getStats(rn487x_sim_stats_t *stats);
+void rn487x_sim_resetStats(void);
+
+#endif
@@ -0,0 +1,98 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime, pthread_cond_timedwait
+
+#include "rn487x_task_posix.h"
+#include <sched.h>
+#include <time.h>
+
+/**
+ ===============================================================================
+            ##### Private functions #####
+ ===============================================================================
+ */
+static void _lock(void *arg)
+{
+  rn487x_posix_t *port = arg;
+  pthread_mutex_lock(&port->lanes);
+}
+
+static void _unlock(void *arg)
+{
+  rn487x_posix_t *port = arg;
+  pthread_mutex_unlock(&port->lanes);
+}
+
+static void _wake(void *arg)
+{
+  rn487x_posix_t *port = arg;
+  pthread_mutex_lock(&port->sync);
+  port->wake = true;
+  pthread_cond_broadcast(&port->cond);
+  pthread_mutex_unlock(&port->sync);
+}
+
+// A wall clock sleep: the simulated clock only runs while the driver
+// task polls, so nothing happens on the module in the meantime
+static void _sleep(void *arg, uint32_t ms)
+{
+  rn487x_posix_t *port = arg;
+  struct timespec until;
+  if (ms == 0)
+  {
+    sched_yield();
+    return;
+  }
+  clock_gettime(CLOCK_REALTIME, &until);
+  until.tv_sec += ms / 1000;
+  until.tv_nsec += (long)(ms % 1000) * 1000000L;
+  if (until.tv_nsec >= 1000000000L)
+  {
+    until.tv_sec++;
+    until.tv_nsec -= 1000000000L;
+  }
+  pthread_mutex_lock(&port->sync);
+  while (!port->wake && pthread_cond_timedwait(&port->cond, &port->sync, &until) == 0)
+  {
+  }
+  port->wake = false;
+  pthread_mutex_unlock(&port->sync);
+}
+
+static void _notify(void *arg, rn487x_req_t *req)
+{
+  rn487x_posix_t *port = arg;
+  (void)req;
+  pthread_mutex_lock(&port->sync);
+  pthread_cond_broadcast(&port->cond);
+  pthread_mutex_unlock(&port->sync);
+}
+
+static void _wait(void *arg, rn487x_req_t *req)
+{
+  rn487x_posix_t *port = arg;
+  pthread_mutex_lock(&port->sync);
+  while (!req->done)
+  {
+    pthread_cond_wait(&port->cond, &port->sync);
+  }
+  pthread_mutex_unlock(&port->sync);
+}
+
+/**
+ ===============================================================================
+            ##### Public functions #####
+ ===============================================================================
+ */
+void rn487x_posix_setup(rn487x_posix_t *port, rn487x_os_t *os)
+{
+  pthread_mutex_init(&port->lanes, NULL);
+  pthread_mutex_init(&port->sync, NULL);
+  pthread_cond_init(&port->cond, NULL);
+  port->wake = false;
+  os->lock = _lock;
+  os->unlock = _unlock;
+  os->wake = _wake;
+  os->sleep = _sleep;
+  os->notify = _notify;
+  os->wait = _wait;
+  os->arg = port;
+}
@@ -0,0 +1,26 @@
+#ifndef __RN487X_TASK_POSIX
+#define __RN487X_TASK_POSIX
+
+/**
+ ===============================================================================
+    pthreads port of the driver task (rn487x_task.h), the Linux stand-in
+    for an RTOS. One mutex guards the lanes, a second one and a condition
+    variable carry the driver wake-ups and the request completions.
+ ===============================================================================
+ */
+
+#include "rn487x_task.h"
+#include <pthread.h>
+
+typedef struct
+{
+  pthread_mutex_t lanes;
+  pthread_mutex_t sync;
+  pthread_cond_t cond;
+  bool wake; // latched until the driver task sleeps
+} rn487x_posix_t;
+
+// Initializes port and fills os with the functions using it
+void rn487x_posix_setup(rn487x_posix_t *port, rn487x_os_t *os);
+
+#endif
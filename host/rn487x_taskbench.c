@@ -0,0 +1,209 @@
+// Contention benchmark of the driver task (rn487x_task.h) on the pthreads
+// port. Three client threads share one module: telemetry writes a value
+// at a time, config lists the characteristics in bursts, status reads the
+// version. Latencies are simulated time from the driver poll that first
+// sees a request to its completion; which requests meet in the queue
+// depends on the thread scheduling, so the figures vary a little. A
+// failed or missing request, or a lane overtaken more often than the
+// rn487x_task.h bound, makes the exit status nonzero.
+
+#include "rn487x.h"
+#include "rn487x_const.h"
+#include "rn487x_sim.h"
+#include "rn487x_task.h"
+#include "rn487x_task_posix.h"
+#include <stdatomic.h>
+#include <stdio.h>
+
+#define SERVICE_UUID "AD11CF40063F11E5BE3E0002A5D5C51B"
+#define CHARACT_UUID(__n__) "BF3FBD80063F11E59E690002A5D5C5" __n__
+#define TELEMETRY_WRITES 200
+#define CONFIG_BURSTS 20
+#define CONFIG_BURST_LEN 3
+#define STATUS_READS 100
+
+typedef struct
+{
+  const char *name;
+  uint32_t requests;
+  uint32_t failures;
+  uint64_t totalUs;
+  uint32_t maxUs;
+} client_stat_t;
+
+static rn487x_posix_t _port;
+static rn487x_task_t _task;
+static atomic_bool _stop;
+static bool _lanes; // false: every request on RN487X_LANE_NORMAL, first come first served
+
+static ble_charact_t _characts[2];
+static const rn487x_charact_def_t _characts_def[] = {
+    {CHARACT_UUID("00"), BLE_PROPERTY_READ | BLE_PROPERTY_WRITE, 4, &_characts[0]},
+    {CHARACT_UUID("01"), BLE_PROPERTY_READ | BLE_PROPERTY_WRITE, 4, &_characts[1]},
+};
+static const rn487x_service_def_t _schema[] = {
+    {SERVICE_UUID, _characts_def, 2},
+};
+
+// Completion on the driver thread, the only one reading the clock
+static void _reqDone(rn487x_req_t *req)
+{
+  client_stat_t *st = req->arg;
+  uint32_t us = micros() - req->queuedAt;
+  st->requests++;
+  st->failures += (req->cmd.status == RN487X_CMD_OK) ? 0 : 1;
+  st->totalUs += us;
+  st->maxUs = (us > st->maxUs) ? us : st->maxUs;
+}
+
+// LS listing lines, before the END completing the request
+static void _listLine(rn487x_cmd_t *cmd, const char *line, uint16_t len)
+{
+  (void)cmd;
+  (void)line;
+  (void)len;
+}
+
+static rn487x_lane_t _lane(rn487x_lane_t lane)
+{
+  return _lanes ? lane : RN487X_LANE_NORMAL;
+}
+
+/**
+ ===============================================================================
+            ##### Threads #####
+ ===============================================================================
+*/
+static void *_driver(void *arg)
+{
+  (void)arg;
+  while (!atomic_load(&_stop))
+  {
+    _task.os.sleep(_task.os.arg, rn487x_task_poll(&_task));
+  }
+  return NULL;
+}
+
+static void *_telemetry(void *arg)
+{
+  rn487x_req_t req = {.callback = _reqDone, .arg = arg};
+  uint8_t value[4] = {0};
+  rn487x_charact_write_t write = {.charact = &_characts[0], .value = value};
+  for (uint16_t k = 0; k < TELEMETRY_WRITES; k++)
+  {
+    value[0] = k;
+    value[1] = k >> 8;
+    rn487x_reqWriteLocalCharact(&req, &write);
+    rn487x_task_call(&_task, &req, _lane(RN487X_LANE_HIGH));
+  }
+  return NULL;
+}
+
+static void *_config(void *arg)
+{
+  rn487x_req_t reqs[CONFIG_BURST_LEN] = {{.callback = NULL}};
+  for (uint8_t k = 0; k < CONFIG_BURSTS; k++)
+  {
+    for (uint8_t i = 0; i < CONFIG_BURST_LEN; i++)
+    {
+      reqs[i].callback = _reqDone;
+      reqs[i].arg = arg;
+      rn487x_reqCommand(&reqs[i], LIST_CHARACTERISTICS, PROMPT_END, LIST_CMD_TIMEOUT);
+      reqs[i].cmd.onLine = _listLine;
+      rn487x_task_post(&_task, &reqs[i], _lane(RN487X_LANE_LOW));
+    }
+    for (uint8_t i = 0; i < CONFIG_BURST_LEN; i++)
+    {
+      _task.os.wait(_task.os.arg, &reqs[i]);
+    }
+  }
+  return NULL;
+}
+
+static void *_status(void *arg)
+{
+  rn487x_req_t req = {.callback = _reqDone, .arg = arg};
+  for (uint8_t k = 0; k < STATUS_READS; k++)
+  {
+    rn487x_reqCommand(&req, "V", "RN487", DEFAULT_CMD_TIMEOUT);
+    rn487x_task_call(&_task, &req, _lane(RN487X_LANE_NORMAL));
+  }
+  return NULL;
+}
+
+/**
+ ===============================================================================
+            ##### Benchmark #####
+ ===============================================================================
+*/
+static bool _run(bool lanes)
+{
+  static const uint32_t expected[3] = {TELEMETRY_WRITES, CONFIG_BURSTS * CONFIG_BURST_LEN, STATUS_READS};
+  bool ok = true;
+  client_stat_t stats[3] = {{.name = "telemetry SHW"}, {.name = "config LS"}, {.name = "status V"}};
+  void *(*clients[3])(void *) = {_telemetry, _config, _status};
+  pthread_t driver, threads[3];
+  uint64_t start = rn487x_sim_micros();
+
+  _lanes = lanes;
+  atomic_store(&_stop, false);
+  pthread_create(&driver, NULL, _driver, NULL);
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    pthread_create(&threads[i], NULL, clients[i], &stats[i]);
+  }
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    pthread_join(threads[i], NULL);
+  }
+  atomic_store(&_stop, true);
+  _task.os.wake(_task.os.arg);
+  pthread_join(driver, NULL);
+
+  printf("%s, %.1f ms in all\n", lanes ? "priority lanes" : "one lane (FIFO)",
+         (double)(rn487x_sim_micros() - start) / 1000.0);
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    uint32_t n = stats[i].requests ? stats[i].requests : 1;
+    printf("  %-26s %6u %6u %12.3f %12.3f\n", stats[i].name, stats[i].requests, stats[i].failures,
+           (double)stats[i].totalUs / n / 1000.0, (double)stats[i].maxUs / 1000.0);
+    if (stats[i].requests != expected[i] || stats[i].failures != 0)
+    {
+      printf("FAIL: %s\n", stats[i].name);
+      ok = false;
+    }
+  }
+  // No lane starves behind a busier one
+  for (uint8_t l = 0; l < RN487X_LANES; l++)
+  {
+    rn487x_lane_stats_t ls;
+    rn487x_task_stats(&_task, l, &ls);
+    if (ls.passedMax > RN487X_TASK_BURST + RN487X_LANES - 1)
+    {
+      printf("FAIL: lane %u overtaken %u times\n", l, ls.passedMax);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+int main(void)
+{
+  rn487x_sim_config_t cfg;
+  rn487x_os_t os;
+
+  rn487x_sim_defaultConfig(&cfg);
+  rn487x_sim_init(&cfg);
+  if (!rn487x_init() || !rn487x_cmdMode() || rn487x_applySchema(_schema, 1) < 0 || !rn487x_cmdMode())
+  {
+    printf("module setup failed\n");
+    return 1;
+  }
+  rn487x_posix_setup(&_port, &os);
+  rn487x_task_setup(&_task, rn487x_defaultDevice(), &os);
+
+  printf("%-28s %6s %6s %12s %12s\n", "driver task", "calls", "fails", "avg [ms]", "max [ms]");
+  bool ok = _run(false);
+  ok = _run(true) && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+// Decoder of the binary trace (RN487X_TRACE, rn487x_trace.h): reads the
+// records of a dump, a file or stdin, and prints one line per record with
+// its time, the time since the previous record and its arguments.
+//
+//   rn487x_tracedump [dump]
+
+#include "rn487x_trace.h"
+#include <stdio.h>
+#include <string.h>
+
+#define TRACE_LABEL(__id__, __label__, __a__, __b__, __c__) __label__,
+#define TRACE_ARG_A(__id__, __label__, __a__, __b__, __c__) __a__,
+#define TRACE_ARG_B(__id__, __label__, __a__, __b__, __c__) __b__,
+#define TRACE_ARG_C(__id__, __label__, __a__, __b__, __c__) __c__,
+
+static const char *const _labels[] = {RN487X_TRACE_IDS(TRACE_LABEL)};
+static const char *const _args_a[] = {RN487X_TRACE_IDS(TRACE_ARG_A)};
+static const char *const _args_b[] = {RN487X_TRACE_IDS(TRACE_ARG_B)};
+static const char *const _args_c[] = {RN487X_TRACE_IDS(TRACE_ARG_C)};
+
+// rn487x_status_t and rn487x_power_state_t, in declaration order
+static const char *const _status[] = {"queued", "sent", "ok", "err", "timeout"};
+static const char *const _power[] = {"awake", "waking", "sleep", "dormant"};
+
+static uint32_t _le(const uint8_t *p, uint8_t n)
+{
+  uint32_t v = 0;
+  while (n-- > 0)
+  {
+    v = (v << 8) | p[n];
+  }
+  return v;
+}
+
+static void _printText(uint32_t c)
+{
+  putchar('"');
+  for (uint8_t i = 0; i < 4 && (c >> (8 * i)) != 0; i++)
+  {
+    uint8_t ch = c >> (8 * i);
+    if (ch >= 0x20 && ch < 0x7F)
+    {
+      putchar(ch);
+    }
+    else
+    {
+      printf("\\x%02X", ch);
+    }
+  }
+  putchar('"');
+}
+
+// Numeric argument, by name where the trace point gives it one
+static void _printArg(uint8_t id, const char *name, uint32_t value)
+{
+  if (name == NULL)
+  {
+    return;
+  }
+  printf(" %s=", name);
+  if (id == RN487X_TRACE_CMD_DONE && name == _args_a[id] && value < sizeof(_status) / sizeof(_status[0]))
+  {
+    printf("%s", _status[value]);
+  }
+  else if (id == RN487X_TRACE_POWER && value < sizeof(_power) / sizeof(_power[0]))
+  {
+    printf("%s", _power[value]);
+  }
+  else
+  {
+    printf("%u", value);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  FILE *in = stdin;
+  uint8_t raw[RN487X_TRACE_REC_SIZE];
+  rn487x_trace_rec_t rec;
+  uint32_t prev = 0;
+  uint32_t count = 0;
+
+  if (argc > 1 && (in = fopen(argv[1], "rb")) == NULL)
+  {
+    perror(argv[1]);
+    return 1;
+  }
+  while (fread(raw, 1, sizeof(raw), in) == sizeof(raw))
+  {
+    rec.us = _le(&raw[0], 4);
+    rec.id = raw[4];
+    rec.a = raw[5];
+    rec.b = _le(&raw[6], 2);
+    rec.c = _le(&raw[8], 4);
+
+    printf("%12.3f ms %+9.3f  ", rec.us / 1000.0, count ? (int32_t)(rec.us - prev) / 1000.0 : 0.0);
+    prev = rec.us;
+    count++;
+    if (rec.id >= RN487X_TRACE_ID_COUNT)
+    {
+      printf("unknown id %u\n", rec.id);
+      continue;
+    }
+    printf("%-10s", _labels[rec.id]);
+    _printArg(rec.id, _args_a[rec.id], rec.a);
+    _printArg(rec.id, _args_b[rec.id], rec.b);
+    if (_args_c[rec.id] != NULL && strcmp(_args_c[rec.id], "text") == 0)
+    {
+      printf(" ");
+      _printText(rec.c);
+    }
+    else
+    {
+      _printArg(rec.id, _args_c[rec.id], rec.c);
+    }
+    printf("\n");
+  }
+  if (in != stdin)
+  {
+    fclose(in);
+  }
+  return 0;
+}